@@ -0,0 +1,20 @@
+// CacheLine.hpp
+// Header file for the cache line width shared by the containers
+// 缓存行宽度，供RingBuffer/FixedMemPool/FlatMap共用
+
+#ifndef TOYLIB_CACHE_LINE_HEADER
+#define TOYLIB_CACHE_LINE_HEADER
+
+#include <cstddef>
+
+namespace toylib {
+
+// Cache line width used to align data written by different threads.
+// Pinned to 64 instead of std::hardware_destructive_interference_size: that value may change with compiler
+// flags (GCC warns with -Winterference-size), and the alignment of pool blocks and ring buffer indexes must not
+// differ between translation units.
+constexpr size_t DEFAULT_CACHE_LINE_WIDTH = 64;
+
+} // namespace toylib
+
+#endif // TOYLIB_CACHE_LINE_HEADER
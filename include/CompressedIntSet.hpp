@@ -0,0 +1,269 @@
+// CompressedIntSet.hpp
+// Header file for read-only sorted set of 64-bit unsigned integers, stored delta encoded and bit packed
+// 压缩的有序整数集合头文件
+
+#ifndef TOYLIB_COMPRESSED_INT_SET_HEADER
+#define TOYLIB_COMPRESSED_INT_SET_HEADER
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+namespace toylib {
+
+// 压缩整数集合
+// Sorted unique uint64_t values are cut into blocks of block_size values.
+// Each block keeps its first value in a skip index, the gaps to the following values (minus one, they are at least 1)
+// are bit packed with the smallest width holding the largest gap of the block.
+// Dense ID sets take a few bits per value instead of 8 bytes, and scans read that much less memory.
+// Lookup binary searches the skip index, then decodes at most one block, O(log(n / block_size) + block_size)
+// 注：
+// 1. 只读，由有序无重复的输入一次性构建
+// 2. 迭代器逐个解码，不支持随机访问和修改
+// 3. 构建后不修改，多线程并发读取是安全的
+class compressed_int_set {
+public:
+    static constexpr size_t block_size = 128;
+
+private:
+    std::vector<uint64_t> firsts_;      // skip index, first value of every block
+    std::vector<uint64_t> offsets_;     // bit offset of every block's packed gaps in bits_
+    std::vector<uint8_t> widths_;       // bits per packed gap of every block
+    std::vector<uint64_t> bits_;
+    uint64_t total_bits_;
+    size_t size_;
+
+    static unsigned bit_width(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+        return x ? static_cast<unsigned>(64 - __builtin_clzll(x)) : 0;
+#else
+        unsigned n = 0;
+        while (x) {
+            x >>= 1;
+            n++;
+        }
+        return n;
+#endif
+    }
+
+    static uint64_t width_mask(unsigned width) {
+        return width == 64 ? ~uint64_t(0) : (uint64_t(1) << width) - 1;
+    }
+
+    // bits_ is padded so the word after pos can always be read, even for zero width gaps at total_bits_, no branch is needed
+    uint64_t read_bits(uint64_t pos, uint64_t mask) const {
+        size_t w = static_cast<size_t>(pos >> 6);
+        unsigned shift = static_cast<unsigned>(pos & 63);
+        // split shift, a single shift by 64 - shift is undefined when shift is 0
+        uint64_t v = (bits_[w] >> shift) | ((bits_[w + 1] << 1) << (63 - shift));
+        return v & mask;
+    }
+
+    void write_bits(uint64_t pos, uint64_t v, unsigned width) {
+        if (!width) return;
+        size_t w = static_cast<size_t>(pos >> 6);
+        unsigned shift = static_cast<unsigned>(pos & 63);
+        bits_[w] |= v << shift;
+        if (shift + width > 64) {
+            bits_[w + 1] |= v >> (64 - shift);
+        }
+    }
+
+    // encode v[0, n) as one block
+    void add_block(const uint64_t* v, size_t n) {
+        uint64_t gaps = 0;
+        for (size_t i = 1; i < n; i++) {
+            gaps |= v[i] - v[i - 1] - 1;    // same highest bit as the largest gap
+        }
+        unsigned width = bit_width(gaps);
+        firsts_.push_back(v[0]);
+        offsets_.push_back(total_bits_);
+        widths_.push_back(static_cast<uint8_t>(width));
+        uint64_t pos = total_bits_;
+        total_bits_ += static_cast<uint64_t>(width) * (n - 1);
+        bits_.resize(static_cast<size_t>(total_bits_ / 64) + 2, 0);
+        for (size_t i = 1; i < n; i++) {
+            write_bits(pos, v[i] - v[i - 1] - 1, width);
+            pos += width;
+        }
+    }
+
+    size_t block_length(size_t b) const {
+        size_t rest = size_ - b * block_size;
+        return rest < block_size ? rest : block_size;
+    }
+
+public:
+    // forward iterator decoding one value per step
+    class const_iterator {
+    private:
+        const compressed_int_set* set_;
+        size_t block_;
+        size_t left_;       // values after the current one in this block
+        uint64_t bit_pos_;  // next gap to decode
+        uint64_t mask_;
+        unsigned width_;
+        uint64_t value_;
+        friend class compressed_int_set;
+
+        const_iterator(const compressed_int_set* set, size_t block) : set_(set) {
+            load_block(block);
+        }
+
+        void load_block(size_t block) {
+            block_ = block;
+            if (block_ < set_->firsts_.size()) {
+                value_ = set_->firsts_[block_];
+                bit_pos_ = set_->offsets_[block_];
+                width_ = set_->widths_[block_];
+                mask_ = width_mask(width_);
+                left_ = set_->block_length(block_) - 1;
+            } else {
+                value_ = 0;
+                bit_pos_ = 0;
+                width_ = 0;
+                mask_ = 0;
+                left_ = 0;
+            }
+        }
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = uint64_t;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const uint64_t*;
+        using reference = const uint64_t&;
+
+        const_iterator() : set_(nullptr), block_(0), left_(0), bit_pos_(0), mask_(0), width_(0), value_(0) {}
+        reference operator*() const {
+            return value_;
+        }
+        pointer operator->() const {
+            return &value_;
+        }
+        const_iterator& operator++() {
+            if (left_ == 0) {
+                load_block(block_ + 1);
+            } else {
+                value_ += set_->read_bits(bit_pos_, mask_) + 1;
+                bit_pos_ += width_;
+                left_--;
+            }
+            return *this;
+        }
+        const_iterator operator++(int) {
+            const_iterator tmp = *this;
+            ++(*this);
+            return tmp;
+        }
+        bool operator==(const const_iterator& other) const {
+            return block_ == other.block_ && left_ == other.left_;
+        }
+        bool operator!=(const const_iterator& other) const {
+            return !(*this == other);
+        }
+    };
+    using iterator = const_iterator;
+
+    compressed_int_set() : bits_(2, 0), total_bits_(0), size_(0) {}
+
+    // @brief Build from values in strictly ascending order, input is read once
+    // @throw std::invalid_argument if the input is not sorted or has duplicates
+    template <typename InputIt>
+    compressed_int_set(InputIt first, InputIt last) : bits_(2, 0), total_bits_(0), size_(0) {
+        uint64_t block[block_size];
+        size_t n = 0;
+        uint64_t prev = 0;
+        for (; first != last; ++first) {
+            uint64_t v = static_cast<uint64_t>(*first);
+            if ((n || size_) && v <= prev) {
+                throw std::invalid_argument("compressed_int_set: input is not sorted or has duplicates");
+            }
+            prev = v;
+            block[n++] = v;
+            if (n == block_size) {
+                add_block(block, n);
+                size_ += n;
+                n = 0;
+            }
+        }
+        if (n) {
+            add_block(block, n);
+            size_ += n;
+        }
+        bits_.shrink_to_fit();
+        firsts_.shrink_to_fit();
+        offsets_.shrink_to_fit();
+        widths_.shrink_to_fit();
+    }
+
+    explicit compressed_int_set(const std::vector<uint64_t>& sorted) : compressed_int_set(sorted.begin(), sorted.end()) {}
+
+    // @return first value not less than v, end() if there is none
+    const_iterator lower_bound(uint64_t v) const {
+        // last block starting at or before v
+        size_t b = static_cast<size_t>(std::upper_bound(firsts_.begin(), firsts_.end(), v) - firsts_.begin());
+        if (b == 0) {
+            return begin();
+        }
+        const_iterator it(this, b - 1);
+        while (it.block_ == b - 1 && *it < v) {
+            ++it;
+        }
+        return it;
+    }
+
+    size_t count(uint64_t v) const {
+        const_iterator it = lower_bound(v);
+        return (it != end() && *it == v) ? 1 : 0;
+    }
+
+    // @brief Call fn(value) for every value in order, decodes block by block in a tight loop, faster than iterators
+    template <typename Fn>
+    void for_each(Fn fn) const {
+        for (size_t b = 0; b < firsts_.size(); b++) {
+            uint64_t v = firsts_[b];
+            uint64_t pos = offsets_[b];
+            const unsigned width = widths_[b];
+            const uint64_t mask = width_mask(width);
+            const size_t n = block_length(b);
+            fn(v);
+            for (size_t i = 1; i < n; i++) {
+                v += read_bits(pos, mask) + 1;
+                pos += width;
+                fn(v);
+            }
+        }
+    }
+
+    const_iterator begin() const {
+        return const_iterator(this, 0);
+    }
+    const_iterator end() const {
+        return const_iterator(this, firsts_.size());
+    }
+    const_iterator cbegin() const {
+        return begin();
+    }
+    const_iterator cend() const {
+        return end();
+    }
+
+    size_t size() const {
+        return size_;
+    }
+    bool empty() const {
+        return size_ == 0;
+    }
+
+    // @return Bytes held by the set, including the skip index
+    size_t memory_usage() const {
+        return bits_.capacity() * sizeof(uint64_t) + firsts_.capacity() * sizeof(uint64_t) +
+               offsets_.capacity() * sizeof(uint64_t) + widths_.capacity() * sizeof(uint8_t);
+    }
+};
+
+}
+#endif
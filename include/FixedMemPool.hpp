@@ -7,9 +7,23 @@
 
 #include <cstddef>
 #include <memory>
+#include <new>
 #include <vector>
+#include <algorithm>
 #include <mutex>
+#include <atomic>
 #include <cassert>
+#include <cstdint>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <unistd.h>
+#define TOYLIB_MEMPOOL_HAS_MLOCK 1
+#endif
+
+#include "CacheLine.hpp"
 
 namespace toylib {
 
@@ -22,34 +36,130 @@ struct chunk {
     char data_[Size];
 };
 
+// count trailing zeros of a non-zero word, used to skip empty bitmap words
+static inline unsigned pool_ctz64(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+    return static_cast<unsigned>(__builtin_ctzll(x));
+#elif defined(_MSC_VER) && defined(_WIN64)
+    unsigned long idx;
+    _BitScanForward64(&idx, x);
+    return static_cast<unsigned>(idx);
+#else
+    unsigned n = 0;
+    while (!(x & 1)) {
+        x >>= 1;
+        n++;
+    }
+    return n;
+#endif
+}
+
+static inline unsigned pool_popcount64(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+    return static_cast<unsigned>(__builtin_popcountll(x));
+#else
+    unsigned n = 0;
+    while (x) {
+        x &= x - 1;
+        n++;
+    }
+    return n;
+#endif
+}
+
+// counters of fixed_mem_pool, see fixed_mem_pool::stats()
+struct mem_pool_stats {
+    size_t allocs_;         // blocks handed out since construction
+    size_t frees_;          // blocks returned since construction
+    size_t live_;           // blocks currently in use
+    size_t peak_live_;      // highest live_ ever reached
+    size_t chunks_;         // chunks allocated
+    size_t capacity_;       // blocks in all chunks
+};
+
+// size hints for fixed_mem_pool's constructor, rounded up to whole chunks
+struct prealloc_bytes {
+    size_t bytes_;
+    explicit prealloc_bytes(size_t bytes) : bytes_(bytes) {}
+};
+
+struct prealloc_objects {
+    size_t count_;
+    explicit prealloc_objects(size_t count) : count_(count) {}
+};
+
+static inline size_t pool_page_size() {
+#ifdef TOYLIB_MEMPOOL_HAS_MLOCK
+    long sz = sysconf(_SC_PAGESIZE);
+    if (sz > 0) return static_cast<size_t>(sz);
+#endif
+    return 4096;
+}
+
 // 简单的内存池实现
 // 注：
 // 1. 对象是连续分配的，发生越界时我们无法检测到，是未定义行为
-// 2. 指定的item_size需要考虑内存对齐
-template <size_t item_size, size_t chunk_size = 4096>
+// 2. 默认item_align为1，块按item_size紧密排列，指定的item_size需要考虑内存对齐
+// 3. 指定item_align时，每个块按item_align对齐并填充，chunk起始地址同样对齐，
+//    例如item_align = DEFAULT_CACHE_LINE_WIDTH可以避免不同线程的对象共享缓存行（false sharing）
+// 4. 每个chunk维护一个占用位图，用于遍历存活对象。位图在第一次调用for_each_live/chunk_occupancy时由空闲链表重建，
+//    之后才在alloc/free中维护，不需要遍历的池不承担这部分开销。debug模式下始终维护，用于检测double free
+template <size_t item_size, size_t chunk_size = 4096, size_t item_align = 1>
 class fixed_mem_pool {
 private:
     static_assert(item_size >= sizeof(mem_node*), "item_size must be greater than a pointer's size"); // NOLINT
-    static_assert(item_size <= chunk_size, "item_size must be less than or equal to chunk_size");
+    static_assert(item_align > 0 && (item_align & (item_align - 1)) == 0, "item_align must be a power of two");
+    // distance between two blocks, item_size padded to item_align
+    static constexpr size_t stride = (item_size + item_align - 1) / item_align * item_align;
+    static_assert(stride <= chunk_size, "padded item_size must be less than or equal to chunk_size");
+    // alignment every block is guaranteed to have: item_align, or what item_size and the chunk base (new[]) give in packed mode
+    static constexpr size_t block_align = item_align > 1 ? item_align
+        : ((stride & (~stride + 1)) < alignof(std::max_align_t) ? (stride & (~stride + 1)) : alignof(std::max_align_t));
+    static constexpr size_t items_per_chunk = chunk_size / stride;
+    static constexpr size_t bitmap_words = (items_per_chunk + 63) / 64;
+
+    // occupancy of one chunk, bit i is set when block i is handed out
+    struct chunk_info {
+        char* base_;
+        std::vector<uint64_t> live_;
+    };
+
     std::mutex chunk_latch_;    // protects chunks
     std::vector<std::unique_ptr<char[]>> chunks_;
 
-    std::mutex node_latch_;     // protects nodes
+    std::mutex node_latch_;     // protects nodes and index
     mem_node* head_;
+    std::vector<chunk_info> index_;     // sorted by base address
+    bool locked_;               // chunks are mlock-ed, set by warm_up(true)
+    bool tracking_;             // live bitmaps in index_ are up to date
+
+    // only written with node_latch_ held, atomic so that stats() can read them without the latch
+    std::atomic<size_t> allocs_;
+    std::atomic<size_t> frees_;
+    std::atomic<size_t> live_;
+    std::atomic<size_t> peak_live_;
+    std::atomic<size_t> chunks_count_;
+
+    // writers are serialized by node_latch_, a plain load/store is enough and avoids a locked instruction
+    static void add_relaxed(std::atomic<size_t>& counter, size_t delta) {
+        counter.store(counter.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+    }
 
-    mem_node* alloc_chunk_impl() {
-        auto new_chunk = std::make_unique<char[]>(chunk_size);
-        mem_node* tail_node;
-        for (int i = 0; i < chunk_size / item_size; i++) {
-            mem_node* node = reinterpret_cast<mem_node*>(new_chunk.get() + i * item_size);
-            mem_node* next;
-            if (i == chunk_size / item_size - 1) {
-                next = nullptr;
-                tail_node = node;
+    // allocate a chunk and link its blocks together
+    // @return the new chunk, its last block's next_ is nullptr
+    char* alloc_chunk_impl() {
+        // over-allocate when the chunk base needs more than new[]'s alignment
+        constexpr size_t extra = item_align > alignof(std::max_align_t) ? item_align - 1 : 0;
+        auto new_chunk = std::make_unique<char[]>(chunk_size + extra);
+        uintptr_t raw = reinterpret_cast<uintptr_t>(new_chunk.get());
+        char* base = new_chunk.get() + ((item_align - raw % item_align) % item_align);
+        for (size_t i = 0; i < items_per_chunk; i++) {
+            mem_node* node = reinterpret_cast<mem_node*>(base + i * stride);
+            if (i == items_per_chunk - 1) {
+                node->next_ = nullptr;
             } else {
-                next = reinterpret_cast<mem_node*>(new_chunk.get() + (i + 1) * item_size);
+                node->next_ = reinterpret_cast<mem_node*>(base + (i + 1) * stride);
             }
-            node->next_ = next;
         }
 
         // latch for chunks_
@@ -57,58 +167,162 @@ private:
         chunks_.push_back(std::move(new_chunk));
         cl.unlock();
 
-        return tail_node;
+        return base;
     }
 
-    bool debug_check_free_align(void* ptr) {
-        std::vector<char*> snapshot;
-        std::unique_lock<std::mutex> cl(chunk_latch_);
-        snapshot.reserve(chunks_.size());
-        for (const auto& c : chunks_) {
-            snapshot.push_back(c.get());
+    // register a chunk in index_ and put its blocks in front of the free list
+    // node_latch_ must be held
+    void link_chunk(char* base) {
+        auto pos = index_.begin();
+        while (pos != index_.end() && pos->base_ < base) {
+            ++pos;
         }
-        cl.unlock();
+        index_.insert(pos, chunk_info{base, std::vector<uint64_t>(bitmap_words, 0)});
+        if (locked_) {
+            lock_chunk(base);
+        }
+        add_relaxed(chunks_count_, 1);
 
-        // check if ptr is in any chunk
-        for (const auto& c : snapshot) {
-            if (ptr >= c && ptr < c + chunk_size) {
-                // check alignment
-                size_t offset = reinterpret_cast<char*>(ptr) - c;
-                if (offset % item_size != 0) {
-                    continue;
-                } else {
-                    return true;
-                }
+        mem_node* tail = reinterpret_cast<mem_node*>(base + (items_per_chunk - 1) * stride);
+        tail->next_ = head_;
+        head_ = reinterpret_cast<mem_node*>(base);
+    }
+
+    static bool lock_chunk(char* base) {
+#ifdef TOYLIB_MEMPOOL_HAS_MLOCK
+        return mlock(base, chunk_size) == 0;
+#else
+        (void)base;
+        return false;
+#endif
+    }
+
+    // node_latch_ must be held
+    char* alloc_locked(bool alloc_when_exhausted) {
+        if (!head_) {
+            if (alloc_when_exhausted) {
+                link_chunk(alloc_chunk_impl());
+            } else {
+                return nullptr;
             }
         }
-        return false;
+        auto ptr = head_;
+        head_ = head_->next_;
+
+        if (tracking_) {
+            chunk_info* c = find_chunk(ptr);
+            size_t idx = (reinterpret_cast<char*>(ptr) - c->base_) / stride;
+            c->live_[idx / 64] |= uint64_t(1) << (idx % 64);
+        }
+
+        add_relaxed(allocs_, 1);
+        size_t live = live_.load(std::memory_order_relaxed) + 1;
+        live_.store(live, std::memory_order_relaxed);
+        if (live > peak_live_.load(std::memory_order_relaxed)) {
+            peak_live_.store(live, std::memory_order_relaxed);
+        }
+        return reinterpret_cast<char*>(ptr);
+    }
+
+    // node_latch_ must be held
+    // @message A pointer that is not a block of this pool, or a block that is already free, asserts in debug mode
+    // and is ignored when bitmaps are tracked
+    void free_locked(void* ptr) {
+        auto node = reinterpret_cast<mem_node*>(ptr);
+
+        if (tracking_) {
+            chunk_info* c = find_chunk(ptr);
+            assert(c && "Pointer to free is not allocated from this pool");
+            if (!c) return;
+            size_t offset = reinterpret_cast<char*>(ptr) - c->base_;
+            assert(offset % stride == 0 && "Pointer to free is not aligned");
+            if (offset % stride != 0) return;
+            size_t idx = offset / stride;
+            uint64_t bit = uint64_t(1) << (idx % 64);
+            assert((c->live_[idx / 64] & bit) && "Double free detected");
+            if (!(c->live_[idx / 64] & bit)) return;
+            c->live_[idx / 64] &= ~bit;
+        }
+
+        add_relaxed(frees_, 1);
+        live_.store(live_.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+
+        node->next_ = head_;
+        head_ = node;
+    }
+
+    // find the chunk containing ptr, node_latch_ must be held
+    // @return nullptr if ptr is not inside any chunk
+    chunk_info* find_chunk(const void* ptr) {
+        const char* p = reinterpret_cast<const char*>(ptr);
+        size_t l = 0, r = index_.size();
+        // last chunk whose base <= p
+        while (l < r) {
+            size_t mid = l + (r - l) / 2;
+            if (index_[mid].base_ <= p) l = mid + 1;
+            else r = mid;
+        }
+        if (l == 0) return nullptr;
+        chunk_info* c = &index_[l - 1];
+        return p < c->base_ + items_per_chunk * stride ? c : nullptr;
+    }
+
+    // start maintaining live bitmaps, rebuilt as every block minus the free list
+    // node_latch_ must be held
+    void track_locked() {
+        if (tracking_) return;
+        for (auto& c : index_) {
+            std::fill(c.live_.begin(), c.live_.end(), ~uint64_t(0));
+            if (items_per_chunk % 64) {
+                c.live_.back() = (uint64_t(1) << (items_per_chunk % 64)) - 1;
+            }
+        }
+        for (mem_node* node = head_; node; node = node->next_) {
+            chunk_info* c = find_chunk(node);
+            size_t idx = (reinterpret_cast<char*>(node) - c->base_) / stride;
+            c->live_[idx / 64] &= ~(uint64_t(1) << (idx % 64));
+        }
+        tracking_ = true;
     }
 
 public:
-    fixed_mem_pool(size_t chunks_count) : chunks_(0), head_(nullptr) {
+    fixed_mem_pool(size_t chunks_count)
+        : chunks_(0), head_(nullptr), locked_(false),
+#ifdef NDEBUG
+          tracking_(false),
+#else
+          tracking_(true),
+#endif
+          allocs_(0), frees_(0), live_(0), peak_live_(0), chunks_count_(0) {
         // 预分配内存
-        for (int c = 0; c < chunks_count; c++) {
-            chunks_.emplace_back(new char[chunk_size]);
-        }
-
-        // 手动进行空间分割
-        for (int c = 0; c < chunks_count; c++) {
-            for (int i = 0; i < chunk_size / item_size; i++) {
-                mem_node* node = reinterpret_cast<mem_node*>(chunks_[c].get() + i * item_size);
-                mem_node* next;
-                if (i == chunk_size / item_size - 1) {
-                    if (c == chunks_count - 1) {
-                        next = nullptr;
-                    } else {
-                        next = reinterpret_cast<mem_node*>(chunks_[c + 1].get());
-                    }
-                } else {
-                    next = reinterpret_cast<mem_node*>(chunks_[c].get() + (i + 1) * item_size);
-                }
-                node->next_ = next;
+        std::vector<char*> bases;
+        bases.reserve(chunks_count);
+        for (size_t c = 0; c < chunks_count; c++) {
+            bases.push_back(alloc_chunk_impl());
+        }
+        // link in reverse so that the first chunk is handed out first
+        std::unique_lock<std::mutex> nl(node_latch_);
+        for (size_t c = chunks_count; c > 0; c--) {
+            link_chunk(bases[c - 1]);
+        }
+    }
+
+    // preallocate enough chunks to hold at least `bytes` bytes
+    explicit fixed_mem_pool(prealloc_bytes bytes)
+        : fixed_mem_pool((bytes.bytes_ + chunk_size - 1) / chunk_size) {}
+
+    // preallocate enough chunks to hold at least `count` objects
+    explicit fixed_mem_pool(prealloc_objects objects)
+        : fixed_mem_pool((objects.count_ + items_per_chunk - 1) / items_per_chunk) {}
+
+    ~fixed_mem_pool() {
+#ifdef TOYLIB_MEMPOOL_HAS_MLOCK
+        if (locked_) {
+            for (const auto& c : index_) {
+                munlock(c.base_, chunk_size);
             }
         }
-        head_ = reinterpret_cast<mem_node*>(chunks_[0].get());
+#endif
     }
 
     // don't think mem pool should be copied or moved
@@ -120,43 +334,308 @@ public:
     // interfaces
 
     void alloc_new_chunk() {
-        auto new_tail = alloc_chunk_impl();
-        
-        // modify tail node
-        std::unique_lock<std::mutex> nl(node_latch_);
-        if (head_) {
-            // 我们可以将新chunk的尾部节点和旧head连接起来
-            new_tail->next_ = head_;
-        }
-        head_ = reinterpret_cast<mem_node*>(chunks_.back().get());
+        // chunk is allocated and split outside node latch
+        char* base = alloc_chunk_impl();
 
+        std::unique_lock<std::mutex> nl(node_latch_);
+        link_chunk(base);
     }
 
     // @param alloc_when_exhausted Whether to allocate new chunks if there is no free node. If set to false, function will return nullptr when exhausted.
     char* alloc(bool alloc_when_exhausted = true) {
         std::unique_lock<std::mutex> nl(node_latch_);
-        if (!head_) {
-            if (alloc_when_exhausted) {
-                alloc_chunk_impl();
-                head_ = reinterpret_cast<mem_node*>(chunks_.back().get());
-            } else {
-                return nullptr;
+        return alloc_locked(alloc_when_exhausted);
+    }
+
+    // @brief Allocate up to n blocks with a single lock acquisition
+    // @param out Array receiving the blocks
+    // @return Number of blocks written to out, less than n only if alloc_when_exhausted is false
+    size_t alloc_bulk(char** out, size_t n, bool alloc_when_exhausted = true) {
+        std::unique_lock<std::mutex> nl(node_latch_);
+        size_t i = 0;
+        try {
+            for (; i < n; i++) {
+                out[i] = alloc_locked(alloc_when_exhausted);
+                if (!out[i]) break;
+            }
+        } catch (...) {
+            // a new chunk couldn't be allocated, give back the blocks already taken
+            for (size_t j = 0; j < i; j++) {
+                free_locked(out[j]);
             }
+            throw;
         }
-        auto ptr = head_;
-        head_ = head_->next_;
-        return reinterpret_cast<char*>(ptr);
+        return i;
     }
-
     
+    template <typename T>
+    T* alloc_as() {
+        static_assert(sizeof(T) <= stride, "Type size is larger than padded item_size");
+        static_assert(alignof(T) <= block_align, "Blocks are not aligned enough for this type, pad item_size or set item_align");
+        return reinterpret_cast<T*>(alloc());
+    }
+
+    // @message This function only checks ptr's alignment, whether it was allocated from this pool and double free in debug mode.
+    void free(void* ptr) {
+        std::unique_lock<std::mutex> nl(node_latch_);
+        free_locked(ptr);
+    }
+
+    // @brief Return n blocks with a single lock acquisition
+    void free_bulk(char* const* ptrs, size_t n) {
+        std::unique_lock<std::mutex> nl(node_latch_);
+        for (size_t i = 0; i < n; i++) {
+            free_locked(ptrs[i]);
+        }
+    }
+
+    // @brief Write every page of existing chunks so that first-touch page faults happen now instead of on the hot path
+    // @param lock_pages Also mlock the chunks (and chunks allocated later) so they can't be swapped out
+    // @return false if locking is requested but failed or unsupported, e.g. RLIMIT_MEMLOCK is too small
+    // @message Each page is rewritten with its own content, so call it before blocks are shared with other threads.
+    bool warm_up(bool lock_pages = false) {
+        std::unique_lock<std::mutex> nl(node_latch_);
+        const size_t page = pool_page_size();
+        bool ok = true;
+        for (const auto& c : index_) {
+            for (size_t off = 0; off < chunk_size; off += page) {
+                volatile char* p = c.base_ + off;
+                *p = *p;
+            }
+            // chunk may end in a page the stride skipped
+            volatile char* last = c.base_ + chunk_size - 1;
+            *last = *last;
+            if (lock_pages && !lock_chunk(c.base_)) {
+                ok = false;
+            }
+        }
+        if (lock_pages) {
+            locked_ = true;
+        }
+        return ok;
+    }
+
+    // @brief Read counters without taking the lock
+    // @message Counters are read one by one, they may be slightly inconsistent with each other while other threads are working.
+    mem_pool_stats stats() const {
+        mem_pool_stats st;
+        st.allocs_ = allocs_.load(std::memory_order_relaxed);
+        st.frees_ = frees_.load(std::memory_order_relaxed);
+        st.live_ = live_.load(std::memory_order_relaxed);
+        st.peak_live_ = peak_live_.load(std::memory_order_relaxed);
+        st.chunks_ = chunks_count_.load(std::memory_order_relaxed);
+        st.capacity_ = st.chunks_ * items_per_chunk;
+        return st;
+    }
+
+    // @brief Number of live blocks of every chunk, in address order
+    std::vector<size_t> chunk_occupancy() {
+        std::unique_lock<std::mutex> nl(node_latch_);
+        track_locked();
+        std::vector<size_t> res;
+        res.reserve(index_.size());
+        for (const auto& c : index_) {
+            size_t live = 0;
+            for (size_t w = 0; w < bitmap_words; w++) {
+                live += pool_popcount64(c.live_[w]);
+            }
+            res.push_back(live);
+        }
+        return res;
+    }
+
+    // @brief Histogram of chunk occupancy, a sparse histogram means blocks are spread over many chunks
+    // @param buckets Number of buckets, bucket i counts chunks whose live ratio is in [i / buckets, (i + 1) / buckets), full chunks go to the last bucket
+    std::vector<size_t> occupancy_histogram(size_t buckets = 10) {
+        std::vector<size_t> hist(buckets, 0);
+        if (buckets == 0) return hist;
+        for (size_t live : chunk_occupancy()) {
+            size_t b = live * buckets / items_per_chunk;
+            hist[b < buckets ? b : buckets - 1]++;
+        }
+        return hist;
+    }
+
+    // @brief Visit every allocated block, chunks are walked in address order
+    // @param fn Callable invoked as fn(char* block)
+    // @message Pool is locked during the walk, fn must not alloc from or free to this pool.
+    // @message The first call rebuilds the bitmaps from the free list, O(capacity), later calls only walk the bitmaps.
+    template <typename Fn>
+    void for_each_live(Fn&& fn) {
+        std::unique_lock<std::mutex> nl(node_latch_);
+        track_locked();
+        for (const auto& c : index_) {
+            for (size_t w = 0; w < bitmap_words; w++) {
+                uint64_t word = c.live_[w];
+                while (word) {
+                    size_t idx = w * 64 + pool_ctz64(word);
+                    fn(c.base_ + idx * stride);
+                    word &= word - 1;
+                }
+            }
+        }
+    }
+};
+
+// blocks padded and aligned to cache lines, for objects written by different threads
+template <size_t item_size, size_t chunk_size = 4096>
+using cache_aligned_mem_pool = fixed_mem_pool<item_size, chunk_size, DEFAULT_CACHE_LINE_WIDTH>;
+
+// CRTP基类，派生类的new/delete自动使用内存池
+// Mixin giving Derived class-specific operator new/delete backed by a per-type fixed_mem_pool.
+// Each thread keeps up to cache_size free blocks so most new/delete calls don't touch the pool's lock,
+// the cache is refilled and flushed half a cache at a time with alloc_bulk/free_bulk.
+// A thread's cache is flushed back to the pool when the thread exits. After that (e.g. in destructors of
+// static objects, which run after the main thread's thread_local objects are gone) new/delete use the pool directly.
+// Classes further derived from Derived have a different size and fall back to the global operator new.
+// Usage: struct message : pooled_object<message> { ... };
+template <typename Derived, size_t chunk_size = 4096, size_t cache_size = 32>
+class pooled_object {
+private:
+    static_assert(cache_size >= 2, "cache_size must be at least 2");
+
+    // Derived is incomplete at class scope, sizes are only computed inside function bodies
+    static constexpr size_t block_align() {
+        return alignof(Derived) > alignof(mem_node) ? alignof(Derived) : alignof(mem_node);
+    }
+    static constexpr size_t block_size() {
+        return ((sizeof(Derived) > sizeof(mem_node) ? sizeof(Derived) : sizeof(mem_node)) + block_align() - 1)
+            / block_align() * block_align();
+    }
+    static constexpr size_t pool_chunk_size() {
+        return chunk_size > block_size() ? chunk_size : block_size();
+    }
+
+    enum cache_state : unsigned char { cache_unused, cache_alive, cache_destroyed };
+
+    struct thread_cache {
+        char* slots_[cache_size];
+        size_t count_;
+        cache_state* state_;
+        explicit thread_cache(cache_state* state) : count_(0), state_(state) {
+            *state_ = cache_alive;
+        }
+        ~thread_cache() {
+            // give cached blocks back when the thread exits
+            object_pool().free_bulk(slots_, count_);
+            count_ = 0;
+            *state_ = cache_destroyed;
+        }
+    };
+
+    // @return this thread's cache, nullptr once it has been destroyed
+    static thread_cache* local_cache() {
+        // trivially destructible, so it can still be read while and after the thread's caches are destroyed
+        thread_local cache_state state = cache_unused;
+        if (state == cache_destroyed) {
+            return nullptr;
+        }
+        thread_local thread_cache cache(&state);
+        return &cache;
+    }
+
+public:
+    // @brief The pool backing Derived, e.g. to warm it up at startup
+    // @message Pool is never destroyed, so objects deleted during static destruction or thread exit are still safe.
+    // @message Blocks sitting in thread caches are reported as live by for_each_live.
+    static auto& object_pool() {
+        static_assert(alignof(Derived) <= alignof(std::max_align_t), "over-aligned types are not supported");
+        static auto* pool = new fixed_mem_pool<block_size(), pool_chunk_size()>(0);
+        return *pool;
+    }
+
+    static void* operator new(size_t size) {
+        if (size != sizeof(Derived)) {
+            return ::operator new(size);
+        }
+        thread_cache* cache = local_cache();
+        if (!cache) {
+            return object_pool().alloc();
+        }
+        if (cache->count_ == 0) {
+            cache->count_ = object_pool().alloc_bulk(cache->slots_, cache_size / 2);
+        }
+        return cache->slots_[--cache->count_];
+    }
+
+    static void operator delete(void* ptr, size_t size) {
+        if (!ptr) return;
+        if (size != sizeof(Derived)) {
+            ::operator delete(ptr);
+            return;
+        }
+        thread_cache* cache = local_cache();
+        if (!cache) {
+            object_pool().free(ptr);
+            return;
+        }
+        if (cache->count_ == cache_size) {
+            cache->count_ -= cache_size / 2;
+            object_pool().free_bulk(cache->slots_ + cache->count_, cache_size / 2);
+        }
+        cache->slots_[cache->count_++] = static_cast<char*>(ptr);
+    }
+};
+
+// 静态存储的内存池，对象数量在编译期确定
+// Memory pool backed by an aligned member array, no heap allocation at all.
+// Free list is built lazily: untouched blocks are handed out by a bump index,
+// so the constructor is constexpr and a static instance is constant-initialized
+// (zero-filled in .bss) before any dynamic initialization runs.
+template <size_t item_size, size_t count>
+class static_mem_pool {
+private:
+    static_assert(item_size >= sizeof(mem_node*), "item_size must be greater than a pointer's size"); // NOLINT
+    static_assert(count > 0, "count must be greater than 0");
+    // alignment every block has: the largest power of two dividing item_size, capped by the storage's alignment
+    static constexpr size_t block_align = (item_size & (~item_size + 1)) < alignof(std::max_align_t)
+        ? (item_size & (~item_size + 1)) : alignof(std::max_align_t);
+    alignas(alignof(std::max_align_t)) char storage_[item_size * count];
+
+    std::mutex node_latch_;     // protects nodes and bump index
+    mem_node* head_;            // blocks returned by free()
+    size_t bump_;               // blocks [bump_, count) have never been handed out
+
+    bool debug_check_free_align(void* ptr) const {
+        const char* p = reinterpret_cast<const char*>(ptr);
+        if (p < storage_ || p >= storage_ + item_size * count) {
+            return false;
+        }
+        return (p - storage_) % item_size == 0;
+    }
+
+public:
+    constexpr static_mem_pool() : storage_(), node_latch_(), head_(nullptr), bump_(0) {}
+
+    // storage lives inside the object, copying or moving it would invalidate handed out blocks
+    static_mem_pool(const static_mem_pool&) = delete;
+    static_mem_pool& operator=(const static_mem_pool&) = delete;
+    static_mem_pool(static_mem_pool&&) = delete;
+    static_mem_pool& operator=(static_mem_pool&&) = delete;
+
+    // @return Pointer to a free block, or nullptr when all `count` blocks are in use
+    char* alloc() {
+        std::unique_lock<std::mutex> nl(node_latch_);
+        if (head_) {
+            auto ptr = head_;
+            head_ = head_->next_;
+            return reinterpret_cast<char*>(ptr);
+        }
+        if (bump_ < count) {
+            return storage_ + item_size * bump_++;
+        }
+        return nullptr;
+    }
+
     template <typename T>
     T* alloc_as() {
         static_assert(sizeof(T) <= item_size, "Type size is larger than item_size");
+        static_assert(alignof(T) <= block_align, "Blocks are not aligned enough for this type, pad item_size");
         return reinterpret_cast<T*>(alloc());
     }
 
-    // @message This function only checks ptr's alignment and whether it was allocated from this pool in debug mode.
-    // @message And it will not check double free.
+    // @message In debug mode ptr is checked to be a block of this pool (inside the storage and at a block boundary),
+    // @message like fixed_mem_pool::free. Unlike fixed_mem_pool there is no occupancy bitmap, so double free is not detected.
     void free(void* ptr) {
         #ifndef NDEBUG
         assert(debug_check_free_align(ptr) && "Pointer to free is not allocated from this pool or not aligned");
@@ -169,6 +648,10 @@ public:
         node->next_ = head_;
         head_ = node;
     }
+
+    static constexpr size_t capacity() {
+        return count;
+    }
 };
 
 }
@@ -0,0 +1,155 @@
+// FlatCommon.hpp
+// Header file for helpers shared by FlatSet.hpp and FlatMap.hpp
+// flat_set/flat_map共用的辅助定义
+
+#ifndef TOYLIB_FLAT_COMMON_HEADER
+#define TOYLIB_FLAT_COMMON_HEADER
+
+#include <cstddef>
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+namespace toylib {
+
+// hint the cpu to fetch the cache line at addr, no-op where unsupported
+static inline void flat_prefetch(const void* addr) {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(addr);
+#else
+    (void)addr;
+#endif
+}
+
+// whether Compare declares is_transparent, which enables lookups with keys of other types (like std::less<>)
+template <typename T>
+struct flat_make_void {
+    using type = void;
+};
+template <typename C, typename = void>
+struct flat_is_transparent : std::false_type {};
+template <typename C>
+struct flat_is_transparent<C, typename flat_make_void<typename C::is_transparent>::type> : std::true_type {};
+
+// tag for constructors adopting data that is already sorted and free of duplicates
+struct sorted_unique_t {
+    explicit sorted_unique_t() = default;
+};
+constexpr sorted_unique_t sorted_unique{};
+
+// parallel sort and deduplication used by the bulk builders of flat_set and flat_map
+// inputs smaller than this are sorted on the calling thread, starting threads would cost more than it saves
+constexpr size_t flat_parallel_min_size = size_t(1) << 16;
+
+// @brief Sort data by less and collapse equivalent elements into the first one in input order,
+//  merge(kept, dup) is called for every later duplicate in input order
+// Chunks are stable sorted on their own threads. Then the key space is cut at splitters sampled from the chunks,
+// and every thread k-way merges one key range of all chunks into its part, so equivalent keys always meet in one part.
+// @param threads number of threads, 0 for std::thread::hardware_concurrency()
+template <typename T, typename Less, typename Merge>
+void flat_parallel_sort_unique(std::vector<T>& data, size_t threads, Less less, Merge merge) {
+    const size_t n = data.size();
+    if (threads == 0) threads = std::thread::hardware_concurrency();
+    if (threads > n / (flat_parallel_min_size / 4)) threads = n / (flat_parallel_min_size / 4);
+    if (n < flat_parallel_min_size || threads <= 1) {
+        std::stable_sort(data.begin(), data.end(), less);
+        size_t w = 0;
+        for (size_t i = 0; i < n; i++) {
+            if (w > 0 && !less(data[w - 1], data[i])) {
+                merge(data[w - 1], std::move(data[i]));
+            } else {
+                if (w != i) data[w] = std::move(data[i]);
+                w++;
+            }
+        }
+        data.erase(data.begin() + w, data.end());
+        return;
+    }
+
+    const size_t k = threads;
+    std::vector<size_t> bounds(k + 1);
+    for (size_t c = 0; c <= k; c++) {
+        bounds[c] = n / k * c + (c < n % k ? c : n % k);
+    }
+    std::vector<std::thread> workers;
+    for (size_t c = 0; c < k; c++) {
+        workers.emplace_back([&data, &bounds, &less, c]() {
+            std::stable_sort(data.begin() + bounds[c], data.begin() + bounds[c + 1], less);
+        });
+    }
+    for (auto& w : workers) w.join();
+    workers.clear();
+
+    // k evenly spaced samples per chunk, every k-th sample splits the key space
+    std::vector<const T*> samples;
+    for (size_t c = 0; c < k; c++) {
+        for (size_t s = 0; s < k; s++) {
+            samples.push_back(&data[bounds[c] + (bounds[c + 1] - bounds[c]) * s / k]);
+        }
+    }
+    std::sort(samples.begin(), samples.end(), [&less](const T* a, const T* b) { return less(*a, *b); });
+    // cuts[c * (k + 1) + j] is where part j starts in chunk c
+    std::vector<size_t> cuts(k * (k + 1));
+    for (size_t c = 0; c < k; c++) {
+        cuts[c * (k + 1)] = bounds[c];
+        cuts[c * (k + 1) + k] = bounds[c + 1];
+        for (size_t j = 1; j < k; j++) {
+            cuts[c * (k + 1) + j] = static_cast<size_t>(std::lower_bound(data.begin() + bounds[c],
+                data.begin() + bounds[c + 1], *samples[j * k], less) - data.begin());
+        }
+    }
+
+    std::vector<std::vector<T>> parts(k);
+    for (size_t j = 0; j < k; j++) {
+        workers.emplace_back([&data, &cuts, &parts, &less, &merge, k, j]() {
+            std::vector<size_t> pos(k), end(k), heap;
+            size_t total = 0;
+            for (size_t c = 0; c < k; c++) {
+                pos[c] = cuts[c * (k + 1) + j];
+                end[c] = cuts[c * (k + 1) + j + 1];
+                total += end[c] - pos[c];
+                if (pos[c] < end[c]) heap.push_back(c);
+            }
+            // smallest head on top, equivalent heads in chunk order so the earliest input wins
+            auto after = [&](size_t a, size_t b) {
+                return less(data[pos[b]], data[pos[a]]) || (!less(data[pos[a]], data[pos[b]]) && a > b);
+            };
+            std::make_heap(heap.begin(), heap.end(), after);
+            std::vector<T>& out = parts[j];
+            out.reserve(total);
+            while (!heap.empty()) {
+                std::pop_heap(heap.begin(), heap.end(), after);
+                const size_t c = heap.back();
+                T& v = data[pos[c]++];
+                if (!out.empty() && !less(out.back(), v)) {
+                    merge(out.back(), std::move(v));
+                } else {
+                    out.push_back(std::move(v));
+                }
+                if (pos[c] < end[c]) {
+                    std::push_heap(heap.begin(), heap.end(), after);
+                } else {
+                    heap.pop_back();
+                }
+            }
+        });
+    }
+    for (auto& w : workers) w.join();
+
+    size_t total = 0;
+    for (const auto& p : parts) total += p.size();
+    std::vector<T> result;
+    result.reserve(total);
+    for (auto& p : parts) {
+        result.insert(result.end(), std::make_move_iterator(p.begin()), std::make_move_iterator(p.end()));
+        std::vector<T>().swap(p);
+    }
+    data.swap(result);
+}
+
+} // namespace toylib
+
+#endif // TOYLIB_FLAT_COMMON_HEADER
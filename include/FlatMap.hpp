@@ -5,20 +5,47 @@
 #define TOYLIB_FLATMAP_HEADER
 
 
+#include <atomic>
+#include <cmath>
 #include <cstddef>
+#include <cstdint>
 #include <iterator>
+#include <limits>
+#include <memory>
+#include <mutex>
 #include <vector>
+#include <algorithm>
+#include <functional>
+#include <cassert>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <tuple>
+#include <utility>
+
+#include "CacheLine.hpp"
+#include "FlatCommon.hpp"
 
 namespace toylib {
 
+// search policies of flat_map, they only change how arithmetic keys ordered by std::less are searched
+// branchless binary search, the default
+struct flat_binary_search {};
+// interpolation search for nearly uniform keys (timestamps, sequence numbers), falls back to binary search on skewed keys
+struct flat_interpolation_search {};
 
 //  flat map container, like std::map but using sorted array as backend and elements are sorted in ascending order by default
 //  Lookup is done by binary search, complexity is O(log n), though it's efficient thanks to cache locality
 //  Insert, Delete's complexity is O(n) due to array shifting
 //  Iteration is done by array traversal, complexity is O(n)
 //  Suitable for scenarios where insertion and deletion are rare but lookup and iteration are frequent
-//  This implement is not thread-safe
-template <typename Key, typename Value, typename Compare = std::less<Key>>
+//  Container is the storage policy, any contiguous sequence of std::pair<Key, Value> with std::vector's interface,
+//  e.g. small_vector<std::pair<Key, Value>, N> from SmallVector.hpp keeps up to N entries inline without a heap allocation
+//  Search is the search policy of arithmetic keys ordered by std::less, flat_binary_search or flat_interpolation_search
+//  This implement is not thread-safe for writes. Const member functions (find, at, count, lower_bound, contains...)
+//  don't modify anything, so any number of threads may read a map concurrently as long as none writes it
+template <typename Key, typename Value, typename Compare = std::less<Key>,
+          typename Container = std::vector<std::pair<Key, Value>>, typename Search = flat_binary_search>
 class flat_map {
 public:
     // Using Compare to judge two elem's equal
@@ -35,18 +62,120 @@ public:
     using pointer = value_type*;
     using const_pointer = const value_type*;
     using size_type = size_t;
-    using iterator = typename std::vector<value_type>::iterator;
-    using const_iterator = typename std::vector<value_type>::const_iterator;
+    using iterator = typename Container::iterator;
+    using const_iterator = typename Container::const_iterator;
 private:
-    bool equal(const Key& a, const Key& b) const {
+    // also used with a key of another type when Compare is transparent
+    template <typename A, typename B>
+    bool equal(const A& a, const B& b) const {
         return !(comp_(a, b) || comp_(b, a));
     }
 
-    std::vector<value_type> data_;
+    // heterogeneous overloads only take part in overload resolution with a transparent comparator
+    template <typename K>
+    using enable_transparent = typename std::enable_if<flat_is_transparent<Compare>::value &&
+        !std::is_convertible<K, iterator>::value && !std::is_convertible<K, const_iterator>::value, int>::type;
+
+    Container data_;
+
+    // arithmetic keys ordered by std::less are searched without branches
+    // keys are interleaved with values, so the final block is scanned with scalar compares
+    using fast_search = std::integral_constant<bool,
+        std::is_arithmetic<Key>::value && std::is_same<Compare, std::less<Key>>::value>;
+    static constexpr size_t search_block = 8;
+
+    // searches interleaved by lower_bound_batch, enough to keep the memory system busy
+    static constexpr size_t batch_group = 16;
+
+    // ranges up to this size are scanned linearly, tiny maps skip the unpredictable branches of binary search
+    static constexpr size_t linear_search_max = 8;
+
+    using interpolation = std::integral_constant<bool,
+        fast_search::value && std::is_same<Search, flat_interpolation_search>::value>;
+    // interpolation probes before falling back to binary search, skewed keys give up after these
+    static constexpr int interpolation_rounds = 3;
+    // steps of search_block slots walked from the last probe to bracket k
+    static constexpr int interpolation_walk = 4;
+
+    // @brief Narrow [l, r) around k by interpolation, keeps k's lower bound in [l, r]
+    // The first probe is guessed from the keys at both ends. Each later probe moves from the previous one by
+    // the key distance to k times the average density, so on nearly uniform keys the error drops from about
+    // sqrt(n) slots to a few in two or three probes, and every probe shrinks [l, r) from one side.
+    // Then a short walk in steps of search_block from the last probe brackets k. On skewed keys a probe lands
+    // far from its guess, or the walk doesn't bracket k. Then [l, r) is restored, so the binary search that
+    // follows starts from the top, where its probes are hot in cache for every lookup
+    void interpolate(const Key& k, size_t& l, size_t& r) const {
+        if (r - l <= 2 * search_block) return;
+        const Key lo = data_[l].first, hi = data_[r - 1].first;
+        if (!(lo < k)) {
+            r = l;
+            return;
+        }
+        if (hi < k) {
+            l = r;
+            return;
+        }
+        // slots per key unit
+        const double density = static_cast<double>(r - 1 - l) / (static_cast<double>(hi) - static_cast<double>(lo));
+        if (!(density > 0 && density < std::numeric_limits<double>::infinity())) return;    // keys too close for double
+        const size_t l0 = l, r0 = r;
+        // uniform keys miss the first guess by about sqrt(n) slots, a probe much farther from its guess means skewed keys
+        const double max_miss = 4 * std::sqrt(static_cast<double>(r - l)) + search_block;
+        double guess = static_cast<double>(l) + (static_cast<double>(k) - static_cast<double>(lo)) * density;
+        size_t m = l;
+        for (int round = 0; round < interpolation_rounds && r - l > 2 * search_block; round++) {
+            m = guess <= static_cast<double>(l) ? l : guess >= static_cast<double>(r - 1) ? r - 1 : static_cast<size_t>(guess);
+            const Key v = data_[m].first;
+            if (v < k) {
+                l = m + 1;
+            } else {
+                r = m;
+            }
+            const double miss = (static_cast<double>(k) - static_cast<double>(v)) * density;
+            if (miss > max_miss || -miss > max_miss) {
+                l = l0;
+                r = r0;
+                return;
+            }
+            guess = static_cast<double>(m) + miss;
+        }
+        for (int step = 1; step <= interpolation_walk && r - l > 2 * search_block; step++) {
+            if (l > m) {
+                const size_t g = m + step * search_block;
+                if (g >= r) break;
+                if (data_[g].first < k) {
+                    l = g + 1;
+                } else {
+                    r = g;
+                }
+            } else {
+                if (m - l < step * search_block) break;
+                const size_t g = m - step * search_block;
+                if (data_[g].first < k) {
+                    l = g + 1;
+                } else {
+                    r = g;
+                }
+            }
+        }
+        if (r - l > 2 * search_block) {
+            l = l0;
+            r = r0;
+        }
+    }
 
     // binary search method in range [l, r)
     // returns the position of k in data_ or the first element greater than v
     size_t bin_impl(const Key& k, size_t l, size_t r) const {
+        return bin_impl(k, l, r, fast_search());
+    }
+
+    template <typename K>
+    size_t bin_impl(const K& k, size_t l, size_t r, std::false_type) const {
+        if (r - l <= linear_search_max) {
+            while (l < r && comp_(data_[l].first, k)) l++;
+            return l;
+        }
         while (l < r) {
             size_t mid = l + (r - l) / 2;
             // data_[mid] < k
@@ -55,11 +184,221 @@ private:
         }
         return l; // l == r
     }
+
+    size_t bin_impl(const Key& k, size_t l, size_t r, std::true_type) const {
+        if (interpolation::value) {
+            interpolate(k, l, r);
+        }
+        const value_type* base = data_.data() + l;
+        size_t n = r - l;
+        // elements before base are less than k, answer is in [base, base + n]
+        while (n > search_block) {
+            size_t half = n / 2;
+            // both candidates of the next probe, hides the load latency the conditional move exposes
+            flat_prefetch(base + half / 2);
+            flat_prefetch(base + half + half / 2);
+            base = base[half].first < k ? base + half : base;   // compiled to a conditional move
+            n -= half;
+        }
+        size_t c = 0;
+        for (size_t i = 0; i < n; i++) {
+            c += base[i].first < k ? 1 : 0;
+        }
+        return (base - data_.data()) + c;
+    }
+
+    // @brief Lower bound positions of a batch of keys
+    // Unsorted batches run batch_group binary searches in lockstep, each step issues one probe per search
+    // and prefetches its next probe, so the cache misses of different searches overlap instead of queueing.
+    // Batches sorted by comp_ are merged against data_ with galloping instead.
+    void lower_bound_batch(const Key* keys, size_t n, size_t* pos) const {
+        const size_t size = data_.size();
+        if (size == 0) {
+            std::fill(pos, pos + n, size_t(0));
+            return;
+        }
+        if (std::is_sorted(keys, keys + n, comp_)) {
+            size_t from = 0;
+            for (size_t i = 0; i < n; i++) {
+                from = gallop_impl(keys[i], from);
+                pos[i] = from;
+            }
+            return;
+        }
+        const value_type* data = data_.data();
+        for (size_t g = 0; g < n; g += batch_group) {
+            const size_t m = n - g < batch_group ? n - g : batch_group;
+            const value_type* base[batch_group];
+            for (size_t j = 0; j < m; j++) {
+                base[j] = data;
+            }
+            // every search has the same length, so they all narrow in the same steps
+            for (size_t len = size; len > 1;) {
+                const size_t half = len / 2;
+                len -= half;
+                for (size_t j = 0; j < m; j++) {
+                    base[j] = comp_(base[j][half].first, keys[g + j]) ? base[j] + half : base[j];
+                    flat_prefetch(base[j] + len / 2);
+                }
+            }
+            for (size_t j = 0; j < m; j++) {
+                pos[g + j] = (base[j] - data) + (comp_(base[j]->first, keys[g + j]) ? 1 : 0);
+            }
+        }
+    }
+
+    // @return first position at or after from whose key is not less than key, by probing from + 1, 3, 7, 15...
+    size_t gallop_impl(const Key& key, size_t from) const {
+        const size_t size = data_.size();
+        size_t lo = from, step = 1;
+        while (from + step <= size && comp_(data_[from + step - 1].first, key)) {
+            lo = from + step;
+            step = step * 2 + 1;
+        }
+        return bin_impl(key, lo, std::min(from + step - 1, size));
+    }
+
+    template <typename V>
+    std::pair<iterator, bool> insert_impl(V&& val) {
+        auto pos = bin_impl(val.first, 0, data_.size());
+        if (pos < data_.size() && equal(val.first, data_[pos].first)) {
+            return {data_.begin() + pos, false};
+        }
+        data_.insert(data_.begin() + pos, std::forward<V>(val));
+        return {data_.begin() + pos, true};
+    }
+
+    // checks whether this position(hint) matches: prev < val < hint, otherwise falls back to a normal insert
+    template <typename V>
+    iterator insert_hint_impl(const_iterator hint, V&& val) {
+        if (data_.empty()) {
+            return data_.insert(data_.begin(), std::forward<V>(val));
+        }
+        if (hint == cbegin()) {
+            if (comp_(val.first, hint->first)) {
+                return data_.insert(data_.begin(), std::forward<V>(val));
+            }
+            return insert_impl(std::forward<V>(val)).first;
+        }
+        if (hint == cend()) {
+            if (comp_((hint - 1)->first, val.first)) {
+                data_.push_back(std::forward<V>(val));
+                return data_.end() - 1;
+            }
+            return insert_impl(std::forward<V>(val)).first;
+        }
+        if (comp_((hint - 1)->first, val.first) && comp_(val.first, hint->first)) {
+            return data_.insert(hint, std::forward<V>(val));
+        }
+        return insert_impl(std::forward<V>(val)).first;
+    }
+
+    // no hint for try_emplace_tuple
+    static constexpr size_t no_hint = ~size_t(0);
+
+    // @brief Construct the value from the tuple vargs only if key is not present
+    // @param hint position to insert at if it's right (prev < key < hint), no_hint to search
+    template <typename K, typename VTuple>
+    std::pair<iterator, bool> try_emplace_tuple(size_t hint, K&& key, VTuple&& vargs) {
+        const size_t size = data_.size();
+        size_t pos = hint;
+        if (hint > size || (hint > 0 && !comp_(data_[hint - 1].first, key)) || (hint < size && !comp_(key, data_[hint].first))) {
+            pos = bin_impl(key, 0, size);
+            if (pos < size && equal(key, data_[pos].first)) {
+                return {data_.begin() + pos, false};
+            }
+        }
+        auto it = data_.emplace(data_.begin() + pos, std::piecewise_construct,
+            std::forward_as_tuple(std::forward<K>(key)), std::forward<VTuple>(vargs));
+        return {it, true};
+    }
+
+    template <typename K, typename... Args>
+    std::pair<iterator, bool> try_emplace_impl(K&& key, Args&&... args) {
+        return try_emplace_tuple(no_hint, std::forward<K>(key), std::forward_as_tuple(std::forward<Args>(args)...));
+    }
+
+    // emplace with a key argument, a Key is built first when it's of another type, so that it can be compared
+    template <typename K, typename VTuple>
+    std::pair<iterator, bool> emplace_key(size_t hint, K&& key, VTuple&& vargs) {
+        return emplace_key(hint, std::forward<K>(key), std::forward<VTuple>(vargs),
+            std::is_same<typename std::decay<K>::type, Key>());
+    }
+    template <typename K, typename VTuple>
+    std::pair<iterator, bool> emplace_key(size_t hint, K&& key, VTuple&& vargs, std::true_type) {
+        return try_emplace_tuple(hint, std::forward<K>(key), std::forward<VTuple>(vargs));
+    }
+    template <typename K, typename VTuple>
+    std::pair<iterator, bool> emplace_key(size_t hint, K&& key, VTuple&& vargs, std::false_type) {
+        return try_emplace_tuple(hint, Key(std::forward<K>(key)), std::forward<VTuple>(vargs));
+    }
+
+    template <typename KTuple, size_t... I>
+    static Key key_from_tuple(KTuple& kargs, std::index_sequence<I...>) {
+        return Key(std::get<I>(std::move(kargs))...);
+    }
+
+    // piecewise emplace, a single key argument is compared as is
+    template <typename KArg, typename VTuple>
+    std::pair<iterator, bool> emplace_piecewise(size_t hint, std::tuple<KArg>&& kargs, VTuple&& vargs) {
+        return emplace_key(hint, std::get<0>(std::move(kargs)), std::forward<VTuple>(vargs));
+    }
+    template <typename... KArgs, typename VTuple>
+    std::pair<iterator, bool> emplace_piecewise(size_t hint, std::tuple<KArgs...>&& kargs, VTuple&& vargs) {
+        return try_emplace_tuple(hint, key_from_tuple(kargs, std::index_sequence_for<KArgs...>()), std::forward<VTuple>(vargs));
+    }
+
+    template <typename K, typename M>
+    std::pair<iterator, bool> insert_or_assign_impl(K&& key, M&& obj) {
+        auto pos = bin_impl(key, 0, data_.size());
+        if (pos < data_.size() && equal(key, data_[pos].first)) {
+            data_[pos].second = std::forward<M>(obj);
+            return {data_.begin() + pos, false};
+        }
+        auto it = data_.emplace(data_.begin() + pos, std::forward<K>(key), std::forward<M>(obj));
+        return {it, true};
+    }
+
+    // @return position of key in data_, data_.size() if not found
+    size_t find_pos(const Key& key) const {
+        auto pos = bin_impl(key, 0, data_.size());
+        return (pos < data_.size() && equal(key, data_[pos].first)) ? pos : data_.size();
+    }
+    template <typename K>
+    size_t find_pos(const K& key, std::false_type) const {
+        auto pos = bin_impl(key, 0, data_.size(), std::false_type());
+        return (pos < data_.size() && equal(key, data_[pos].first)) ? pos : data_.size();
+    }
+
+    size_t checked_pos(size_t pos) const {
+        if (pos == data_.size()) {
+            throw std::out_of_range("flat_map::at: key not found");
+        }
+        return pos;
+    }
+
+    // keys are unique, so the upper bound is the lower bound or one past it
+    size_t upper_from(size_t lower, const Key& key) const {
+        return (lower < data_.size() && equal(key, data_[lower].first)) ? lower + 1 : lower;
+    }
+    size_t upper_pos(const Key& key) const {
+        return upper_from(bin_impl(key, 0, data_.size()), key);
+    }
+
     Compare comp_;
 public:
     // constructors/destructor
     flat_map() = default;
     explicit flat_map(const Compare& comp) : data_(), comp_(comp) {}
+
+    // @brief Adopt entries that are already sorted by key and have no duplicate keys, without copying
+    // @message Ordering is only checked in debug mode
+    flat_map(sorted_unique_t, Container&& data, const Compare& comp = Compare())
+        : data_(std::move(data)), comp_(comp) {
+        assert(std::adjacent_find(data_.begin(), data_.end(),
+            [this](const value_type& a, const value_type& b) { return !comp_(a.first, b.first); }) == data_.end()
+            && "data is not sorted or has duplicate keys");
+    }
     ~flat_map() = default;
 
     // copy ops
@@ -80,26 +419,24 @@ public:
         return (pos < data_.size() && equal(key, data_[pos].first)) ? 1 : 0;
     }
 
-    // template <typename... Args>
-    // std::pair<iterator, bool> emplace(Args&&... args) {
-
-    // }
-
-    // template <typename... Args>
-    // iterator emplace_hint(const_iterator hint, Args&&... args) {
-
-    // }
+    // @brief count with any key comparable with Key, e.g. const char* for std::string keys
+    // @message Only available when Compare has is_transparent (e.g. std::less<>), no temporary Key is constructed
+    template <typename K, enable_transparent<K> = 0>
+    size_t count(const K& key) const {
+        auto pos = bin_impl(key, 0, data_.size(), std::false_type());
+        return (pos < data_.size() && equal(key, data_[pos].first)) ? 1 : 0;
+    }
 
     // @brief insert one key
     // @param key key to insert
     // @return pair of {iterator to inserted or existing element, whether insertion took place}
     std::pair<iterator, bool> insert(const value_type& val) {
-        auto pos = bin_impl(val.first, 0, data_.size());
-        if (pos < data_.size() && equal(val.first, data_[pos].first)) {
-            return {data_.begin() + pos, false};
-        }
-        data_.insert(data_.begin() + pos, val);
-        return {data_.begin() + pos, true};
+        return insert_impl(val);
+    }
+
+    // @brief insert one element, moved into the map only if its key is not present
+    std::pair<iterator, bool> insert(value_type&& val) {
+        return insert_impl(std::move(val));
     }
 
     // @brief hinted insert
@@ -107,32 +444,68 @@ public:
     // @param val key to insert
     // @return Position of inserted or existing equal element
     iterator insert(const_iterator hint, const value_type& val) {
-        // check whether this position(hint) matches:
-        //  prev < val < hint
-        if (data_.empty()) {
-            return data_.insert(data_.begin(), val);
-        }
-        if (hint == cbegin()) {
-            if ((comp_(val.first, hint->first))) {
-                data_.insert(data_.begin(), val);
-                return data_.begin();
-            }
-            // just a normal insert
-            return insert(val).first;
-        }
-        if (hint == cend()) {
-            if (comp_((hint - 1)->first, val.first)) {
-                data_.push_back(val);
-                return data_.end() - 1;
-            }
-            // just a normal insert
-            return insert(val).first;
-        }
-        if (comp_((hint - 1)->first, val.first) && comp_(val.first, hint->first)) {
-            return data_.insert(hint, val);
-        }
-        // normal insert
-        return insert(val).first;
+        return insert_hint_impl(hint, val);
+    }
+
+    iterator insert(const_iterator hint, value_type&& val) {
+        return insert_hint_impl(hint, std::move(val));
+    }
+
+    // @brief construct an element in place
+    // emplace(key, value_arg) and emplace(std::piecewise_construct, key_args, value_args) compare the key first,
+    // the value is only constructed when the key is not present. Other forms build the pair before comparing, like std::map
+    template <typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args) {
+        return insert_impl(value_type(std::forward<Args>(args)...));
+    }
+
+    template <typename K, typename M>
+    std::pair<iterator, bool> emplace(K&& key, M&& obj) {
+        return emplace_key(no_hint, std::forward<K>(key), std::forward_as_tuple(std::forward<M>(obj)));
+    }
+
+    template <typename... KArgs, typename... VArgs>
+    std::pair<iterator, bool> emplace(std::piecewise_construct_t, std::tuple<KArgs...> kargs, std::tuple<VArgs...> vargs) {
+        return emplace_piecewise(no_hint, std::move(kargs), std::move(vargs));
+    }
+
+    template <typename... Args>
+    iterator emplace_hint(const_iterator hint, Args&&... args) {
+        return insert_hint_impl(hint, value_type(std::forward<Args>(args)...));
+    }
+
+    template <typename K, typename M>
+    iterator emplace_hint(const_iterator hint, K&& key, M&& obj) {
+        return emplace_key(static_cast<size_t>(hint - cbegin()), std::forward<K>(key), std::forward_as_tuple(std::forward<M>(obj))).first;
+    }
+
+    template <typename... KArgs, typename... VArgs>
+    iterator emplace_hint(const_iterator hint, std::piecewise_construct_t, std::tuple<KArgs...> kargs, std::tuple<VArgs...> vargs) {
+        return emplace_piecewise(static_cast<size_t>(hint - cbegin()), std::move(kargs), std::move(vargs)).first;
+    }
+
+    // @brief construct the value from args only if key is not present, nothing is constructed or moved otherwise
+    // @return pair of {iterator to inserted or existing element, whether insertion took place}
+    template <typename... Args>
+    std::pair<iterator, bool> try_emplace(const Key& key, Args&&... args) {
+        return try_emplace_impl(key, std::forward<Args>(args)...);
+    }
+
+    template <typename... Args>
+    std::pair<iterator, bool> try_emplace(Key&& key, Args&&... args) {
+        return try_emplace_impl(std::move(key), std::forward<Args>(args)...);
+    }
+
+    // @brief assign to the value of key if it exists, insert otherwise
+    // @return pair of {iterator to the element, whether insertion took place}
+    template <typename M>
+    std::pair<iterator, bool> insert_or_assign(const Key& key, M&& obj) {
+        return insert_or_assign_impl(key, std::forward<M>(obj));
+    }
+
+    template <typename M>
+    std::pair<iterator, bool> insert_or_assign(Key&& key, M&& obj) {
+        return insert_or_assign_impl(std::move(key), std::forward<M>(obj));
     }
 
     // @brief range insert
@@ -153,6 +526,15 @@ public:
         return 1;
     }
 
+    // @brief erase by a key comparable with Key, needs a transparent comparator
+    template <typename K, enable_transparent<K> = 0>
+    size_t erase(const K& key) {
+        auto pos = bin_impl(key, 0, data_.size(), std::false_type());
+        if (pos >= data_.size() || !equal(key, data_[pos].first)) return 0;
+        data_.erase(data_.begin() + pos);
+        return 1;
+    }
+
     // @brief erase by iterator
     // @return next iterator after erased one
     iterator erase(iterator pos) {
@@ -168,26 +550,106 @@ public:
     // @brief find elem
     // @return element's iterator or end() if not found
     iterator find(const Key& key) {
-        auto pos = bin_impl(key, 0, data_.size());
-        if (pos == data_.size() || !equal(key, data_[pos].first)) return end();
-        return data_.begin() + pos;
+        return data_.begin() + find_pos(key);
+    }
+    const_iterator find(const Key& key) const {
+        return data_.begin() + find_pos(key);
+    }
+
+    // @brief Count a batch of keys, out[i] is count(keys[i])
+    // @message Faster than calling count() in a loop once the set doesn't fit in cache, more so when keys are sorted
+    void count_batch(const Key* keys, size_t n, size_t* out) const {
+        lower_bound_batch(keys, n, out);
+        for (size_t i = 0; i < n; i++) {
+            out[i] = (out[i] < data_.size() && equal(keys[i], data_[out[i]].first)) ? 1 : 0;
+        }
     }
 
+    // @brief Find a batch of keys, out[i] is find(keys[i])
+    void find_batch(const Key* keys, size_t n, iterator* out) {
+        std::vector<size_t> pos(n);
+        lower_bound_batch(keys, n, pos.data());
+        for (size_t i = 0; i < n; i++) {
+            out[i] = (pos[i] < data_.size() && equal(keys[i], data_[pos[i]].first)) ? data_.begin() + pos[i] : data_.end();
+        }
+    }
+    void find_batch(const Key* keys, size_t n, const_iterator* out) const {
+        std::vector<size_t> pos(n);
+        lower_bound_batch(keys, n, pos.data());
+        for (size_t i = 0; i < n; i++) {
+            out[i] = (pos[i] < data_.size() && equal(keys[i], data_[pos[i]].first)) ? data_.begin() + pos[i] : data_.end();
+        }
+    }
+
+    // @brief find by a key comparable with Key, needs a transparent comparator
+    template <typename K, enable_transparent<K> = 0>
+    iterator find(const K& key) {
+        return data_.begin() + find_pos(key, std::false_type());
+    }
+    template <typename K, enable_transparent<K> = 0>
+    const_iterator find(const K& key) const {
+        return data_.begin() + find_pos(key, std::false_type());
+    }
+
+    // @return whether key is in the map
+    bool contains(const Key& key) const {
+        return find_pos(key) < data_.size();
+    }
+    template <typename K, enable_transparent<K> = 0>
+    bool contains(const K& key) const {
+        return find_pos(key, std::false_type()) < data_.size();
+    }
+
+    // @throw std::out_of_range if key is not found
     Value& at(const Key& key) {
-        auto pos = bin_impl(key, 0, data_.size());
-        if (pos >= data_.size() || !equal(key, data_[pos].first)) {
-            throw std::out_of_range("flat_map::at: key not found");
-        } 
-        return data_[pos].second;
+        return data_[checked_pos(find_pos(key))].second;
+    }
+    const Value& at(const Key& key) const {
+        return data_[checked_pos(find_pos(key))].second;
+    }
+
+    // @brief at() by a key comparable with Key, needs a transparent comparator
+    template <typename K, enable_transparent<K> = 0>
+    Value& at(const K& key) {
+        return data_[checked_pos(find_pos(key, std::false_type()))].second;
+    }
+    template <typename K, enable_transparent<K> = 0>
+    const Value& at(const K& key) const {
+        return data_[checked_pos(find_pos(key, std::false_type()))].second;
+    }
+
+    // @return first element whose key is not less than key
+    iterator lower_bound(const Key& key) {
+        return data_.begin() + bin_impl(key, 0, data_.size());
+    }
+    const_iterator lower_bound(const Key& key) const {
+        return data_.begin() + bin_impl(key, 0, data_.size());
+    }
+
+    // @return first element whose key is greater than key
+    iterator upper_bound(const Key& key) {
+        return data_.begin() + upper_pos(key);
+    }
+    const_iterator upper_bound(const Key& key) const {
+        return data_.begin() + upper_pos(key);
+    }
+
+    // @return {lower_bound(key), upper_bound(key)}, an empty range or the one element with key
+    std::pair<iterator, iterator> equal_range(const Key& key) {
+        size_t lower = bin_impl(key, 0, data_.size());
+        return {data_.begin() + lower, data_.begin() + upper_from(lower, key)};
+    }
+    std::pair<const_iterator, const_iterator> equal_range(const Key& key) const {
+        size_t lower = bin_impl(key, 0, data_.size());
+        return {data_.begin() + lower, data_.begin() + upper_from(lower, key)};
     }
 
     Value& operator[](const Key& key) {
-        auto pos = bin_impl(key, 0, data_.size());
-        if (pos >= data_.size() || !equal(key, data_[pos].first)) {
-            auto it = data_.emplace(data_.begin() + pos, key, Value());
-            return it->second;
-        } 
-        return data_[pos].second;
+        return try_emplace_impl(key).first->second;
+    }
+
+    Value& operator[](Key&& key) {
+        return try_emplace_impl(std::move(key)).first->second;
     }
 
     // begins/ends
@@ -232,6 +694,713 @@ public:
     //     return data_;
     // }
 };
+
+// duplicate policies of flat_map_build_parallel, called as resolve(kept, dup) for every later value of a key
+// keep the value that came first in the input, like insert
+struct flat_keep_first {
+    template <typename V>
+    void operator()(V&, V&&) const {}
+};
+// keep the value that came last in the input, like operator[] assignments
+struct flat_keep_last {
+    template <typename V>
+    void operator()(V& kept, V&& dup) const {
+        kept = std::move(dup);
+    }
+};
+
+// @brief Build a flat_map from unsorted entries with duplicate keys on several threads, for large maps built at startup
+// Chunks are sorted in parallel and k-way merged in parallel. Values of equivalent keys are folded in input order
+// by resolve(Value& kept, Value&& dup), any functor works, e.g. one summing counters.
+// Inputs under flat_parallel_min_size entries are built on the calling thread. Needs about twice the input's memory at peak.
+// @param entries entries to adopt, moved from
+// @param threads number of threads, 0 for std::thread::hardware_concurrency()
+template <typename Key, typename Value, typename Compare = std::less<Key>, typename Resolve = flat_keep_first>
+flat_map<Key, Value, Compare> flat_map_build_parallel(std::vector<std::pair<Key, Value>>&& entries, size_t threads = 0,
+                                                      const Compare& comp = Compare(), Resolve resolve = Resolve()) {
+    using value_type = std::pair<Key, Value>;
+    flat_parallel_sort_unique(entries, threads,
+        [&comp](const value_type& a, const value_type& b) { return comp(a.first, b.first); },
+        [&resolve](value_type& kept, value_type&& dup) { resolve(kept.second, std::move(dup.second)); });
+    return flat_map<Key, Value, Compare>(sorted_unique, std::move(entries), comp);
+}
+
+//  flat map keeping keys and values in two separate sorted arrays (structure of arrays)
+//  flat_map interleaves keys with values, so with large values every probe of the binary search pulls a cache line
+//  that is mostly value bytes. Here the search only reads the key array, which is dense and much smaller,
+//  and the value array is touched once, when the found entry's value is used.
+//  Iterators yield proxy pairs std::pair<const Key&, Value&> built on the fly, it->first and it->second work as usual,
+//  but there is no value_type object to point to, so keep the proxy by value (auto kv = *it), not by reference
+//  Insert, Delete's complexity is O(n), both arrays shift
+//  This implement is not thread-safe
+template <typename Key, typename Value, typename Compare = std::less<Key>>
+class soa_flat_map {
+public:
+    using key_type = Key;
+    using mapped_type = Value;
+    using value_type = std::pair<Key, Value>;
+    using size_type = size_t;
+
+    // iterator over both arrays, IsConst selects const Value&
+    // It moves like a random access iterator, but operator* returns a proxy pair by value rather than a reference,
+    // so it is only an input iterator to the standard library
+    template <bool IsConst>
+    class basic_iterator {
+    private:
+        using map_type = typename std::conditional<IsConst, const soa_flat_map, soa_flat_map>::type;
+        using value_ref = typename std::conditional<IsConst, const Value&, Value&>::type;
+        map_type* map_;
+        size_t i_;
+        friend class soa_flat_map;
+        basic_iterator(map_type* map, size_t i) : map_(map), i_(i) {}
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = std::pair<Key, Value>;
+        using difference_type = std::ptrdiff_t;
+        using reference = std::pair<const Key&, value_ref>;
+        // operator-> has to return something with an operator->, it holds the proxy pair
+        struct pointer {
+            reference ref_;
+            const reference* operator->() const {
+                return &ref_;
+            }
+        };
+
+        basic_iterator() : map_(nullptr), i_(0) {}
+        // iterator converts to const_iterator
+        template <bool C = IsConst, typename std::enable_if<C, int>::type = 0>
+        basic_iterator(const basic_iterator<false>& other) : map_(other.map_), i_(other.i_) {}
+
+        reference operator*() const {
+            return reference(map_->keys_[i_], map_->values_[i_]);
+        }
+        pointer operator->() const {
+            return pointer{**this};
+        }
+        reference operator[](difference_type n) const {
+            return *(*this + n);
+        }
+        const Key& key() const {
+            return map_->keys_[i_];
+        }
+        value_ref value() const {
+            return map_->values_[i_];
+        }
+
+        basic_iterator& operator++() {
+            i_++;
+            return *this;
+        }
+        basic_iterator operator++(int) {
+            basic_iterator tmp = *this;
+            i_++;
+            return tmp;
+        }
+        basic_iterator& operator--() {
+            i_--;
+            return *this;
+        }
+        basic_iterator operator--(int) {
+            basic_iterator tmp = *this;
+            i_--;
+            return tmp;
+        }
+        basic_iterator& operator+=(difference_type n) {
+            i_ += n;
+            return *this;
+        }
+        basic_iterator& operator-=(difference_type n) {
+            i_ -= n;
+            return *this;
+        }
+        basic_iterator operator+(difference_type n) const {
+            return basic_iterator(map_, i_ + n);
+        }
+        basic_iterator operator-(difference_type n) const {
+            return basic_iterator(map_, i_ - n);
+        }
+        difference_type operator-(const basic_iterator& other) const {
+            return static_cast<difference_type>(i_) - static_cast<difference_type>(other.i_);
+        }
+        // iterator and const_iterator compare with each other
+        template <bool C>
+        bool operator==(const basic_iterator<C>& other) const {
+            return i_ == other.i_;
+        }
+        template <bool C>
+        bool operator!=(const basic_iterator<C>& other) const {
+            return i_ != other.i_;
+        }
+        bool operator<(const basic_iterator& other) const {
+            return i_ < other.i_;
+        }
+        bool operator>(const basic_iterator& other) const {
+            return i_ > other.i_;
+        }
+        bool operator<=(const basic_iterator& other) const {
+            return i_ <= other.i_;
+        }
+        bool operator>=(const basic_iterator& other) const {
+            return i_ >= other.i_;
+        }
+        template <bool C>
+        friend class basic_iterator;
+    };
+    using iterator = basic_iterator<false>;
+    using const_iterator = basic_iterator<true>;
+
+private:
+    std::vector<Key> keys_;
+    std::vector<Value> values_;
+    Compare comp_;
+
+    bool equal(const Key& a, const Key& b) const {
+        return !(comp_(a, b) || comp_(b, a));
+    }
+
+    // arithmetic keys ordered by std::less are searched without branches
+    using fast_search = std::integral_constant<bool,
+        std::is_arithmetic<Key>::value && std::is_same<Compare, std::less<Key>>::value>;
+    // keys are contiguous here, the final block is two cache lines of arithmetic keys and its scan vectorizes
+    static constexpr size_t search_block = 128 / sizeof(Key);
+    static constexpr size_t linear_search_max = 8;
+
+    // @return position of k in keys_ or of the first key greater than k
+    size_t bin_impl(const Key& k) const {
+        return bin_impl(k, fast_search());
+    }
+
+    size_t bin_impl(const Key& k, std::false_type) const {
+        size_t l = 0, r = keys_.size();
+        if (r <= linear_search_max) {
+            while (l < r && comp_(keys_[l], k)) l++;
+            return l;
+        }
+        while (l < r) {
+            size_t mid = l + (r - l) / 2;
+            if (comp_(keys_[mid], k)) l = mid + 1;
+            else r = mid;
+        }
+        return l;
+    }
+
+    size_t bin_impl(const Key& k, std::true_type) const {
+        const Key* base = keys_.data();
+        size_t n = keys_.size();
+        while (n > search_block) {
+            size_t half = n / 2;
+            flat_prefetch(base + half / 2);
+            flat_prefetch(base + half + half / 2);
+            base = base[half] < k ? base + half : base;     // compiled to a conditional move
+            n -= half;
+        }
+        size_t c = 0;
+        for (size_t i = 0; i < n; i++) {
+            c += base[i] < k ? 1 : 0;
+        }
+        return (base - keys_.data()) + c;
+    }
+
+    // @return position of key, size() if not found
+    size_t find_impl(const Key& key) const {
+        size_t pos = bin_impl(key);
+        return (pos < keys_.size() && equal(key, keys_[pos])) ? pos : keys_.size();
+    }
+
+    // insert into both arrays at pos, the key is taken back out if the value throws
+    template <typename K, typename... Args>
+    void emplace_at(size_t pos, K&& key, Args&&... args) {
+        keys_.insert(keys_.begin() + pos, std::forward<K>(key));
+        try {
+            values_.emplace(values_.begin() + pos, std::forward<Args>(args)...);
+        } catch (...) {
+            keys_.erase(keys_.begin() + pos);
+            throw;
+        }
+    }
+
+    template <typename K, typename... Args>
+    std::pair<iterator, bool> try_emplace_impl(K&& key, Args&&... args) {
+        size_t pos = bin_impl(key);
+        if (pos < keys_.size() && equal(key, keys_[pos])) {
+            return {iterator(this, pos), false};
+        }
+        emplace_at(pos, std::forward<K>(key), std::forward<Args>(args)...);
+        return {iterator(this, pos), true};
+    }
+
+    template <typename K, typename M>
+    std::pair<iterator, bool> insert_or_assign_impl(K&& key, M&& obj) {
+        size_t pos = bin_impl(key);
+        if (pos < keys_.size() && equal(key, keys_[pos])) {
+            values_[pos] = std::forward<M>(obj);
+            return {iterator(this, pos), false};
+        }
+        emplace_at(pos, std::forward<K>(key), std::forward<M>(obj));
+        return {iterator(this, pos), true};
+    }
+
+public:
+    soa_flat_map() = default;
+    explicit soa_flat_map(const Compare& comp) : comp_(comp) {}
+
+    // @brief Adopt keys sorted by comp without duplicates and their values in the same order, without copying
+    // @throw std::invalid_argument if the arrays have different sizes
+    soa_flat_map(sorted_unique_t, std::vector<Key>&& keys, std::vector<Value>&& values, const Compare& comp = Compare())
+        : keys_(std::move(keys)), values_(std::move(values)), comp_(comp) {
+        if (keys_.size() != values_.size()) {
+            throw std::invalid_argument("soa_flat_map: keys and values have different sizes");
+        }
+        assert(std::adjacent_find(keys_.begin(), keys_.end(),
+            [this](const Key& a, const Key& b) { return !comp_(a, b); }) == keys_.end()
+            && "keys are not sorted or have duplicates");
+    }
+
+    size_t count(const Key& key) const {
+        return find_impl(key) < keys_.size() ? 1 : 0;
+    }
+
+    // @return element's iterator or end() if not found
+    iterator find(const Key& key) {
+        return iterator(this, find_impl(key));
+    }
+    const_iterator find(const Key& key) const {
+        return const_iterator(this, find_impl(key));
+    }
+
+    Value& at(const Key& key) {
+        size_t pos = find_impl(key);
+        if (pos == keys_.size()) {
+            throw std::out_of_range("soa_flat_map::at: key not found");
+        }
+        return values_[pos];
+    }
+    const Value& at(const Key& key) const {
+        size_t pos = find_impl(key);
+        if (pos == keys_.size()) {
+            throw std::out_of_range("soa_flat_map::at: key not found");
+        }
+        return values_[pos];
+    }
+
+    Value& operator[](const Key& key) {
+        return values_[try_emplace_impl(key).first.i_];
+    }
+    Value& operator[](Key&& key) {
+        return values_[try_emplace_impl(std::move(key)).first.i_];
+    }
+
+    // @brief insert one entry
+    // @return pair of {iterator to inserted or existing element, whether insertion took place}
+    std::pair<iterator, bool> insert(const value_type& val) {
+        return try_emplace_impl(val.first, val.second);
+    }
+    std::pair<iterator, bool> insert(value_type&& val) {
+        return try_emplace_impl(std::move(val.first), std::move(val.second));
+    }
+
+    // @brief construct the value from args only if key is absent
+    template <typename... Args>
+    std::pair<iterator, bool> try_emplace(const Key& key, Args&&... args) {
+        return try_emplace_impl(key, std::forward<Args>(args)...);
+    }
+    template <typename... Args>
+    std::pair<iterator, bool> try_emplace(Key&& key, Args&&... args) {
+        return try_emplace_impl(std::move(key), std::forward<Args>(args)...);
+    }
+
+    template <typename M>
+    std::pair<iterator, bool> insert_or_assign(const Key& key, M&& obj) {
+        return insert_or_assign_impl(key, std::forward<M>(obj));
+    }
+    template <typename M>
+    std::pair<iterator, bool> insert_or_assign(Key&& key, M&& obj) {
+        return insert_or_assign_impl(std::move(key), std::forward<M>(obj));
+    }
+
+    // @return 1 if the element is erased, 0 if not found
+    size_t erase(const Key& key) {
+        size_t pos = find_impl(key);
+        if (pos == keys_.size()) return 0;
+        keys_.erase(keys_.begin() + pos);
+        values_.erase(values_.begin() + pos);
+        return 1;
+    }
+
+    // @return next iterator after erased one
+    iterator erase(const_iterator pos) {
+        keys_.erase(keys_.begin() + pos.i_);
+        values_.erase(values_.begin() + pos.i_);
+        return iterator(this, pos.i_);
+    }
+
+    iterator begin() {
+        return iterator(this, 0);
+    }
+    iterator end() {
+        return iterator(this, keys_.size());
+    }
+    const_iterator begin() const {
+        return const_iterator(this, 0);
+    }
+    const_iterator end() const {
+        return const_iterator(this, keys_.size());
+    }
+    const_iterator cbegin() const {
+        return begin();
+    }
+    const_iterator cend() const {
+        return end();
+    }
+
+    // the sorted key array and the value array in the same order, e.g. to scan only one of them
+    const std::vector<Key>& keys() const {
+        return keys_;
+    }
+    const std::vector<Value>& values() const {
+        return values_;
+    }
+
+    size_t size() const {
+        return keys_.size();
+    }
+    bool empty() const {
+        return keys_.empty();
+    }
+    void clear() {
+        keys_.clear();
+        values_.clear();
+    }
+    void reserve(size_t n) {
+        keys_.reserve(n);
+        values_.reserve(n);
+    }
+};
+
+//  Concurrent flat_map for read-mostly data (routing tables, configuration), readers never lock
+//  The map is an immutable snapshot published through an atomic pointer. A writer copies the current snapshot,
+//  applies a batch of changes to the copy and publishes it, so readers always see a whole version.
+//  Readers run inside read(fn): each one marks a reader slot of its own cache line with the epoch it entered in,
+//  loads the snapshot pointer and clears the slot when fn returns. No reader writes a shared cache line, they don't
+//  contend with each other, and the cost is one compare and swap on the slot plus two atomic loads.
+//  A replaced snapshot is freed once no slot holds an epoch older than its replacement. Writers never wait for readers,
+//  they only free what is safe and leave the rest to a later update.
+//  注：
+//  1. 每次更新都复制整个map，O(n)，应在update中批量修改，不适合写入频繁的场景
+//  2. 不要在read的回调里保存map的引用或迭代器到回调外使用，回调返回后快照可能被释放
+//  3. 同时在读的线程超过reader_slots时，多出的读者会自旋等待空闲的slot
+template <typename Key, typename Value, typename Compare = std::less<Key>>
+class cow_flat_map {
+public:
+    using map_type = flat_map<Key, Value, Compare>;
+    static constexpr size_t reader_slots = 64;
+
+private:
+    struct alignas(DEFAULT_CACHE_LINE_WIDTH) reader_slot {
+        std::atomic<uint64_t> epoch;    // 0 when idle, otherwise the epoch the reader entered in
+    };
+
+    std::atomic<const map_type*> current_;
+    std::atomic<uint64_t> epoch_;
+    mutable reader_slot slots_[reader_slots];
+    std::mutex write_mutex_;
+    std::vector<std::pair<uint64_t, const map_type*>> retired_;  // replaced snapshots and the epoch of their replacement
+
+    // every thread starts probing at its own slot, so readers usually find theirs free
+    static size_t thread_slot() {
+        static std::atomic<size_t> next_id(0);
+        thread_local size_t id = next_id.fetch_add(1, std::memory_order_relaxed);
+        return id % reader_slots;
+    }
+
+    // free retired snapshots no reader can still see, write_mutex_ must be held
+    void reclaim() {
+        uint64_t oldest = ~uint64_t(0);
+        for (size_t i = 0; i < reader_slots; i++) {
+            uint64_t e = slots_[i].epoch.load();
+            if (e != 0 && e < oldest) oldest = e;
+        }
+        // a reader that entered before epoch e may hold a snapshot replaced at e
+        size_t kept = 0;
+        for (size_t i = 0; i < retired_.size(); i++) {
+            if (retired_[i].first <= oldest) {
+                delete retired_[i].second;
+            } else {
+                retired_[kept++] = retired_[i];
+            }
+        }
+        retired_.resize(kept);
+    }
+
+    void publish(const map_type* next) {
+        const map_type* old = current_.exchange(next);
+        uint64_t e = epoch_.fetch_add(1) + 1;
+        retired_.push_back({e, old});
+        reclaim();
+    }
+
+public:
+    cow_flat_map() : cow_flat_map(map_type()) {}
+
+    explicit cow_flat_map(map_type initial) : current_(new map_type(std::move(initial))), epoch_(1) {
+        for (size_t i = 0; i < reader_slots; i++) {
+            slots_[i].epoch.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    cow_flat_map(const cow_flat_map&) = delete;
+    cow_flat_map& operator=(const cow_flat_map&) = delete;
+
+    // @message No reader or writer may be running
+    ~cow_flat_map() {
+        delete current_.load();
+        for (auto& r : retired_) {
+            delete r.second;
+        }
+    }
+
+    // @brief Run fn(const map_type&) on the current snapshot without locking
+    // @return what fn returns
+    template <typename Fn>
+    auto read(Fn&& fn) const -> decltype(fn(std::declval<const map_type&>())) {
+        size_t i = thread_slot();
+        uint64_t e = epoch_.load();
+        uint64_t idle = 0;
+        while (!slots_[i].epoch.compare_exchange_weak(idle, e)) {
+            idle = 0;
+            i = (i + 1) % reader_slots;
+        }
+        // clears the slot when fn returns or throws
+        struct slot_guard {
+            std::atomic<uint64_t>& epoch;
+            ~slot_guard() {
+                epoch.store(0, std::memory_order_release);
+            }
+        } guard{slots_[i].epoch};
+        return fn(*current_.load());
+    }
+
+    // @brief Apply fn(map_type&) to a copy of the current snapshot and publish the copy, writers are serialized
+    // Batch many changes into one update, every update copies the whole map
+    template <typename Fn>
+    void update(Fn&& fn) {
+        std::lock_guard<std::mutex> lock(write_mutex_);
+        std::unique_ptr<map_type> next(new map_type(*current_.load()));
+        fn(*next);
+        publish(next.release());
+    }
+
+    // @brief Publish a new map replacing the whole content, without copying the old one
+    void assign(map_type next) {
+        std::lock_guard<std::mutex> lock(write_mutex_);
+        publish(new map_type(std::move(next)));
+    }
+
+    // single key reads, each one is a whole read
+    bool contains(const Key& key) const {
+        return read([&key](const map_type& m) { return m.contains(key); });
+    }
+    // @return copy of the value, or fallback if key is absent
+    Value get(const Key& key, const Value& fallback = Value()) const {
+        return read([&](const map_type& m) {
+            auto it = m.find(key);
+            return it == m.end() ? fallback : it->second;
+        });
+    }
+    size_t size() const {
+        return read([](const map_type& m) { return m.size(); });
+    }
+
+    // single key writes, each one is a whole update that copies the map
+    void insert_or_assign(const Key& key, const Value& value) {
+        update([&](map_type& m) { m.insert_or_assign(key, value); });
+    }
+    size_t erase(const Key& key) {
+        size_t n = 0;
+        update([&](map_type& m) { n = m.erase(key); });
+        return n;
+    }
+
+    // snapshots replaced but not yet freed because a reader may still use them
+    size_t retired() {
+        std::lock_guard<std::mutex> lock(write_mutex_);
+        reclaim();
+        return retired_.size();
+    }
+};
+
+//  Read-only map of arithmetic keys with a piecewise linear learned index, built once from sorted entries
+//  The keys are covered by line segments, each predicting the position of a key from the key itself
+//  within max_error slots. Building is one greedy pass: a segment grows while some line still fits all its points
+//  within max_error (the shrinking cone). A lookup binary searches the small segment array, evaluates the line
+//  and binary searches 2 * max_error + 1 slots, O(log segments + log max_error) instead of O(log n).
+//  Nearly uniform keys need very few segments, clustered keys need more, the error bound holds for any distribution.
+//  Positions predicted with double precision are checked against the neighbours of the window, a bad prediction
+//  falls back to binary search, so results are exact even for huge keys
+//  This implement is not thread-safe for writes, concurrent reads are fine
+template <typename Key, typename Value>
+class learned_flat_map {
+    static_assert(std::is_arithmetic<Key>::value, "learned_flat_map needs arithmetic keys");
+public:
+    using key_type = Key;
+    using mapped_type = Value;
+    using value_type = std::pair<Key, Value>;
+    using iterator = typename std::vector<value_type>::const_iterator;
+    using const_iterator = typename std::vector<value_type>::const_iterator;
+
+private:
+    struct segment {
+        Key first_key;
+        double slope;       // slots per key unit
+        size_t first_pos;
+    };
+
+    std::vector<value_type> data_;
+    std::vector<segment> segments_;
+    std::vector<Key> segment_keys_;     // first key of every segment, searched before the segment is read
+    size_t max_error_;
+
+    // distance from a to b >= a as double, integers are subtracted first to keep precision for large keys
+    static double key_distance(Key a, Key b) {
+        return key_distance(a, b, std::is_integral<Key>());
+    }
+    static double key_distance(Key a, Key b, std::true_type) {
+        using U = typename std::make_unsigned<Key>::type;
+        return static_cast<double>(static_cast<U>(static_cast<U>(b) - static_cast<U>(a)));
+    }
+    static double key_distance(Key a, Key b, std::false_type) {
+        return static_cast<double>(b) - static_cast<double>(a);
+    }
+
+    void build() {
+        const size_t n = data_.size();
+        size_t start = 0;
+        while (start < n) {
+            // slopes of lines through the segment's first point that keep every point within max_error
+            double lo = 0, hi = std::numeric_limits<double>::infinity();
+            size_t end = start + 1;
+            const double err = static_cast<double>(max_error_);
+            for (; end < n; end++) {
+                const double dx = key_distance(data_[start].first, data_[end].first);
+                const double dy = static_cast<double>(end - start);
+                const double new_lo = std::max(lo, (dy - err) / dx);
+                const double new_hi = std::min(hi, (dy + err) / dx);
+                if (new_lo > new_hi) break;
+                lo = new_lo;
+                hi = new_hi;
+            }
+            double slope = end - start == 1 ? 0 : (hi == std::numeric_limits<double>::infinity() ? lo : (lo + hi) / 2);
+            segments_.push_back({data_[start].first, slope, start});
+            segment_keys_.push_back(data_[start].first);
+            start = end;
+        }
+        segments_.shrink_to_fit();
+        segment_keys_.shrink_to_fit();
+    }
+
+    // @return position of the first entry whose key is not less than k
+    size_t lower_bound_pos(const Key& k) const {
+        const size_t n = data_.size();
+        if (n == 0 || !(data_[0].first < k)) return 0;
+        // last segment starting at or before k
+        size_t s = static_cast<size_t>(std::upper_bound(segment_keys_.begin(), segment_keys_.end(), k) - segment_keys_.begin()) - 1;
+        const segment& seg = segments_[s];
+        // keys past the segment's last point belong right after it, don't extrapolate into the next segment
+        const size_t seg_end = s + 1 < segments_.size() ? segments_[s + 1].first_pos : n;
+        const double guess = static_cast<double>(seg.first_pos) + seg.slope * key_distance(seg.first_key, k);
+        // infinite keys give inf or NaN guesses (0 * inf, inf - inf), which must not reach the cast
+        size_t pred = !(guess < static_cast<double>(seg_end)) ? seg_end
+                      : (guess <= static_cast<double>(seg.first_pos) ? seg.first_pos : static_cast<size_t>(guess));
+        size_t l = pred > max_error_ + 1 ? pred - max_error_ - 1 : 0;
+        size_t r = pred + max_error_ + 2 < n ? pred + max_error_ + 2 : n;
+        auto less = [](const value_type& e, const Key& key) { return e.first < key; };
+        size_t pos = static_cast<size_t>(std::lower_bound(data_.begin() + l, data_.begin() + r, k, less) - data_.begin());
+        // the window is right if the answer has a smaller key before it and a key not less than k at it
+        bool ok = (pos == 0 || data_[pos - 1].first < k) && (pos == n || !(data_[pos].first < k));
+        if (!ok) {
+            pos = static_cast<size_t>(std::lower_bound(data_.begin(), data_.end(), k, less) - data_.begin());
+        }
+        return pos;
+    }
+
+public:
+    static constexpr size_t default_max_error = 32;
+
+    learned_flat_map() : max_error_(default_max_error) {}
+
+    // @brief Build from entries sorted by key without duplicate keys
+    // @param max_error largest distance between a predicted and the real position
+    learned_flat_map(sorted_unique_t, std::vector<value_type>&& data, size_t max_error = default_max_error)
+        : data_(std::move(data)), max_error_(max_error) {
+        assert(std::adjacent_find(data_.begin(), data_.end(),
+            [](const value_type& a, const value_type& b) { return !(a.first < b.first); }) == data_.end()
+            && "data is not sorted or has duplicate keys");
+        build();
+    }
+
+    // @brief Build from a flat_map, the map is left untouched
+    template <typename Container, typename Search>
+    explicit learned_flat_map(const flat_map<Key, Value, std::less<Key>, Container, Search>& map, size_t max_error = default_max_error)
+        : data_(map.begin(), map.end()), max_error_(max_error) {
+        build();
+    }
+
+    size_t count(const Key& key) const {
+        size_t pos = lower_bound_pos(key);
+        return (pos < data_.size() && !(key < data_[pos].first)) ? 1 : 0;
+    }
+
+    bool contains(const Key& key) const {
+        return count(key) == 1;
+    }
+
+    // @return element's iterator or end() if not found
+    const_iterator find(const Key& key) const {
+        size_t pos = lower_bound_pos(key);
+        return (pos < data_.size() && !(key < data_[pos].first)) ? data_.begin() + pos : data_.end();
+    }
+
+    // @throw std::out_of_range if key is not found
+    const Value& at(const Key& key) const {
+        auto it = find(key);
+        if (it == data_.end()) {
+            throw std::out_of_range("learned_flat_map::at: key not found");
+        }
+        return it->second;
+    }
+
+    // @return first element whose key is not less than key
+    const_iterator lower_bound(const Key& key) const {
+        return data_.begin() + lower_bound_pos(key);
+    }
+
+    const_iterator begin() const {
+        return data_.begin();
+    }
+    const_iterator end() const {
+        return data_.end();
+    }
+    const_iterator cbegin() const {
+        return data_.cbegin();
+    }
+    const_iterator cend() const {
+        return data_.cend();
+    }
+
+    size_t size() const {
+        return data_.size();
+    }
+    bool empty() const {
+        return data_.empty();
+    }
+    // number of line segments of the index, fewer is better
+    size_t segments() const {
+        return segments_.size();
+    }
+    size_t max_error() const {
+        return max_error_;
+    }
+};
 }
 
 #endif
\ No newline at end of file
@@ -7,17 +7,134 @@
 #include <cstddef>
 #include <iterator>
 #include <vector>
+#include <algorithm>
+#include <functional>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+#include "FlatCommon.hpp"
 
 namespace toylib {
 
+// number of elements less than v in sorted p[0, n), used to finish a search inside a small block
+// scalar version, branch free so the compiler can vectorize it
+template <typename T>
+static inline size_t flat_count_less(const T* p, size_t n, T v) {
+    size_t c = 0;
+    for (size_t i = 0; i < n; i++) {
+        c += p[i] < v ? 1 : 0;
+    }
+    return c;
+}
+
+static inline unsigned flat_popcount32(uint32_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+    return static_cast<unsigned>(__builtin_popcount(x));
+#else
+    unsigned n = 0;
+    while (x) {
+        x &= x - 1;
+        n++;
+    }
+    return n;
+#endif
+}
+
+#if defined(__AVX2__)
+static inline size_t flat_count_less(const int32_t* p, size_t n, int32_t v) {
+    const __m256i key = _mm256_set1_epi32(v);
+    size_t c = 0, i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+        c += flat_popcount32(static_cast<uint32_t>(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(key, x)))));
+    }
+    return c + flat_count_less<int32_t>(p + i, n - i, v);
+}
+
+static inline size_t flat_count_less(const uint32_t* p, size_t n, uint32_t v) {
+    // flip the sign bit so that signed compare gives unsigned order
+    const __m256i bias = _mm256_set1_epi32(INT32_MIN);
+    const __m256i key = _mm256_xor_si256(_mm256_set1_epi32(static_cast<int32_t>(v)), bias);
+    size_t c = 0, i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i x = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i)), bias);
+        c += flat_popcount32(static_cast<uint32_t>(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(key, x)))));
+    }
+    return c + flat_count_less<uint32_t>(p + i, n - i, v);
+}
+
+static inline size_t flat_count_less(const int64_t* p, size_t n, int64_t v) {
+    const __m256i key = _mm256_set1_epi64x(v);
+    size_t c = 0, i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+        c += flat_popcount32(static_cast<uint32_t>(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(key, x)))));
+    }
+    return c + flat_count_less<int64_t>(p + i, n - i, v);
+}
+
+static inline size_t flat_count_less(const float* p, size_t n, float v) {
+    const __m256 key = _mm256_set1_ps(v);
+    size_t c = 0, i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 x = _mm256_loadu_ps(p + i);
+        c += flat_popcount32(static_cast<uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(x, key, _CMP_LT_OQ))));
+    }
+    return c + flat_count_less<float>(p + i, n - i, v);
+}
+#elif defined(__SSE2__) || defined(_M_X64)
+static inline size_t flat_count_less(const int32_t* p, size_t n, int32_t v) {
+    const __m128i key = _mm_set1_epi32(v);
+    size_t c = 0, i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+        c += flat_popcount32(static_cast<uint32_t>(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmplt_epi32(x, key)))));
+    }
+    return c + flat_count_less<int32_t>(p + i, n - i, v);
+}
+
+static inline size_t flat_count_less(const uint32_t* p, size_t n, uint32_t v) {
+    // flip the sign bit so that signed compare gives unsigned order
+    const __m128i bias = _mm_set1_epi32(INT32_MIN);
+    const __m128i key = _mm_xor_si128(_mm_set1_epi32(static_cast<int32_t>(v)), bias);
+    size_t c = 0, i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i x = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i)), bias);
+        c += flat_popcount32(static_cast<uint32_t>(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmplt_epi32(x, key)))));
+    }
+    return c + flat_count_less<uint32_t>(p + i, n - i, v);
+}
+
+static inline size_t flat_count_less(const float* p, size_t n, float v) {
+    const __m128 key = _mm_set1_ps(v);
+    size_t c = 0, i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 x = _mm_loadu_ps(p + i);
+        c += flat_popcount32(static_cast<uint32_t>(_mm_movemask_ps(_mm_cmplt_ps(x, key))));
+    }
+    return c + flat_count_less<float>(p + i, n - i, v);
+}
+#endif
 
 //  flat set container, like std::set but using sorted array as backend and elements are sorted in ascending order by default
 //  Lookup is done by binary search, complexity is O(log n)
 //  Insert, Delete's complexity is O(n) due to array shifting
 //  Iteration is done by array traversal, complexity is O(n)
 //  So flat_set suits scenarios where insertion and deletion are rare but lookup and iteration are frequent
-//  This implement is not thread-safe
-template <typename Key, typename Compare = std::less<Key>>
+//  Container is the storage policy, any contiguous sequence with std::vector's interface, e.g. small_vector<Key, N>
+//  from SmallVector.hpp keeps up to N keys inline, so tiny sets don't allocate
+//  This implement is not thread-safe for writes. Const member functions (find, count, lower_bound, contains...)
+//  don't modify anything, so any number of threads may read a set concurrently as long as none writes it
+template <typename Key, typename Compare = std::less<Key>, typename Container = std::vector<Key>>
 class flat_set {
 public:
     // Using Compare to judge two elem's equal
@@ -26,18 +143,46 @@ public:
 
     // iterator definition
     // We can't modify element in a set by iterator, so we set them to const
-    using iterator = typename std::vector<Key>::const_iterator;
-    using const_iterator = typename std::vector<Key>::const_iterator;
+    using iterator = typename Container::const_iterator;
+    using const_iterator = typename Container::const_iterator;
 private:
-    bool equal(const Key& a, const Key& b) const {
+    // also used with a key of another type when Compare is transparent
+    template <typename A, typename B>
+    bool equal(const A& a, const B& b) const {
         return !(comp_(a, b) || comp_(b, a));
     }
 
-    std::vector<Key> data_;
+    // heterogeneous overloads only take part in overload resolution with a transparent comparator
+    template <typename K>
+    using enable_transparent = typename std::enable_if<flat_is_transparent<Compare>::value &&
+        !std::is_convertible<K, const_iterator>::value, int>::type;
+
+    Container data_;
+
+    // arithmetic keys ordered by std::less are searched without branches and finished with SIMD compares
+    using fast_search = std::integral_constant<bool,
+        std::is_arithmetic<Key>::value && std::is_same<Compare, std::less<Key>>::value>;
+    // elements left when the branchless search switches to counting, two cache lines of arithmetic keys
+    static constexpr size_t search_block = 128 / sizeof(Key);
+
+    // searches interleaved by lower_bound_batch, enough to keep the memory system busy
+    static constexpr size_t batch_group = 16;
+
+    // ranges up to this size are scanned linearly, tiny sets skip the unpredictable branches of binary search
+    static constexpr size_t linear_search_max = 8;
 
     // binary search method in range [l, r)
     // returns the position of v in data_ or the first element greater than v
     size_t bin_impl(const Key& v, size_t l, size_t r) const {
+        return bin_impl(v, l, r, fast_search());
+    }
+
+    template <typename K>
+    size_t bin_impl(const K& v, size_t l, size_t r, std::false_type) const {
+        if (r - l <= linear_search_max) {
+            while (l < r && comp_(data_[l], v)) l++;
+            return l;
+        }
         while (l < r) {
             size_t mid = l + (r - l) / 2;
             // data_[mid] < v
@@ -46,11 +191,141 @@ private:
         }
         return l; // l == r
     }
+
+    size_t bin_impl(const Key& v, size_t l, size_t r, std::true_type) const {
+        const Key* base = data_.data() + l;
+        size_t n = r - l;
+        // elements before base are less than v, answer is in [base, base + n]
+        while (n > search_block) {
+            size_t half = n / 2;
+            // both candidates of the next probe, hides the load latency the conditional move exposes
+            flat_prefetch(base + half / 2);
+            flat_prefetch(base + half + half / 2);
+            base = base[half] < v ? base + half : base;     // compiled to a conditional move
+            n -= half;
+        }
+        return (base - data_.data()) + flat_count_less(base, n, v);
+    }
+
+    // @brief Lower bound positions of a batch of keys
+    // Unsorted batches run batch_group binary searches in lockstep, each step issues one probe per search
+    // and prefetches its next probe, so the cache misses of different searches overlap instead of queueing.
+    // Batches sorted by comp_ are merged against data_ with galloping instead.
+    void lower_bound_batch(const Key* keys, size_t n, size_t* pos) const {
+        const size_t size = data_.size();
+        if (size == 0) {
+            std::fill(pos, pos + n, size_t(0));
+            return;
+        }
+        if (std::is_sorted(keys, keys + n, comp_)) {
+            size_t from = 0;
+            for (size_t i = 0; i < n; i++) {
+                from = gallop_impl(keys[i], from);
+                pos[i] = from;
+            }
+            return;
+        }
+        const Key* data = data_.data();
+        for (size_t g = 0; g < n; g += batch_group) {
+            const size_t m = n - g < batch_group ? n - g : batch_group;
+            const Key* base[batch_group];
+            for (size_t j = 0; j < m; j++) {
+                base[j] = data;
+            }
+            // every search has the same length, so they all narrow in the same steps
+            for (size_t len = size; len > 1;) {
+                const size_t half = len / 2;
+                len -= half;
+                for (size_t j = 0; j < m; j++) {
+                    base[j] = comp_(base[j][half], keys[g + j]) ? base[j] + half : base[j];
+                    flat_prefetch(base[j] + len / 2);
+                }
+            }
+            for (size_t j = 0; j < m; j++) {
+                pos[g + j] = (base[j] - data) + (comp_(*base[j], keys[g + j]) ? 1 : 0);
+            }
+        }
+    }
+
+    // @return first position at or after from whose key is not less than key, by probing from + 1, 3, 7, 15...
+    size_t gallop_impl(const Key& key, size_t from) const {
+        const size_t size = data_.size();
+        size_t lo = from, step = 1;
+        while (from + step <= size && comp_(data_[from + step - 1], key)) {
+            lo = from + step;
+            step = step * 2 + 1;
+        }
+        return bin_impl(key, lo, std::min(from + step - 1, size));
+    }
+
+    // keys are unique, so the upper bound is the lower bound or one past it
+    size_t upper_from(size_t lower, const Key& key) const {
+        return (lower < data_.size() && equal(key, data_[lower])) ? lower + 1 : lower;
+    }
+
+    template <typename K>
+    std::pair<iterator, bool> insert_impl(K&& key) {
+        auto pos = bin_impl(key, 0, data_.size());
+        if (pos < data_.size() && equal(key, data_[pos])) {
+            return {data_.begin() + pos, false};
+        }
+        data_.insert(data_.begin() + pos, std::forward<K>(key));
+        return {data_.begin() + pos, true};
+    }
+
+    // checks whether this position(hint) matches: prev < val < hint, otherwise falls back to a normal insert
+    template <typename K>
+    iterator insert_hint_impl(const_iterator hint, K&& val) {
+        if (data_.empty()) {
+            return data_.insert(data_.begin(), std::forward<K>(val));
+        }
+        if (hint == cbegin()) {
+            if (comp_(val, *hint)) {
+                return data_.insert(data_.begin(), std::forward<K>(val));
+            }
+            return insert_impl(std::forward<K>(val)).first;
+        }
+        if (hint == cend()) {
+            if (comp_(*(hint - 1), val)) {
+                data_.push_back(std::forward<K>(val));
+                return data_.end() - 1;
+            }
+            return insert_impl(std::forward<K>(val)).first;
+        }
+        if (comp_(*(hint - 1), val) && comp_(val, *hint)) {
+            return data_.insert(hint, std::forward<K>(val));
+        }
+        return insert_impl(std::forward<K>(val)).first;
+    }
+
+    std::pair<iterator, bool> emplace_impl(const Key& key) {
+        return insert_impl(key);
+    }
+    std::pair<iterator, bool> emplace_impl(Key& key) {
+        return insert_impl(static_cast<const Key&>(key));
+    }
+    std::pair<iterator, bool> emplace_impl(Key&& key) {
+        return insert_impl(std::move(key));
+    }
+    template <typename... Args>
+    std::pair<iterator, bool> emplace_impl(Args&&... args) {
+        return insert_impl(Key(std::forward<Args>(args)...));
+    }
+
     Compare comp_;
 public:
     // constructors/destructor
     flat_set() = default;
     explicit flat_set(const Compare& comp) : data_(), comp_(comp) {}
+
+    // @brief Adopt a container that is already sorted by comp and has no duplicates, without copying
+    // @message Ordering is only checked in debug mode
+    flat_set(sorted_unique_t, Container&& data, const Compare& comp = Compare())
+        : data_(std::move(data)), comp_(comp) {
+        assert(std::adjacent_find(data_.begin(), data_.end(),
+            [this](const Key& a, const Key& b) { return !comp_(a, b); }) == data_.end()
+            && "data is not sorted or has duplicates");
+    }
     ~flat_set() = default;
 
     // copy ops
@@ -71,26 +346,24 @@ public:
         return (pos < data_.size() && equal(key, data_[pos])) ? 1 : 0;
     }
 
-    // template <typename... Args>
-    // std::pair<iterator, bool> emplace(Args&&... args) {
-
-    // }
-
-    // template <typename... Args>
-    // iterator emplace_hint(const_iterator hint, Args&&... args) {
-
-    // }
+    // @brief count with any key comparable with Key, e.g. const char* for std::string keys
+    // @message Only available when Compare has is_transparent (e.g. std::less<>), no temporary Key is constructed
+    template <typename K, enable_transparent<K> = 0>
+    size_t count(const K& key) const {
+        auto pos = bin_impl(key, 0, data_.size(), std::false_type());
+        return (pos < data_.size() && equal(key, data_[pos])) ? 1 : 0;
+    }
 
     // @brief insert one key
     // @param key key to insert
     // @return pair of {iterator to inserted or existing element, whether insertion took place}
     std::pair<iterator, bool> insert(const Key& key) {
-        auto pos = bin_impl(key, 0, data_.size());
-        if (pos < data_.size() && equal(key, data_[pos])) {
-            return {data_.begin() + pos, false};
-        }
-        data_.insert(data_.begin() + pos, key);
-        return {data_.begin() + pos, true};
+        return insert_impl(key);
+    }
+
+    // @brief insert one key, moved into the set only if it is not present
+    std::pair<iterator, bool> insert(Key&& key) {
+        return insert_impl(std::move(key));
     }
 
     // @brief hinted insert
@@ -98,40 +371,44 @@ public:
     // @param val key to insert
     // @return Position of inserted or existing equal element
     iterator insert(const_iterator hint, const Key& val) {
-        // check whether this position(hint) matches:
-        //  prev < val < hint
-        if (data_.empty()) {
-            return data_.insert(data_.begin(), val);
-        }
-        if (hint == cbegin()) {
-            if ((comp_(val, *hint))) {
-                data_.insert(data_.begin(), val);
-                return data_.begin();
-            }
-            // just a normal insert
-            return insert(val).first;
-        }
-        if (hint == cend()) {
-            if (comp_(*(hint - 1), val)) {
-                data_.push_back(val);
-                return data_.end() - 1;
-            }
-            // just a normal insert
-            return insert(val).first;
-        }
-        if (comp_(*(hint - 1), val) && comp_(val, *hint)) {
-            return data_.insert(hint, val);
-        }
-        // normal insert
-        return insert(val).first;
+        return insert_hint_impl(hint, val);
+    }
+
+    iterator insert(const_iterator hint, Key&& val) {
+        return insert_hint_impl(hint, std::move(val));
+    }
+
+    // @brief construct a key in place
+    // The key has to exist to be compared, so it is built once on the stack and moved in if it is not present
+    // A single argument of type Key is inserted directly without that temporary
+    template <typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args) {
+        return emplace_impl(std::forward<Args>(args)...);
+    }
+
+    template <typename... Args>
+    iterator emplace_hint(const_iterator hint, Args&&... args) {
+        return insert_hint_impl(hint, Key(std::forward<Args>(args)...));
     }
 
     // @brief range insert
+    // Appends the new elements, sorts them and merges them with existing data in place, O(n + m log m)
+    // As with std::set, existing elements and the first of equal new elements are kept
     template <typename InputIt>
     void insert(InputIt first, InputIt last) {
-        for (auto it = first; it != last; ++it) {
-            insert(*it);
-        }
+        size_t old_size = data_.size();
+        data_.insert(data_.end(), first, last);
+        if (data_.size() == old_size) return;
+
+        auto eq = [this](const Key& a, const Key& b) { return equal(a, b); };
+        auto mid = data_.begin() + old_size;
+        std::stable_sort(mid, data_.end(), comp_);
+        data_.erase(std::unique(mid, data_.end(), eq), data_.end());
+        mid = data_.begin() + old_size;
+        // all new elements go after existing ones, skip merging (e.g. keys loaded in order)
+        if (old_size == 0 || comp_(*(mid - 1), *mid)) return;
+        std::inplace_merge(data_.begin(), mid, data_.end(), comp_);
+        data_.erase(std::unique(data_.begin(), data_.end(), eq), data_.end());
     }
 
     // @brief erase by key
@@ -144,6 +421,15 @@ public:
         return 1;
     }
 
+    // @brief erase by a key comparable with Key, needs a transparent comparator
+    template <typename K, enable_transparent<K> = 0>
+    size_t erase(const K& key) {
+        auto pos = bin_impl(key, 0, data_.size(), std::false_type());
+        if (pos >= data_.size() || !equal(key, data_[pos])) return 0;
+        data_.erase(data_.begin() + pos);
+        return 1;
+    }
+
     // @brief erase by iterator
     // @return next iterator after erased one
     iterator erase(iterator pos) {
@@ -158,12 +444,64 @@ public:
 
     // @brief find elem
     // @return element's iterator or end() if not found
-    iterator find(const Key& key) {
+    const_iterator find(const Key& key) const {
         auto pos = bin_impl(key, 0, data_.size());
         if (pos == data_.size() || !equal(key, data_[pos])) return end();
         return data_.begin() + pos;
     }
 
+    // @return whether key is in the set
+    bool contains(const Key& key) const {
+        return count(key) == 1;
+    }
+
+    // @return first element not less than key
+    const_iterator lower_bound(const Key& key) const {
+        return data_.begin() + bin_impl(key, 0, data_.size());
+    }
+
+    // @return first element greater than key
+    const_iterator upper_bound(const Key& key) const {
+        return data_.begin() + upper_from(bin_impl(key, 0, data_.size()), key);
+    }
+
+    // @return {lower_bound(key), upper_bound(key)}, an empty range or the one element equal to key
+    std::pair<const_iterator, const_iterator> equal_range(const Key& key) const {
+        size_t lower = bin_impl(key, 0, data_.size());
+        return {data_.begin() + lower, data_.begin() + upper_from(lower, key)};
+    }
+
+    // @brief Count a batch of keys, out[i] is count(keys[i])
+    // @message Faster than calling count() in a loop once the set doesn't fit in cache, more so when keys are sorted
+    void count_batch(const Key* keys, size_t n, size_t* out) const {
+        lower_bound_batch(keys, n, out);
+        for (size_t i = 0; i < n; i++) {
+            out[i] = (out[i] < data_.size() && equal(keys[i], data_[out[i]])) ? 1 : 0;
+        }
+    }
+
+    // @brief Find a batch of keys, out[i] is find(keys[i])
+    void find_batch(const Key* keys, size_t n, const_iterator* out) const {
+        std::vector<size_t> pos(n);
+        lower_bound_batch(keys, n, pos.data());
+        for (size_t i = 0; i < n; i++) {
+            out[i] = (pos[i] < data_.size() && equal(keys[i], data_[pos[i]])) ? data_.begin() + pos[i] : data_.end();
+        }
+    }
+
+    // @brief find by a key comparable with Key, needs a transparent comparator
+    template <typename K, enable_transparent<K> = 0>
+    const_iterator find(const K& key) const {
+        auto pos = bin_impl(key, 0, data_.size(), std::false_type());
+        if (pos == data_.size() || !equal(key, data_[pos])) return end();
+        return data_.begin() + pos;
+    }
+
+    template <typename K, enable_transparent<K> = 0>
+    bool contains(const K& key) const {
+        return count(key) == 1;
+    }
+
     // begins/ends
     iterator begin() {
         return data_.begin();
@@ -202,11 +540,786 @@ public:
     void reserve(size_t n) {
         data_.reserve(n);
     }
+    Compare key_comp() const {
+        return comp_;
+    }
     // std::vector<Key>& get_data() {
     //     return data_;
     // }
 };
+
+//  flat_set with a sorted insertion buffer in front of the main array, for write bursts
+//  New keys go into the small buffer, which is merged into the main array when it grows past its limit,
+//  so an insert shifts O(buffer) elements plus an amortized O(n / buffer) share of the merge instead of O(n).
+//  With the default limit of about sqrt(n) keys, inserting into a 1M-key set costs thousands of moves rather than a million.
+//  Lookups binary search both arrays, iteration merges them on the fly and yields keys in sorted order.
+//  Keys in the buffer are never in the main array, erase removes from whichever holds the key.
+//  This implement is not thread-safe
+template <typename Key, typename Compare = std::less<Key>>
+class buffered_flat_set {
+private:
+    std::vector<Key> main_;
+    std::vector<Key> buffer_;
+    size_t max_buffer_;     // 0 means about sqrt(size()), at least min_buffer
+    Compare comp_;
+
+    static constexpr size_t min_buffer = 64;
+
+    bool equal(const Key& a, const Key& b) const {
+        return !(comp_(a, b) || comp_(b, a));
+    }
+
+    static size_t lower_bound_in(const std::vector<Key>& v, const Key& key, const Compare& comp) {
+        return static_cast<size_t>(std::lower_bound(v.begin(), v.end(), key, comp) - v.begin());
+    }
+
+    size_t buffer_limit() const {
+        if (max_buffer_) return max_buffer_;
+        size_t limit = static_cast<size_t>(std::sqrt(static_cast<double>(main_.size())));
+        return limit < min_buffer ? min_buffer : limit;
+    }
+
+public:
+    // forward iterator merging the two arrays
+    class const_iterator {
+    private:
+        const buffered_flat_set* set_;
+        size_t i_;      // position in main_
+        size_t j_;      // position in buffer_
+        friend class buffered_flat_set;
+        const_iterator(const buffered_flat_set* set, size_t i, size_t j) : set_(set), i_(i), j_(j) {}
+
+        bool from_buffer() const {
+            return j_ < set_->buffer_.size() &&
+                (i_ == set_->main_.size() || set_->comp_(set_->buffer_[j_], set_->main_[i_]));
+        }
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = Key;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const Key*;
+        using reference = const Key&;
+
+        const_iterator() : set_(nullptr), i_(0), j_(0) {}
+        reference operator*() const {
+            return from_buffer() ? set_->buffer_[j_] : set_->main_[i_];
+        }
+        pointer operator->() const {
+            return &**this;
+        }
+        const_iterator& operator++() {
+            if (from_buffer()) ++j_;
+            else ++i_;
+            return *this;
+        }
+        const_iterator operator++(int) {
+            const_iterator tmp = *this;
+            ++(*this);
+            return tmp;
+        }
+        bool operator==(const const_iterator& other) const {
+            return i_ == other.i_ && j_ == other.j_;
+        }
+        bool operator!=(const const_iterator& other) const {
+            return !(*this == other);
+        }
+    };
+    using iterator = const_iterator;
+
+    // @param max_buffer Keys buffered before merging, 0 picks about sqrt(size()) on every merge
+    explicit buffered_flat_set(size_t max_buffer = 0, const Compare& comp = Compare())
+        : max_buffer_(max_buffer), comp_(comp) {}
+
+    size_t count(const Key& key) const {
+        size_t i = lower_bound_in(main_, key, comp_);
+        if (i < main_.size() && equal(key, main_[i])) return 1;
+        size_t j = lower_bound_in(buffer_, key, comp_);
+        return (j < buffer_.size() && equal(key, buffer_[j])) ? 1 : 0;
+    }
+
+    // @return element's iterator or end() if not found
+    const_iterator find(const Key& key) const {
+        size_t i = lower_bound_in(main_, key, comp_);
+        size_t j = lower_bound_in(buffer_, key, comp_);
+        if ((i < main_.size() && equal(key, main_[i])) || (j < buffer_.size() && equal(key, buffer_[j]))) {
+            return const_iterator(this, i, j);
+        }
+        return end();
+    }
+
+    // @brief insert one key, merges the buffer if it is full
+    // @return pair of {iterator to inserted or existing element, whether insertion took place}
+    std::pair<const_iterator, bool> insert(const Key& key) {
+        size_t i = lower_bound_in(main_, key, comp_);
+        if (i < main_.size() && equal(key, main_[i])) {
+            return {const_iterator(this, i, lower_bound_in(buffer_, key, comp_)), false};
+        }
+        size_t j = lower_bound_in(buffer_, key, comp_);
+        if (j < buffer_.size() && equal(key, buffer_[j])) {
+            return {const_iterator(this, i, j), false};
+        }
+        buffer_.insert(buffer_.begin() + j, key);
+        if (buffer_.size() > buffer_limit()) {
+            flush();
+            return {find(key), true};
+        }
+        return {const_iterator(this, i, j), true};
+    }
+
+    // @brief range insert, new keys are sorted into the buffer and merged at once if it overflows
+    template <typename InputIt>
+    void insert(InputIt first, InputIt last) {
+        for (; first != last; ++first) {
+            size_t i = lower_bound_in(main_, *first, comp_);
+            if (i < main_.size() && equal(*first, main_[i])) continue;
+            size_t j = lower_bound_in(buffer_, *first, comp_);
+            if (j < buffer_.size() && equal(*first, buffer_[j])) continue;
+            buffer_.insert(buffer_.begin() + j, *first);
+            if (buffer_.size() > buffer_limit()) flush();
+        }
+    }
+
+    // @brief erase by key
+    // @return 1 if the element is erased, 0 if not found
+    size_t erase(const Key& key) {
+        size_t j = lower_bound_in(buffer_, key, comp_);
+        if (j < buffer_.size() && equal(key, buffer_[j])) {
+            buffer_.erase(buffer_.begin() + j);
+            return 1;
+        }
+        size_t i = lower_bound_in(main_, key, comp_);
+        if (i < main_.size() && equal(key, main_[i])) {
+            main_.erase(main_.begin() + i);
+            return 1;
+        }
+        return 0;
+    }
+
+    // @brief merge the buffer into the main array, O(n + buffer)
+    void flush() {
+        if (buffer_.empty()) return;
+        size_t old_size = main_.size();
+        main_.insert(main_.end(), buffer_.begin(), buffer_.end());
+        buffer_.clear();
+        auto mid = main_.begin() + old_size;
+        if (old_size != 0 && comp_(*mid, *(mid - 1))) {
+            std::inplace_merge(main_.begin(), mid, main_.end(), comp_);
+        }
+    }
+
+    const_iterator begin() const {
+        return const_iterator(this, 0, 0);
+    }
+    const_iterator end() const {
+        return const_iterator(this, main_.size(), buffer_.size());
+    }
+    const_iterator cbegin() const {
+        return begin();
+    }
+    const_iterator cend() const {
+        return end();
+    }
+
+    size_t size() const {
+        return main_.size() + buffer_.size();
+    }
+    // keys waiting to be merged
+    size_t buffer_size() const {
+        return buffer_.size();
+    }
+    bool empty() const {
+        return main_.empty() && buffer_.empty();
+    }
+    void clear() {
+        main_.clear();
+        buffer_.clear();
+    }
+    void reserve(size_t n) {
+        main_.reserve(n);
+    }
+};
+
+// set algebra on flat_set
+// The four operations share one merge loop, telling which elements are written:
+// only in a, only in b, in both (written once, taken from a)
+struct flat_set_op {
+    bool only_a_;
+    bool only_b_;
+    bool both_;
+};
+
+// sizes differing by more than this factor switch from linear merge to galloping
+constexpr size_t flat_set_gallop_ratio = 16;
+
+// @return first position in [first, last) not less than v
+// probes first + 1, 3, 7, 15... then binary searches the last step, O(log d) where d is the distance to the answer
+template <typename It, typename Key, typename Compare>
+It flat_gallop(It first, It last, const Key& v, const Compare& comp) {
+    size_t n = static_cast<size_t>(last - first);
+    size_t step = 1, lo = 0;
+    while (step <= n && comp(first[step - 1], v)) {
+        lo = step;
+        step = step * 2 + 1;
+    }
+    return std::lower_bound(first + lo, first + (step <= n ? step - 1 : n), v, comp);
+}
+
+// linear merge, O(n + m)
+template <typename It, typename OutputIt, typename Compare>
+OutputIt flat_merge_op(It a, It a_end, It b, It b_end, OutputIt out, const Compare& comp, flat_set_op op) {
+    while (a != a_end && b != b_end) {
+        if (comp(*a, *b)) {
+            if (op.only_a_) *out++ = *a;
+            ++a;
+        } else if (comp(*b, *a)) {
+            if (op.only_b_) *out++ = *b;
+            ++b;
+        } else {
+            if (op.both_) *out++ = *a;
+            ++a;
+            ++b;
+        }
+    }
+    if (op.only_a_) out = std::copy(a, a_end, out);
+    if (op.only_b_) out = std::copy(b, b_end, out);
+    return out;
+}
+
+// galloping merge for skewed sizes, walks the small range and gallops over the large one, O(m log(n / m))
+// runs of the large range between two small elements are copied or skipped as a whole
+template <typename It, typename OutputIt, typename Compare>
+OutputIt flat_gallop_op(It small, It small_end, It large, It large_end, OutputIt out, const Compare& comp,
+                        bool only_small, bool only_large, bool both, bool small_is_a) {
+    for (; small != small_end; ++small) {
+        It pos = flat_gallop(large, large_end, *small, comp);
+        if (only_large) out = std::copy(large, pos, out);
+        large = pos;
+        if (large != large_end && !comp(*small, *large)) {
+            if (both) *out++ = small_is_a ? *small : *large;
+            ++large;
+        } else if (only_small) {
+            *out++ = *small;
+        }
+    }
+    if (only_large) out = std::copy(large, large_end, out);
+    return out;
+}
+
+template <typename It, typename OutputIt, typename Compare>
+OutputIt flat_set_apply(It a, It a_end, It b, It b_end, OutputIt out, const Compare& comp, flat_set_op op) {
+    size_t na = static_cast<size_t>(a_end - a), nb = static_cast<size_t>(b_end - b);
+    if (na * flat_set_gallop_ratio < nb) {
+        return flat_gallop_op(a, a_end, b, b_end, out, comp, op.only_a_, op.only_b_, op.both_, true);
+    }
+    if (nb * flat_set_gallop_ratio < na) {
+        return flat_gallop_op(b, b_end, a, a_end, out, comp, op.only_b_, op.only_a_, op.both_, false);
+    }
+    return flat_merge_op(a, a_end, b, b_end, out, comp, op);
+}
+
+// 32-bit integer keys in ascending order are intersected 4x4 at a time with SIMD compares
+template <typename Key, typename Compare>
+struct flat_simd_intersect : std::integral_constant<bool,
+    std::is_integral<Key>::value && sizeof(Key) == 4 && std::is_same<Compare, std::less<Key>>::value> {};
+
+template <typename Key, typename OutputIt>
+OutputIt flat_intersect_blocks(const Key* a, size_t na, const Key* b, size_t nb, OutputIt out) {
+    size_t i = 0, j = 0;
+#if defined(__SSE2__) || defined(_M_X64)
+    while (i + 4 <= na && j + 4 <= nb) {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + j));
+        // compare every element of va with every element of vb by rotating vb
+        __m128i m = _mm_cmpeq_epi32(va, vb);
+        m = _mm_or_si128(m, _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(0, 3, 2, 1))));
+        m = _mm_or_si128(m, _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(1, 0, 3, 2))));
+        m = _mm_or_si128(m, _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(2, 1, 0, 3))));
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(m));
+        for (int k = 0; k < 4; k++) {
+            if (mask & (1 << k)) *out++ = a[i + k];
+        }
+        // the block with the smaller maximum can't match anything further
+        Key amax = a[i + 3], bmax = b[j + 3];
+        if (!(bmax < amax)) i += 4;
+        if (!(amax < bmax)) j += 4;
+    }
+#endif
+    return flat_merge_op(a + i, a + na, b + j, b + nb, out, std::less<Key>(), flat_set_op{false, false, true});
+}
+
+template <typename Key, typename Compare, typename Container, typename OutputIt>
+OutputIt flat_intersection_impl(const flat_set<Key, Compare, Container>& a, const flat_set<Key, Compare, Container>& b,
+                                OutputIt out, std::false_type) {
+    return flat_set_apply(a.begin(), a.end(), b.begin(), b.end(), out, a.key_comp(), flat_set_op{false, false, true});
+}
+
+template <typename Key, typename Compare, typename Container, typename OutputIt>
+OutputIt flat_intersection_impl(const flat_set<Key, Compare, Container>& a, const flat_set<Key, Compare, Container>& b,
+                                OutputIt out, std::true_type) {
+    size_t na = a.size(), nb = b.size();
+    if (na == 0 || nb == 0 || na * flat_set_gallop_ratio < nb || nb * flat_set_gallop_ratio < na) {
+        return flat_intersection_impl(a, b, out, std::false_type());
+    }
+    return flat_intersect_blocks(&*a.begin(), na, &*b.begin(), nb, out);
+}
+
+// @brief Elements in a or b, written to out in order
+// @return End of the output
+template <typename Key, typename Compare, typename Container, typename OutputIt>
+OutputIt flat_set_union(const flat_set<Key, Compare, Container>& a, const flat_set<Key, Compare, Container>& b,
+                        OutputIt out) {
+    return flat_set_apply(a.begin(), a.end(), b.begin(), b.end(), out, a.key_comp(), flat_set_op{true, true, true});
+}
+
+// @brief Elements in both a and b, written to out in order
+template <typename Key, typename Compare, typename Container, typename OutputIt>
+OutputIt flat_set_intersection(const flat_set<Key, Compare, Container>& a, const flat_set<Key, Compare, Container>& b,
+                               OutputIt out) {
+    return flat_intersection_impl(a, b, out, flat_simd_intersect<Key, Compare>());
+}
+
+// @brief Elements in a but not in b, written to out in order
+template <typename Key, typename Compare, typename Container, typename OutputIt>
+OutputIt flat_set_difference(const flat_set<Key, Compare, Container>& a, const flat_set<Key, Compare, Container>& b,
+                             OutputIt out) {
+    return flat_set_apply(a.begin(), a.end(), b.begin(), b.end(), out, a.key_comp(), flat_set_op{true, false, false});
+}
+
+// @brief Elements in exactly one of a and b, written to out in order
+template <typename Key, typename Compare, typename Container, typename OutputIt>
+OutputIt flat_set_symmetric_difference(const flat_set<Key, Compare, Container>& a, const flat_set<Key, Compare, Container>& b,
+                                       OutputIt out) {
+    return flat_set_apply(a.begin(), a.end(), b.begin(), b.end(), out, a.key_comp(), flat_set_op{true, true, false});
+}
+
+// versions returning a new set, the output is sorted already so it is adopted without sorting
+template <typename Key, typename Compare, typename Container>
+flat_set<Key, Compare, Container> flat_set_union(const flat_set<Key, Compare, Container>& a,
+                                                  const flat_set<Key, Compare, Container>& b) {
+    Container out;
+    out.reserve(a.size() + b.size());
+    flat_set_union(a, b, std::back_inserter(out));
+    return flat_set<Key, Compare, Container>(sorted_unique, std::move(out), a.key_comp());
+}
+
+template <typename Key, typename Compare, typename Container>
+flat_set<Key, Compare, Container> flat_set_intersection(const flat_set<Key, Compare, Container>& a,
+                                                         const flat_set<Key, Compare, Container>& b) {
+    Container out;
+    out.reserve(std::min(a.size(), b.size()));
+    flat_set_intersection(a, b, std::back_inserter(out));
+    return flat_set<Key, Compare, Container>(sorted_unique, std::move(out), a.key_comp());
+}
+
+template <typename Key, typename Compare, typename Container>
+flat_set<Key, Compare, Container> flat_set_difference(const flat_set<Key, Compare, Container>& a,
+                                                       const flat_set<Key, Compare, Container>& b) {
+    Container out;
+    out.reserve(a.size());
+    flat_set_difference(a, b, std::back_inserter(out));
+    return flat_set<Key, Compare, Container>(sorted_unique, std::move(out), a.key_comp());
+}
+
+template <typename Key, typename Compare, typename Container>
+flat_set<Key, Compare, Container> flat_set_symmetric_difference(const flat_set<Key, Compare, Container>& a,
+                                                                 const flat_set<Key, Compare, Container>& b) {
+    Container out;
+    out.reserve(a.size() + b.size());
+    flat_set_symmetric_difference(a, b, std::back_inserter(out));
+    return flat_set<Key, Compare, Container>(sorted_unique, std::move(out), a.key_comp());
 }
 
+// the sorted keys are moved into Container, std::vector is taken over as is
+template <typename Container, typename Key>
+Container flat_adopt_keys(std::vector<Key>&& keys, std::true_type) {
+    return std::move(keys);
+}
+
+template <typename Container, typename Key>
+Container flat_adopt_keys(std::vector<Key>&& keys, std::false_type) {
+    return Container(std::make_move_iterator(keys.begin()), std::make_move_iterator(keys.end()));
+}
+
+// @brief Build a flat_set from unsorted keys with duplicates on several threads, for large sets built at startup
+// Chunks are sorted in parallel and k-way merged in parallel, the first of equivalent keys in input order is kept.
+// Inputs under flat_parallel_min_size keys are built on the calling thread. Needs about twice the input's memory at peak.
+// @param keys keys to adopt, moved from
+// @param threads number of threads, 0 for std::thread::hardware_concurrency()
+template <typename Key, typename Compare = std::less<Key>, typename Container = std::vector<Key>>
+flat_set<Key, Compare, Container> flat_set_build_parallel(std::vector<Key>&& keys, size_t threads = 0,
+                                                          const Compare& comp = Compare()) {
+    flat_parallel_sort_unique(keys, threads, comp, [](Key&, Key&&) {});
+    return flat_set<Key, Compare, Container>(sorted_unique,
+        flat_adopt_keys<Container>(std::move(keys), std::is_same<Container, std::vector<Key>>()), comp);
+}
+
+//  Read-only flat_set with a minimal perfect hash over its keys, for sets built once and queried with count
+//  Keys stay in a sorted array, so iteration and lower_bound work as in flat_set.
+//  The hash table (hash and displace): keys are hashed into buckets of about bucket_load keys, for every bucket
+//  a seed is searched, larger buckets first, that sends all its keys to free slots of a table with exactly size() slots.
+//  Buckets holding one key store their slot directly. A lookup reads the bucket's seed, the slot, and compares
+//  one key, O(1) with no probing, instead of flat_set's log2(n) dependent cache misses.
+//  Building takes O(n) expected time
+//  注：
+//  1. Hash必须和Compare判断的相等一致，即Compare认为相等的键哈希值也相等
+//  2. 如果Hash无法区分不同的键，退化为二分查找
+//  3. 构建后不修改，多线程并发读取是安全的，不需要加锁
+template <typename Key, typename Compare = std::less<Key>, typename Hash = std::hash<Key>>
+class frozen_flat_set {
+public:
+    using iterator = typename std::vector<Key>::const_iterator;
+    using const_iterator = typename std::vector<Key>::const_iterator;
+private:
+    static constexpr size_t bucket_load = 2;                // average keys per bucket
+    static constexpr uint32_t direct_flag = 0x80000000u;    // bucket's seed is its single key's slot
+    static constexpr uint32_t max_seed = 1u << 20;          // seeds tried per bucket before a new salt
+    static constexpr uint64_t max_salt = 16;                // salts tried before falling back to binary search
+
+    std::vector<Key> data_;
+    std::vector<uint32_t> seeds_;   // per bucket, empty if the hash couldn't be built
+    std::vector<uint32_t> slots_;   // slot -> index in data_
+    uint64_t salt_;
+    Compare comp_;
+    Hash hash_;
+
+    bool equal(const Key& a, const Key& b) const {
+        return !(comp_(a, b) || comp_(b, a));
+    }
+
+    // splitmix64 finalizer, spreads weak hashes like std::hash<int> over all bits
+    static uint64_t mix(uint64_t x) {
+        x ^= x >> 30;
+        x *= 0xbf58476d1ce4e5b9ULL;
+        x ^= x >> 27;
+        x *= 0x94d049bb133111ebULL;
+        x ^= x >> 31;
+        return x;
+    }
+
+    // map the low 32 bits of x into [0, n) with a multiply instead of a division
+    static size_t reduce(uint64_t x, size_t n) {
+        return static_cast<size_t>(((x & 0xffffffffULL) * static_cast<uint64_t>(n)) >> 32);
+    }
+
+    uint64_t key_hash(const Key& key) const {
+        return mix(static_cast<uint64_t>(hash_(key)) ^ salt_);
+    }
+    size_t bucket_of(uint64_t h) const {
+        return reduce(h >> 32, seeds_.size());
+    }
+    size_t slot_of(uint64_t h, uint32_t seed) const {
+        return reduce(mix(h ^ (seed * 0x9e3779b97f4a7c15ULL)), slots_.size());
+    }
+
+    void build() {
+        const size_t n = data_.size();
+        assert(n < direct_flag);
+        slots_.assign(n, 0);
+        if (n == 0) return;
+        for (salt_ = 0; salt_ < max_salt; salt_++) {
+            if (try_build()) return;
+        }
+        // distinct keys with equal hashes, no seed separates them
+        seeds_.clear();
+        slots_.clear();
+    }
+
+    bool try_build() {
+        const size_t n = data_.size();
+        const size_t nb = (n + bucket_load - 1) / bucket_load;
+        seeds_.assign(nb, 0);
+        std::vector<uint64_t> hashes(n);
+        // group key indexes by bucket, counting sort
+        std::vector<uint32_t> start(nb + 1, 0), members(n);
+        for (size_t i = 0; i < n; i++) {
+            hashes[i] = key_hash(data_[i]);
+            start[bucket_of(hashes[i]) + 1]++;
+        }
+        for (size_t b = 0; b < nb; b++) {
+            start[b + 1] += start[b];
+        }
+        {
+            std::vector<uint32_t> pos(start.begin(), start.end() - 1);
+            for (size_t i = 0; i < n; i++) {
+                members[pos[bucket_of(hashes[i])]++] = static_cast<uint32_t>(i);
+            }
+        }
+        std::vector<uint32_t> order(nb);
+        for (size_t b = 0; b < nb; b++) {
+            order[b] = static_cast<uint32_t>(b);
+        }
+        std::sort(order.begin(), order.end(), [&](uint32_t x, uint32_t y) {
+            return start[x + 1] - start[x] > start[y + 1] - start[y];
+        });
+
+        std::vector<bool> taken(n, false);
+        std::vector<size_t> placed;
+        size_t k = 0;
+        // buckets with several keys, largest first while the table is still empty
+        for (; k < nb; k++) {
+            const uint32_t b = order[k];
+            if (start[b + 1] - start[b] < 2) break;
+            uint32_t seed = 1;
+            for (;; seed++) {
+                if (seed == max_seed) return false;
+                placed.clear();
+                bool ok = true;
+                for (uint32_t m = start[b]; m < start[b + 1]; m++) {
+                    size_t s = slot_of(hashes[members[m]], seed);
+                    if (taken[s]) {
+                        ok = false;
+                        break;
+                    }
+                    taken[s] = true;
+                    placed.push_back(s);
+                }
+                if (ok) break;
+                for (size_t s : placed) {
+                    taken[s] = false;
+                }
+            }
+            seeds_[b] = seed;
+            for (uint32_t m = start[b]; m < start[b + 1]; m++) {
+                slots_[placed[m - start[b]]] = members[m];
+            }
+        }
+        // single key buckets take the remaining free slots directly
+        size_t free_slot = 0;
+        for (; k < nb; k++) {
+            const uint32_t b = order[k];
+            if (start[b + 1] == start[b]) break;
+            while (taken[free_slot]) free_slot++;
+            taken[free_slot] = true;
+            slots_[free_slot] = members[start[b]];
+            seeds_[b] = direct_flag | static_cast<uint32_t>(free_slot);
+        }
+        return true;
+    }
+
+    // @return index of key in data_, size() if not found
+    size_t index_of(const Key& key) const {
+        if (data_.empty()) return 0;
+        if (seeds_.empty()) {
+            auto it = std::lower_bound(data_.begin(), data_.end(), key, comp_);
+            return (it != data_.end() && equal(*it, key)) ? static_cast<size_t>(it - data_.begin()) : data_.size();
+        }
+        const uint64_t h = key_hash(key);
+        const uint32_t seed = seeds_[bucket_of(h)];
+        const size_t s = (seed & direct_flag) ? (seed & ~direct_flag) : slot_of(h, seed);
+        const uint32_t i = slots_[s];
+        return equal(data_[i], key) ? i : data_.size();
+    }
+
+public:
+    frozen_flat_set() : salt_(0) {}
+
+    // @brief Build from keys already sorted by comp without duplicates
+    frozen_flat_set(sorted_unique_t, std::vector<Key>&& sorted, const Compare& comp = Compare(), const Hash& hash = Hash())
+        : data_(std::move(sorted)), salt_(0), comp_(comp), hash_(hash) {
+        build();
+    }
+
+    // @brief Build from a flat_set, the set is left untouched
+    template <typename Container>
+    explicit frozen_flat_set(const flat_set<Key, Compare, Container>& set, const Hash& hash = Hash())
+        : data_(set.begin(), set.end()), salt_(0), comp_(set.key_comp()), hash_(hash) {
+        build();
+    }
+
+    // @brief O(1) membership test, one slot and one key compared
+    size_t count(const Key& key) const {
+        return index_of(key) < data_.size() ? 1 : 0;
+    }
+
+    // @return element's iterator or end() if not found
+    const_iterator find(const Key& key) const {
+        return data_.begin() + index_of(key);
+    }
+
+    // @return first element not less than key, binary search on the sorted keys
+    const_iterator lower_bound(const Key& key) const {
+        return std::lower_bound(data_.begin(), data_.end(), key, comp_);
+    }
+
+    const_iterator begin() const {
+        return data_.begin();
+    }
+    const_iterator end() const {
+        return data_.end();
+    }
+    const_iterator cbegin() const {
+        return data_.cbegin();
+    }
+    const_iterator cend() const {
+        return data_.cend();
+    }
+
+    size_t size() const {
+        return data_.size();
+    }
+    bool empty() const {
+        return data_.empty();
+    }
+    Compare key_comp() const {
+        return comp_;
+    }
+    // whether lookups use the perfect hash, false only if the hash couldn't tell some keys apart
+    bool hashed() const {
+        return !seeds_.empty() || data_.empty();
+    }
+};
+
+//  Read-only set storing keys in Eytzinger (BFS) order: the children of node k are 2k and 2k + 1 (1-based)
+//  Binary search walks the array top-down, the first levels share a few hot cache lines
+//  and the descendants several levels ahead are contiguous, so they are prefetched while comparing
+//  Suits large read-mostly sets where flat_set's lookup misses cache on almost every level
+//  Iteration is in sorted order, each step is an in-order successor in the implicit tree (amortized O(1))
+//  Built from a flat_set or a sorted unique vector, there is no insert or erase
+//  This implement is not thread-safe for writes, concurrent reads are fine
+template <typename Key, typename Compare = std::less<Key>>
+class eytzinger_set {
+private:
+    std::vector<Key> tree_;     // node k (1-based) is tree_[k - 1]
+    Compare comp_;
+
+    // keys per cache line, node k's descendants 4 levels down start at 16k
+    static constexpr size_t prefetch_levels = sizeof(Key) <= 4 ? 4 : (sizeof(Key) <= 8 ? 3 : (sizeof(Key) <= 16 ? 2 : 1));
+
+    bool equal(const Key& a, const Key& b) const {
+        return !(comp_(a, b) || comp_(b, a));
+    }
+
+    // fill nodes in in-order, which visits sorted keys in sorted order
+    template <typename It>
+    void build(size_t k, It& it) {
+        if (k > tree_.size()) return;
+        build(2 * k, it);
+        tree_[k - 1] = std::move(*it);
+        ++it;
+        build(2 * k + 1, it);
+    }
+
+    // @return 1-based node of the first key not less than v, 0 if there is none
+    size_t lower_bound_impl(const Key& v) const {
+        const size_t n = tree_.size();
+        size_t k = 1;
+        while (k <= n) {
+            size_t pf = k << prefetch_levels;
+            if (pf <= n) flat_prefetch(tree_.data() + pf - 1);
+            k = 2 * k + (comp_(tree_[k - 1], v) ? 1 : 0);
+        }
+        // went right on the trailing 1 bits after the last left turn, undo them and that left turn
+        while (k & 1) k >>= 1;
+        return k >> 1;
+    }
+
+    static size_t leftmost(size_t k, size_t n) {
+        if (k > n) return 0;
+        while (2 * k <= n) k = 2 * k;
+        return k;
+    }
+
+public:
+    // forward iterator over keys in sorted order
+    class const_iterator {
+    private:
+        const eytzinger_set* set_;
+        size_t k_;      // 1-based node, 0 is end
+        friend class eytzinger_set;
+        const_iterator(const eytzinger_set* set, size_t k) : set_(set), k_(k) {}
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = Key;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const Key*;
+        using reference = const Key&;
+
+        const_iterator() : set_(nullptr), k_(0) {}
+        reference operator*() const {
+            return set_->tree_[k_ - 1];
+        }
+        pointer operator->() const {
+            return &set_->tree_[k_ - 1];
+        }
+        const_iterator& operator++() {
+            const size_t n = set_->tree_.size();
+            if (2 * k_ + 1 <= n) {
+                k_ = leftmost(2 * k_ + 1, n);
+            } else {
+                // climb while we are a right child, then once more
+                while (k_ & 1) k_ >>= 1;
+                k_ >>= 1;
+            }
+            return *this;
+        }
+        const_iterator operator++(int) {
+            const_iterator tmp = *this;
+            ++(*this);
+            return tmp;
+        }
+        bool operator==(const const_iterator& other) const {
+            return k_ == other.k_;
+        }
+        bool operator!=(const const_iterator& other) const {
+            return k_ != other.k_;
+        }
+    };
+    using iterator = const_iterator;
+
+    eytzinger_set() = default;
+
+    // @brief Build from keys already sorted by comp without duplicates
+    eytzinger_set(sorted_unique_t, const std::vector<Key>& sorted, const Compare& comp = Compare())
+        : tree_(sorted.size()), comp_(comp) {
+        auto it = sorted.begin();
+        build(1, it);
+    }
+
+    // @brief Build from a flat_set, the set is left untouched, keys are searched with the set's comparator
+    template <typename Container>
+    explicit eytzinger_set(const flat_set<Key, Compare, Container>& set)
+        : tree_(set.size()), comp_(set.key_comp()) {
+        auto it = set.begin();
+        build(1, it);
+    }
+
+    size_t count(const Key& key) const {
+        size_t k = lower_bound_impl(key);
+        return (k && equal(key, tree_[k - 1])) ? 1 : 0;
+    }
+
+    const_iterator find(const Key& key) const {
+        size_t k = lower_bound_impl(key);
+        return (k && equal(key, tree_[k - 1])) ? const_iterator(this, k) : end();
+    }
+
+    // @return first element not less than key
+    const_iterator lower_bound(const Key& key) const {
+        return const_iterator(this, lower_bound_impl(key));
+    }
+
+    const_iterator begin() const {
+        return const_iterator(this, leftmost(1, tree_.size()));
+    }
+    const_iterator end() const {
+        return const_iterator(this, 0);
+    }
+    const_iterator cbegin() const {
+        return begin();
+    }
+    const_iterator cend() const {
+        return end();
+    }
+
+    size_t size() const {
+        return tree_.size();
+    }
+    bool empty() const {
+        return tree_.empty();
+    }
+};
+}
+
+
 
 #endif
\ No newline at end of file
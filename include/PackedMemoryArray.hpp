@@ -0,0 +1,352 @@
+// PackedMemoryArray.hpp
+// Header file for sorted set stored in a packed memory array (gapped array)
+// 基于稀疏有序数组(Packed Memory Array)的有序集合头文件
+
+#ifndef TOYLIB_PACKED_MEMORY_ARRAY_HEADER
+#define TOYLIB_PACKED_MEMORY_ARRAY_HEADER
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <utility>
+
+namespace toylib {
+
+//  Sorted set keeping its keys in one array with gaps spread evenly between them
+//  The array is cut into segments of about log(capacity) slots, keys are packed to the left of each segment.
+//  An insert shifts keys inside one segment. When the segment is full, the smallest aligned window of segments
+//  whose density stays under its threshold is rebalanced (keys spread evenly again), thresholds go from 100% for one
+//  segment to 75% for the whole array, above that the capacity doubles. This gives O(log^2 n) amortized moves per insert
+//  instead of flat_set's O(n), while keys stay in nearly contiguous memory, so lookup and iteration keep flat_set's locality
+//  Lookup is a binary search over segments' first keys and then inside one segment, O(log n)
+//  注：
+//  1. Key需要默认构造，空位上是默认构造的Key
+//  2. 删除只在段内移动，整体密度低于1/8时容量减半。段被删空时重新分布所在的窗口，
+//     空段只会出现在数组末尾，查找始终是对段的二分
+//  3. This implement is not thread-safe
+template <typename Key, typename Compare = std::less<Key>>
+class pma_set {
+private:
+    static constexpr size_t min_capacity = 64;
+    static constexpr size_t npos = ~size_t(0);
+
+    std::vector<Key> slots_;
+    std::vector<uint32_t> counts_;  // keys in every segment, packed at the segment's start
+    size_t seg_size_;
+    size_t size_;
+    Compare comp_;
+
+    bool equal(const Key& a, const Key& b) const {
+        return !(comp_(a, b) || comp_(b, a));
+    }
+
+    size_t segments() const {
+        return counts_.size();
+    }
+
+    Key* segment(size_t s) {
+        return slots_.data() + s * seg_size_;
+    }
+    const Key* segment(size_t s) const {
+        return slots_.data() + s * seg_size_;
+    }
+
+    // density threshold of a window 2^level segments wide, from 1.0 for one segment to 0.75 for the whole array
+    double upper_density(size_t level, size_t height) const {
+        return height == 0 ? 0.75 : 1.0 - 0.25 * static_cast<double>(level) / static_cast<double>(height);
+    }
+
+    // @return last non-empty segment whose first key is not greater than v, npos if there is none
+    // Empty segments only trail the non-empty ones, so they are treated as greater than any key
+    size_t locate(const Key& v) const {
+        size_t lo = 0, hi = segments(), ans = npos;
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (counts_[mid] != 0 && !comp_(v, *segment(mid))) {
+                ans = mid;
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        return ans;
+    }
+
+    // spread keys evenly over segments [first, first + count), keys must be sorted
+    void distribute(std::vector<Key>& keys, size_t first, size_t count) {
+        size_t n = keys.size(), k = 0;
+        for (size_t s = 0; s < count; s++) {
+            size_t c = n / count + (s < n % count ? 1 : 0);
+            Key* seg = segment(first + s);
+            for (size_t i = 0; i < c; i++) {
+                seg[i] = std::move(keys[k++]);
+            }
+            counts_[first + s] = static_cast<uint32_t>(c);
+        }
+    }
+
+    // move keys of segments [first, first + count) out in order
+    void gather(std::vector<Key>& keys, size_t first, size_t count) {
+        for (size_t s = first; s < first + count; s++) {
+            Key* seg = segment(s);
+            for (size_t i = 0; i < counts_[s]; i++) {
+                keys.push_back(std::move(seg[i]));
+            }
+        }
+    }
+
+    // rebuild the whole array with a new capacity, keys must be sorted
+    void rebuild(std::vector<Key>& keys, size_t capacity) {
+        size_t lg = 0;
+        while ((size_t(1) << lg) < capacity) lg++;
+        seg_size_ = 8;
+        while (seg_size_ < lg * 2) seg_size_ *= 2;
+        slots_.clear();
+        slots_.resize(capacity);
+        counts_.assign(capacity / seg_size_, 0);
+        distribute(keys, 0, segments());
+    }
+
+    // @brief Refill segment s emptied by erase, unless it's the last non-empty one
+    // Spreads the smallest enclosing window holding at least one key per segment, or the whole array,
+    // which leaves empty segments only at its end
+    void refill(size_t s) {
+        if (s + 1 == segments() || counts_[s + 1] == 0) return;
+        std::vector<Key> keys;
+        for (size_t width = 2; width < segments(); width *= 2) {
+            size_t first = s & ~(width - 1);
+            size_t total = 0;
+            for (size_t i = first; i < first + width; i++) {
+                total += counts_[i];
+            }
+            if (total >= width) {
+                keys.reserve(total);
+                gather(keys, first, width);
+                distribute(keys, first, width);
+                return;
+            }
+        }
+        keys.reserve(size_);
+        gather(keys, 0, segments());
+        distribute(keys, 0, segments());
+    }
+
+    // slot of the k-th key counted from segment first
+    size_t slot_of(size_t first, size_t k) const {
+        size_t s = first;
+        while (k >= counts_[s]) {
+            k -= counts_[s];
+            s++;
+        }
+        return s * seg_size_ + k;
+    }
+
+    // @return slot of the inserted key
+    template <typename K>
+    size_t insert_new(size_t s, K&& v) {
+        if (counts_[s] < seg_size_) {
+            Key* seg = segment(s);
+            size_t c = counts_[s];
+            size_t pos = static_cast<size_t>(std::lower_bound(seg, seg + c, v, comp_) - seg);
+            std::move_backward(seg + pos, seg + c, seg + c + 1);
+            seg[pos] = std::forward<K>(v);
+            counts_[s]++;
+            size_++;
+            return s * seg_size_ + pos;
+        }
+        // find the smallest enclosing window that can take one more key
+        size_t height = 0;
+        while ((size_t(1) << height) < segments()) height++;
+        std::vector<Key> keys;
+        for (size_t level = 1; level <= height; level++) {
+            size_t width = size_t(1) << level;
+            size_t first = s & ~(width - 1);
+            size_t total = 1;
+            for (size_t i = first; i < first + width; i++) {
+                total += counts_[i];
+            }
+            if (static_cast<double>(total) <= upper_density(level, height) * static_cast<double>(width * seg_size_)) {
+                keys.reserve(total);
+                gather(keys, first, width);
+                size_t k = static_cast<size_t>(std::lower_bound(keys.begin(), keys.end(), v, comp_) - keys.begin());
+                keys.insert(keys.begin() + k, std::forward<K>(v));
+                distribute(keys, first, width);
+                size_++;
+                return slot_of(first, k);
+            }
+        }
+        // the whole array is too dense, double it
+        keys.reserve(size_ + 1);
+        gather(keys, 0, segments());
+        size_t k = static_cast<size_t>(std::lower_bound(keys.begin(), keys.end(), v, comp_) - keys.begin());
+        keys.insert(keys.begin() + k, std::forward<K>(v));
+        rebuild(keys, slots_.size() * 2);
+        size_++;
+        return slot_of(0, k);
+    }
+
+    // @return pair of {slot of inserted or existing key, whether insertion took place}
+    template <typename K>
+    std::pair<size_t, bool> insert_impl(K&& v) {
+        if (slots_.empty()) {
+            std::vector<Key> none;
+            rebuild(none, min_capacity);
+        }
+        size_t s = locate(v);
+        if (s == npos) {
+            s = 0;      // smaller than every key, goes to the front of the first segment
+        } else {
+            const Key* seg = segment(s);
+            const Key* p = std::lower_bound(seg, seg + counts_[s], v, comp_);
+            if (p != seg + counts_[s] && equal(v, *p)) {
+                return {s * seg_size_ + (p - seg), false};
+            }
+        }
+        return {insert_new(s, std::forward<K>(v)), true};
+    }
+
+    // @return slot of v, npos if not found
+    size_t find_slot(const Key& v) const {
+        if (size_ == 0) return npos;
+        size_t s = locate(v);
+        if (s == npos) return npos;
+        const Key* seg = segment(s);
+        const Key* p = std::lower_bound(seg, seg + counts_[s], v, comp_);
+        if (p == seg + counts_[s] || !equal(v, *p)) return npos;
+        return s * seg_size_ + (p - seg);
+    }
+
+public:
+    // forward iterator skipping the gaps
+    class const_iterator {
+    private:
+        const pma_set* set_;
+        size_t seg_;
+        size_t idx_;
+        friend class pma_set;
+
+        const_iterator(const pma_set* set, size_t seg, size_t idx) : set_(set), seg_(seg), idx_(idx) {
+            skip_empty();
+        }
+        void skip_empty() {
+            while (seg_ < set_->segments() && idx_ >= set_->counts_[seg_]) {
+                seg_++;
+                idx_ = 0;
+            }
+        }
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = Key;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const Key*;
+        using reference = const Key&;
+
+        const_iterator() : set_(nullptr), seg_(0), idx_(0) {}
+        reference operator*() const {
+            return set_->segment(seg_)[idx_];
+        }
+        pointer operator->() const {
+            return &set_->segment(seg_)[idx_];
+        }
+        const_iterator& operator++() {
+            idx_++;
+            skip_empty();
+            return *this;
+        }
+        const_iterator operator++(int) {
+            const_iterator tmp = *this;
+            ++(*this);
+            return tmp;
+        }
+        bool operator==(const const_iterator& other) const {
+            return seg_ == other.seg_ && idx_ == other.idx_;
+        }
+        bool operator!=(const const_iterator& other) const {
+            return !(*this == other);
+        }
+    };
+    using iterator = const_iterator;
+
+    pma_set() : seg_size_(8), size_(0) {}
+    explicit pma_set(const Compare& comp) : seg_size_(8), size_(0), comp_(comp) {}
+
+    size_t count(const Key& key) const {
+        return find_slot(key) == npos ? 0 : 1;
+    }
+
+    // @return element's iterator or end() if not found
+    const_iterator find(const Key& key) const {
+        size_t slot = find_slot(key);
+        if (slot == npos) return end();
+        return const_iterator(this, slot / seg_size_, slot % seg_size_);
+    }
+
+    // @brief insert one key
+    // @return pair of {iterator to inserted or existing element, whether insertion took place}
+    std::pair<const_iterator, bool> insert(const Key& key) {
+        auto r = insert_impl(key);
+        return {const_iterator(this, r.first / seg_size_, r.first % seg_size_), r.second};
+    }
+
+    std::pair<const_iterator, bool> insert(Key&& key) {
+        auto r = insert_impl(std::move(key));
+        return {const_iterator(this, r.first / seg_size_, r.first % seg_size_), r.second};
+    }
+
+    // @brief erase by key, halves the capacity when it gets sparse
+    // @return 1 if the element is erased, 0 if not found
+    size_t erase(const Key& key) {
+        size_t slot = find_slot(key);
+        if (slot == npos) return 0;
+        size_t s = slot / seg_size_, i = slot % seg_size_;
+        Key* seg = segment(s);
+        std::move(seg + i + 1, seg + counts_[s], seg + i);
+        seg[counts_[s] - 1] = Key();
+        counts_[s]--;
+        size_--;
+        if (slots_.size() > min_capacity && size_ * 8 < slots_.size()) {
+            std::vector<Key> keys;
+            keys.reserve(size_);
+            gather(keys, 0, segments());
+            rebuild(keys, slots_.size() / 2);
+        } else if (counts_[s] == 0) {
+            refill(s);
+        }
+        return 1;
+    }
+
+    const_iterator begin() const {
+        return const_iterator(this, 0, 0);
+    }
+    const_iterator end() const {
+        return const_iterator(this, segments(), 0);
+    }
+    const_iterator cbegin() const {
+        return begin();
+    }
+    const_iterator cend() const {
+        return end();
+    }
+
+    size_t size() const {
+        return size_;
+    }
+    bool empty() const {
+        return size_ == 0;
+    }
+    // slots including gaps
+    size_t capacity() const {
+        return slots_.size();
+    }
+    void clear() {
+        slots_.clear();
+        counts_.clear();
+        size_ = 0;
+    }
+};
+
+}
+#endif
@@ -0,0 +1,307 @@
+// PersistentMemPool.hpp
+// Header file for file-backed memory pool of fixed block size
+// 基于内存映射文件的持久化内存池头文件
+
+#ifndef TOYLIB_PERSISTENT_MEMPOOL_HEADER
+#define TOYLIB_PERSISTENT_MEMPOOL_HEADER
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <stdexcept>
+#include <cassert>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace toylib {
+
+// 自相对指针，保存目标地址与自身地址的差值
+// Self-relative pointer, stays valid when the whole mapping is remapped at another address.
+// Only use it to point between objects inside the same pool.
+template <typename T>
+class offset_ptr {
+private:
+    // target - this, 1 stands for nullptr since no object can start one byte after this pointer
+    std::ptrdiff_t off_;
+
+    // arithmetic is done on integers, the target is usually not part of the same object as this
+    void set(const T* p) {
+        off_ = p ? static_cast<std::ptrdiff_t>(reinterpret_cast<uintptr_t>(p) - reinterpret_cast<uintptr_t>(this)) : 1;
+    }
+public:
+    offset_ptr() : off_(1) {}
+    offset_ptr(std::nullptr_t) : off_(1) {}
+    offset_ptr(T* p) { set(p); }
+    offset_ptr(const offset_ptr& other) { set(other.get()); }
+
+    offset_ptr& operator=(const offset_ptr& other) {
+        set(other.get());
+        return *this;
+    }
+    offset_ptr& operator=(T* p) {
+        set(p);
+        return *this;
+    }
+
+    T* get() const {
+        if (off_ == 1) return nullptr;
+        return reinterpret_cast<T*>(reinterpret_cast<uintptr_t>(this) + static_cast<uintptr_t>(off_));
+    }
+    T& operator*() const {
+        return *get();
+    }
+    T* operator->() const {
+        return get();
+    }
+    explicit operator bool() const {
+        return off_ != 1;
+    }
+
+    friend bool operator==(const offset_ptr& a, const offset_ptr& b) {
+        return a.get() == b.get();
+    }
+    friend bool operator!=(const offset_ptr& a, const offset_ptr& b) {
+        return a.get() != b.get();
+    }
+};
+
+// 持久化内存池
+// Same idea as fixed_mem_pool, but chunks live in a MAP_SHARED file mapping:
+// [header][chunk 0][chunk 1]...
+// The header records the layout, chunk count, free list head and a user root as offsets from the mapping base,
+// so a restarted process can map the file again and continue with every object in place.
+// 注：
+// 1. 整个文件映射在一段预留的地址空间上，扩容时不会移动，已分配的指针保持有效
+// 2. 每次修改都先写好新节点再发布到header，进程在任意位置被杀死不会破坏结构：
+//    alloc/free中被杀死最多泄漏一个block，扩容中被杀死最多泄漏新的一个chunk（items_per_chunk个block）
+// 3. 同一时间只允许一个进程打开文件（flock），进程内线程安全
+// 4. 只保证进程崩溃后的一致性，断电需要先调用sync()
+template <size_t item_size, size_t chunk_size = 4096>
+class persistent_mem_pool {
+private:
+    static_assert(item_size >= sizeof(uint64_t), "item_size must be able to hold an offset");
+    static_assert(item_size <= chunk_size, "item_size must be less than or equal to chunk_size");
+    static constexpr size_t items_per_chunk = chunk_size / item_size;
+    // alignment every block has: the largest power of two dividing both item_size and chunk_size,
+    // capped by the header's 64 bytes (the mapping itself is page aligned)
+    static constexpr size_t size_align = (item_size | chunk_size) & (~(item_size | chunk_size) + 1);
+    static constexpr size_t block_align = size_align < 64 ? size_align : 64;
+    static constexpr uint64_t magic = 0x4c4f4f50594f54ull;     // "TOYPOOL"
+    static constexpr uint64_t version = 1;
+
+    struct header {
+        uint64_t magic_;            // written last when the file is created
+        uint64_t version_;
+        uint64_t item_size_;
+        uint64_t chunk_size_;
+        uint64_t chunks_count_;     // chunks in use, file may be longer after a crash during growth
+        uint64_t free_head_;        // offset of first free block, 0 if none
+        uint64_t root_;             // offset of user's root object, 0 if none
+    };
+    static constexpr size_t header_size = (sizeof(header) + 63) / 64 * 64;
+
+    int fd_;
+    char* base_;
+    size_t max_chunks_;
+    std::mutex latch_;      // protects header and free list
+
+    header* hdr() const {
+        return reinterpret_cast<header*>(base_);
+    }
+
+    char* chunk_base(uint64_t c) const {
+        return base_ + header_size + c * chunk_size;
+    }
+
+    // keep compiler from reordering stores across publish points, a killed process has no other observer
+    static void publish_fence() {
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+    }
+
+    // free list link stored at the beginning of a free block
+    static uint64_t& next_of(char* block) {
+        return *reinterpret_cast<uint64_t*>(block);
+    }
+
+    // extend the file and link the new chunk's blocks, then publish it
+    // @return false if max_chunks is reached or the file can't be extended
+    // latch_ must be held
+    bool grow() {
+        uint64_t c = hdr()->chunks_count_;
+        if (c >= max_chunks_) {
+            return false;
+        }
+        if (ftruncate(fd_, static_cast<off_t>(header_size + (c + 1) * chunk_size)) != 0) {
+            return false;
+        }
+        char* base = chunk_base(c);
+        for (size_t i = 0; i < items_per_chunk; i++) {
+            next_of(base + i * item_size) = (i == items_per_chunk - 1)
+                ? hdr()->free_head_
+                : to_offset(base + (i + 1) * item_size);
+        }
+        publish_fence();
+        // count first: a crash before free_head_ is updated only leaks this chunk
+        hdr()->chunks_count_ = c + 1;
+        publish_fence();
+        hdr()->free_head_ = to_offset(base);
+        return true;
+    }
+
+    void close_file() {
+        if (base_) {
+            munmap(base_, header_size + max_chunks_ * chunk_size);
+            base_ = nullptr;
+        }
+        if (fd_ >= 0) {
+            ::close(fd_);
+            fd_ = -1;
+        }
+    }
+
+    void fail(const char* msg) {
+        close_file();
+        throw std::runtime_error(msg);
+    }
+
+public:
+    // @brief Open or create a pool file
+    // @param path File backing the pool
+    // @param max_chunks Upper bound of chunks, address space for all of them is reserved up front
+    // @param initial_chunks Chunks to create when the file is new
+    // @throw std::runtime_error if the file can't be opened, is locked by another process or has a different layout
+    persistent_mem_pool(const std::string& path, size_t max_chunks, size_t initial_chunks = 1)
+        : fd_(-1), base_(nullptr), max_chunks_(max_chunks) {
+        fd_ = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd_ < 0) {
+            fail("persistent_mem_pool: failed to open file");
+        }
+        if (flock(fd_, LOCK_EX | LOCK_NB) != 0) {
+            fail("persistent_mem_pool: file is used by another process");
+        }
+        struct stat st;
+        if (fstat(fd_, &st) != 0) {
+            fail("persistent_mem_pool: failed to stat file");
+        }
+        void* addr = mmap(nullptr, header_size + max_chunks_ * chunk_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (addr == MAP_FAILED) {
+            fail("persistent_mem_pool: failed to map file");
+        }
+        base_ = static_cast<char*>(addr);
+
+        // an empty magic means the file was never completely initialized
+        size_t file_size = static_cast<size_t>(st.st_size);
+        if (file_size != 0 && (file_size < header_size || (hdr()->magic_ != 0 && hdr()->magic_ != magic))) {
+            fail("persistent_mem_pool: file is not a pool file");
+        }
+        bool fresh = file_size == 0 || hdr()->magic_ == 0;
+        if (fresh) {
+            // magic is written last, a crash during creation leaves a file that is created again
+            if (ftruncate(fd_, static_cast<off_t>(header_size)) != 0) {
+                fail("persistent_mem_pool: failed to resize file");
+            }
+            hdr()->version_ = version;
+            hdr()->item_size_ = item_size;
+            hdr()->chunk_size_ = chunk_size;
+            hdr()->chunks_count_ = 0;
+            hdr()->free_head_ = 0;
+            hdr()->root_ = 0;
+            for (size_t c = 0; c < initial_chunks && c < max_chunks_; c++) {
+                grow();
+            }
+            publish_fence();
+            hdr()->magic_ = magic;
+            return;
+        }
+
+        if (hdr()->version_ != version || hdr()->item_size_ != item_size || hdr()->chunk_size_ != chunk_size) {
+            fail("persistent_mem_pool: file layout doesn't match");
+        }
+        if (hdr()->chunks_count_ > max_chunks_ ||
+            file_size < header_size + hdr()->chunks_count_ * chunk_size) {
+            fail("persistent_mem_pool: file is truncated or max_chunks is too small");
+        }
+    }
+
+    ~persistent_mem_pool() {
+        close_file();
+    }
+
+    // mapping and file lock are owned by this object
+    persistent_mem_pool(const persistent_mem_pool&) = delete;
+    persistent_mem_pool& operator=(const persistent_mem_pool&) = delete;
+    persistent_mem_pool(persistent_mem_pool&&) = delete;
+    persistent_mem_pool& operator=(persistent_mem_pool&&) = delete;
+
+    // @param alloc_when_exhausted Whether to extend the file by one chunk if there is no free block
+    // @return nullptr when exhausted and growing is not allowed, max_chunks is reached or the file can't be extended
+    char* alloc(bool alloc_when_exhausted = true) {
+        std::unique_lock<std::mutex> l(latch_);
+        if (!hdr()->free_head_) {
+            if (!alloc_when_exhausted || !grow()) {
+                return nullptr;
+            }
+        }
+        char* block = from_offset(hdr()->free_head_);
+        hdr()->free_head_ = next_of(block);
+        return block;
+    }
+
+    template <typename T>
+    T* alloc_as() {
+        static_assert(sizeof(T) <= item_size, "Type size is larger than item_size");
+        static_assert(alignof(T) <= block_align, "Blocks are not aligned enough for this type, pad item_size");
+        return reinterpret_cast<T*>(alloc());
+    }
+
+    // @message Like fixed_mem_pool::free, ptr is only checked in debug mode and double free is not detected.
+    void free(void* ptr) {
+        char* block = static_cast<char*>(ptr);
+        std::unique_lock<std::mutex> l(latch_);
+        assert(block >= chunk_base(0) && block < chunk_base(hdr()->chunks_count_) && "Pointer to free is not allocated from this pool");
+        assert((block - chunk_base(0)) % chunk_size % item_size == 0 && "Pointer to free is not aligned");
+        next_of(block) = hdr()->free_head_;
+        publish_fence();
+        hdr()->free_head_ = to_offset(block);
+    }
+
+    // @brief Record the entry object of user's data, found again by root() after restart
+    void set_root(void* ptr) {
+        std::unique_lock<std::mutex> l(latch_);
+        hdr()->root_ = ptr ? to_offset(ptr) : 0;
+    }
+
+    template <typename T>
+    T* root() {
+        std::unique_lock<std::mutex> l(latch_);
+        return hdr()->root_ ? reinterpret_cast<T*>(from_offset(hdr()->root_)) : nullptr;
+    }
+
+    // offsets are stable across restarts, pointers are not
+    uint64_t to_offset(const void* ptr) const {
+        return static_cast<uint64_t>(static_cast<const char*>(ptr) - base_);
+    }
+    char* from_offset(uint64_t off) const {
+        return base_ + off;
+    }
+
+    // @brief Flush the mapping to disk, needed to survive power loss rather than process crash
+    bool sync() {
+        std::unique_lock<std::mutex> l(latch_);
+        return msync(base_, header_size + hdr()->chunks_count_ * chunk_size, MS_SYNC) == 0;
+    }
+
+    size_t chunks_count() {
+        std::unique_lock<std::mutex> l(latch_);
+        return hdr()->chunks_count_;
+    }
+};
+
+}
+#endif
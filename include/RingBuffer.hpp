@@ -9,6 +9,8 @@
 #include <memory>
 #include <cstddef>
 
+#include "CacheLine.hpp"
+
 namespace toylib {
 
 // Adapted from cameron314/readerwriterqueue
@@ -19,12 +21,6 @@ static inline char* align_for(char* ptr)
     return ptr + (alignment - (reinterpret_cast<uintptr_t>(ptr) % alignment)) % alignment;
 }
 
-// Cache line width
-#if defined(__cpp_lib_hardware_interference_size) // since C++17
-constexpr size_t DEFAULT_CACHE_LINE_WIDTH = std::hardware_destructive_interference_size;
-#else
-constexpr size_t DEFAULT_CACHE_LINE_WIDTH = 64;
-#endif
 // A lock-free fixed-size ring buffer queue
 // This implement is SPSC-only: one producer and one consumer at most.
 template <typename T>
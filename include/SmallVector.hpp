@@ -0,0 +1,342 @@
+// SmallVector.hpp
+// Header file for vector with inline storage for a few elements
+// 带内联存储的小容量vector头文件
+
+#ifndef TOYLIB_SMALL_VECTOR_HEADER
+#define TOYLIB_SMALL_VECTOR_HEADER
+
+#include <cstddef>
+#include <iterator>
+#include <algorithm>
+#include <initializer_list>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+namespace toylib {
+
+//  vector that keeps up to N elements inside the object and spills to the heap when it grows past N
+//  A container with a few elements costs no heap allocation and no pointer chase to a separate block,
+//  which matters when a process holds thousands of tiny containers (e.g. per connection attributes).
+//  Implements the part of std::vector's interface used by flat_set and flat_map, so it can be their storage policy:
+//      flat_map<int, int, std::less<int>, small_vector<std::pair<int, int>, 8>>
+//  Iterators are plain pointers
+//  注：
+//  1. 超过N后改用堆内存，之后即使元素变少也不会回到内联存储，除非调用shrink_to_fit
+//  2. 移动构造时内联的元素需要逐个移动，不像std::vector只交换指针
+//  3. This implement is not thread-safe
+template <typename T, size_t N>
+class small_vector {
+    static_assert(N > 0, "small_vector needs an inline capacity of at least 1");
+public:
+    using value_type = T;
+    using size_type = size_t;
+    using difference_type = std::ptrdiff_t;
+    using reference = T&;
+    using const_reference = const T&;
+    using pointer = T*;
+    using const_pointer = const T*;
+    using iterator = T*;
+    using const_iterator = const T*;
+
+private:
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type inline_[N];
+    T* data_;
+    size_t size_;
+    size_t capacity_;
+
+    T* inline_data() {
+        return reinterpret_cast<T*>(inline_);
+    }
+    bool is_inline() const {
+        return data_ == reinterpret_cast<const T*>(inline_);
+    }
+
+    // move elements into a buffer of new_cap, new_cap >= size_
+    void reallocate(size_t new_cap) {
+        T* buf = new_cap <= N ? inline_data() : static_cast<T*>(::operator new(new_cap * sizeof(T)));
+        if (buf == data_) return;
+        for (size_t i = 0; i < size_; i++) {
+            ::new (static_cast<void*>(buf + i)) T(std::move_if_noexcept(data_[i]));
+            data_[i].~T();
+        }
+        if (!is_inline()) {
+            ::operator delete(data_);
+        }
+        data_ = buf;
+        capacity_ = new_cap <= N ? N : new_cap;
+    }
+
+    void grow_for(size_t n) {
+        if (n > capacity_) {
+            reallocate(std::max(n, capacity_ * 2));
+        }
+    }
+
+    void destroy_all() {
+        for (size_t i = 0; i < size_; i++) {
+            data_[i].~T();
+        }
+        size_ = 0;
+    }
+
+    // steal other's heap buffer, or move its inline elements one by one
+    void take(small_vector&& other) {
+        if (other.is_inline()) {
+            for (size_t i = 0; i < other.size_; i++) {
+                ::new (static_cast<void*>(data_ + i)) T(std::move(other.data_[i]));
+            }
+            size_ = other.size_;
+            other.destroy_all();
+        } else {
+            data_ = other.data_;
+            size_ = other.size_;
+            capacity_ = other.capacity_;
+            other.data_ = other.inline_data();
+            other.size_ = 0;
+            other.capacity_ = N;
+        }
+    }
+
+public:
+    small_vector() : data_(inline_data()), size_(0), capacity_(N) {}
+
+    template <typename InputIt, typename = typename std::iterator_traits<InputIt>::iterator_category>
+    small_vector(InputIt first, InputIt last) : small_vector() {
+        insert(end(), first, last);
+    }
+
+    small_vector(std::initializer_list<T> init) : small_vector(init.begin(), init.end()) {}
+
+    small_vector(const small_vector& other) : small_vector() {
+        reserve(other.size_);
+        std::uninitialized_copy(other.begin(), other.end(), data_);
+        size_ = other.size_;
+    }
+
+    small_vector(small_vector&& other) noexcept(std::is_nothrow_move_constructible<T>::value) : small_vector() {
+        take(std::move(other));
+    }
+
+    small_vector& operator=(const small_vector& other) {
+        if (this != &other) {
+            clear();
+            reserve(other.size_);
+            std::uninitialized_copy(other.begin(), other.end(), data_);
+            size_ = other.size_;
+        }
+        return *this;
+    }
+
+    small_vector& operator=(small_vector&& other) noexcept(std::is_nothrow_move_constructible<T>::value) {
+        if (this != &other) {
+            clear();
+            if (!is_inline()) {
+                ::operator delete(data_);
+                data_ = inline_data();
+                capacity_ = N;
+            }
+            take(std::move(other));
+        }
+        return *this;
+    }
+
+    ~small_vector() {
+        destroy_all();
+        if (!is_inline()) {
+            ::operator delete(data_);
+        }
+    }
+
+    // element access
+    T& operator[](size_t i) {
+        return data_[i];
+    }
+    const T& operator[](size_t i) const {
+        return data_[i];
+    }
+    T& at(size_t i) {
+        if (i >= size_) throw std::out_of_range("small_vector::at");
+        return data_[i];
+    }
+    const T& at(size_t i) const {
+        if (i >= size_) throw std::out_of_range("small_vector::at");
+        return data_[i];
+    }
+    T& front() {
+        return data_[0];
+    }
+    const T& front() const {
+        return data_[0];
+    }
+    T& back() {
+        return data_[size_ - 1];
+    }
+    const T& back() const {
+        return data_[size_ - 1];
+    }
+    T* data() {
+        return data_;
+    }
+    const T* data() const {
+        return data_;
+    }
+
+    // iterators
+    iterator begin() {
+        return data_;
+    }
+    iterator end() {
+        return data_ + size_;
+    }
+    const_iterator begin() const {
+        return data_;
+    }
+    const_iterator end() const {
+        return data_ + size_;
+    }
+    const_iterator cbegin() const {
+        return data_;
+    }
+    const_iterator cend() const {
+        return data_ + size_;
+    }
+
+    // capacity
+    size_t size() const {
+        return size_;
+    }
+    bool empty() const {
+        return size_ == 0;
+    }
+    size_t capacity() const {
+        return capacity_;
+    }
+    // whether the elements live in the object itself
+    bool inlined() const {
+        return is_inline();
+    }
+    void reserve(size_t n) {
+        if (n > capacity_) {
+            reallocate(n);
+        }
+    }
+    // move back into the inline storage if the elements fit, otherwise into a heap buffer of exactly size()
+    void shrink_to_fit() {
+        if (!is_inline() && size_ < capacity_) {
+            reallocate(size_);
+        }
+    }
+
+    // modifiers
+    void clear() {
+        destroy_all();
+    }
+
+    template <typename... Args>
+    T& emplace_back(Args&&... args) {
+        if (size_ == capacity_) {
+            // args may refer to an element, build the new one before the old buffer goes away
+            T tmp(std::forward<Args>(args)...);
+            grow_for(size_ + 1);
+            ::new (static_cast<void*>(data_ + size_)) T(std::move(tmp));
+        } else {
+            ::new (static_cast<void*>(data_ + size_)) T(std::forward<Args>(args)...);
+        }
+        return data_[size_++];
+    }
+    void push_back(const T& v) {
+        emplace_back(v);
+    }
+    void push_back(T&& v) {
+        emplace_back(std::move(v));
+    }
+    void pop_back() {
+        data_[--size_].~T();
+    }
+
+    // @brief construct an element before pos, later elements shift right by one
+    // @return iterator to the new element
+    template <typename... Args>
+    iterator emplace(const_iterator pos, Args&&... args) {
+        size_t idx = static_cast<size_t>(pos - data_);
+        if (idx == size_) {
+            emplace_back(std::forward<Args>(args)...);
+            return data_ + idx;
+        }
+        // args may refer to an element that is about to move
+        T tmp(std::forward<Args>(args)...);
+        grow_for(size_ + 1);
+        ::new (static_cast<void*>(data_ + size_)) T(std::move(data_[size_ - 1]));
+        std::move_backward(data_ + idx, data_ + size_ - 1, data_ + size_);
+        data_[idx] = std::move(tmp);
+        size_++;
+        return data_ + idx;
+    }
+    iterator insert(const_iterator pos, const T& v) {
+        return emplace(pos, v);
+    }
+    iterator insert(const_iterator pos, T&& v) {
+        return emplace(pos, std::move(v));
+    }
+
+    // @brief insert [first, last) before pos, appended then rotated into place
+    template <typename InputIt, typename = typename std::iterator_traits<InputIt>::iterator_category>
+    iterator insert(const_iterator pos, InputIt first, InputIt last) {
+        size_t idx = static_cast<size_t>(pos - data_);
+        size_t old_size = size_;
+        for (; first != last; ++first) {
+            emplace_back(*first);
+        }
+        std::rotate(data_ + idx, data_ + old_size, data_ + size_);
+        return data_ + idx;
+    }
+
+    iterator erase(const_iterator pos) {
+        return erase(pos, pos + 1);
+    }
+    iterator erase(const_iterator first, const_iterator last) {
+        T* f = data_ + (first - data_);
+        T* l = data_ + (last - data_);
+        if (f != l) {
+            T* new_end = std::move(l, data_ + size_, f);
+            for (T* p = new_end; p != data_ + size_; p++) {
+                p->~T();
+            }
+            size_ = static_cast<size_t>(new_end - data_);
+        }
+        return f;
+    }
+
+    void resize(size_t n) {
+        if (n < size_) {
+            erase(begin() + n, end());
+        } else {
+            reserve(n);
+            while (size_ < n) {
+                emplace_back();
+            }
+        }
+    }
+
+    void swap(small_vector& other) {
+        small_vector tmp(std::move(other));
+        other = std::move(*this);
+        *this = std::move(tmp);
+    }
+};
+
+template <typename T, size_t N>
+bool operator==(const small_vector<T, N>& a, const small_vector<T, N>& b) {
+    return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin());
+}
+
+template <typename T, size_t N>
+bool operator!=(const small_vector<T, N>& a, const small_vector<T, N>& b) {
+    return !(a == b);
+}
+
+}
+#endif
@@ -0,0 +1,292 @@
+// TLSFAllocator.hpp
+// Header file for Two-Level Segregated Fit allocator
+// TLSF分配器头文件，O(1)的变长内存分配与释放
+
+#ifndef TOYLIB_TLSF_ALLOCATOR_HEADER
+#define TOYLIB_TLSF_ALLOCATOR_HEADER
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <cassert>
+
+namespace toylib {
+
+// index of the most significant set bit, x must be non-zero
+static inline unsigned tlsf_fls(size_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+    return static_cast<unsigned>(sizeof(unsigned long long) * 8 - 1 - __builtin_clzll(x));
+#else
+    unsigned n = 0;
+    while (x >>= 1) {
+        n++;
+    }
+    return n;
+#endif
+}
+
+// index of the least significant set bit, x must be non-zero
+static inline unsigned tlsf_ffs(uint32_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+    return static_cast<unsigned>(__builtin_ctz(x));
+#else
+    unsigned n = 0;
+    while (!(x & 1)) {
+        x >>= 1;
+        n++;
+    }
+    return n;
+#endif
+}
+
+// Two-Level Segregated Fit allocator
+// Free blocks are kept in segregated lists indexed by (first level = power of two, second level = linear subdivision).
+// Two bitmaps tell which lists are non-empty, so finding a fitting block is a couple of bit scans
+// and allocate/deallocate are O(1) with bounded worst case, suitable for real-time threads.
+// Fragmentation is bounded by the second level granularity: a request is served from a list whose blocks are all large enough
+// 注：
+// 1. 内存来自调用方提供的区域，或构造时一次性分配的区域，运行期间不会再向系统申请
+// 2. 返回的地址按16字节对齐，每个块有16字节的头部开销
+// 3. 非线程安全，通常每个实时线程各持有一个
+class tlsf_allocator {
+private:
+    static constexpr size_t align_log2 = 4;
+    static constexpr size_t align_size = size_t(1) << align_log2;
+    static constexpr size_t sl_index_log2 = 5;
+    static constexpr size_t sl_index_count = size_t(1) << sl_index_log2;
+    static constexpr size_t fl_index_shift = sl_index_log2 + align_log2;
+    static constexpr size_t fl_index_max = sizeof(size_t) == 8 ? 40 : 30;     // blocks are smaller than 2^fl_index_max bytes
+    static constexpr size_t fl_index_count = fl_index_max - fl_index_shift + 1;
+    static constexpr size_t small_block_size = size_t(1) << fl_index_shift;   // sizes below are split linearly in first level 0
+
+    static constexpr size_t flag_free = 1;
+    static constexpr size_t flag_prev_free = 2;
+    static constexpr size_t flag_mask = flag_free | flag_prev_free;
+
+    // header of every physical block, payload follows right after it
+    struct alignas(align_size) block_header {
+        block_header* prev_phys_;   // physically previous block, nullptr for the first block of a region
+        size_t size_;               // payload size, low bits hold flags
+    };
+
+    // links of a free block, stored in its payload
+    struct free_links {
+        block_header* next_;
+        block_header* prev_;
+    };
+
+    static constexpr size_t header_size = sizeof(block_header);
+    static constexpr size_t block_size_min = (sizeof(free_links) + align_size - 1) / align_size * align_size;
+    static constexpr size_t block_size_max = (size_t(1) << fl_index_max) - align_size;
+
+    static_assert(sizeof(block_header) == align_size, "block header must keep payload aligned");
+    static_assert(sl_index_count <= 32, "second level bitmap is 32 bits");
+    static_assert(fl_index_count <= 32, "first level bitmap is 32 bits");
+
+    uint32_t fl_bitmap_;
+    uint32_t sl_bitmap_[fl_index_count];
+    block_header* blocks_[fl_index_count][sl_index_count];
+    std::unique_ptr<char[]> owned_;     // region allocated by the size constructor
+
+    // block helpers
+    static size_t block_size(const block_header* b) {
+        return b->size_ & ~flag_mask;
+    }
+    static void set_block_size(block_header* b, size_t size) {
+        b->size_ = size | (b->size_ & flag_mask);
+    }
+    static bool is_free(const block_header* b) {
+        return b->size_ & flag_free;
+    }
+    static bool is_prev_free(const block_header* b) {
+        return b->size_ & flag_prev_free;
+    }
+    static void set_flag(block_header* b, size_t flag, bool on) {
+        if (on) b->size_ |= flag;
+        else b->size_ &= ~flag;
+    }
+    static char* payload(block_header* b) {
+        return reinterpret_cast<char*>(b) + header_size;
+    }
+    static block_header* header_of(void* ptr) {
+        return reinterpret_cast<block_header*>(static_cast<char*>(ptr) - header_size);
+    }
+    static block_header* next_phys(block_header* b) {
+        return reinterpret_cast<block_header*>(payload(b) + block_size(b));
+    }
+    static free_links& links(block_header* b) {
+        return *reinterpret_cast<free_links*>(payload(b));
+    }
+
+    // list index a block of this size belongs to
+    static void mapping_insert(size_t size, size_t& fl, size_t& sl) {
+        if (size < small_block_size) {
+            fl = 0;
+            sl = size / (small_block_size / sl_index_count);
+        } else {
+            size_t f = tlsf_fls(size);
+            sl = (size >> (f - sl_index_log2)) ^ sl_index_count;
+            fl = f - (fl_index_shift - 1);
+        }
+    }
+
+    // first list whose blocks are all large enough for size
+    static void mapping_search(size_t size, size_t& fl, size_t& sl) {
+        if (size >= small_block_size) {
+            size += (size_t(1) << (tlsf_fls(size) - sl_index_log2)) - 1;
+        }
+        mapping_insert(size, fl, sl);
+    }
+
+    // @return head of the first non-empty list at or above (fl, sl), nullptr if there is none
+    block_header* find_suitable(size_t& fl, size_t& sl) {
+        if (fl >= fl_index_count) return nullptr;
+        uint32_t sl_map = sl_bitmap_[fl] & (~uint32_t(0) << sl);
+        if (!sl_map) {
+            if (fl + 1 >= fl_index_count) return nullptr;
+            uint32_t fl_map = fl_bitmap_ & (~uint32_t(0) << (fl + 1));
+            if (!fl_map) return nullptr;
+            fl = tlsf_ffs(fl_map);
+            sl_map = sl_bitmap_[fl];
+        }
+        sl = tlsf_ffs(sl_map);
+        return blocks_[fl][sl];
+    }
+
+    void remove_free_block(block_header* b, size_t fl, size_t sl) {
+        block_header* prev = links(b).prev_;
+        block_header* next = links(b).next_;
+        if (next) links(next).prev_ = prev;
+        if (prev) links(prev).next_ = next;
+        if (blocks_[fl][sl] == b) {
+            blocks_[fl][sl] = next;
+            if (!next) {
+                sl_bitmap_[fl] &= ~(uint32_t(1) << sl);
+                if (!sl_bitmap_[fl]) {
+                    fl_bitmap_ &= ~(uint32_t(1) << fl);
+                }
+            }
+        }
+    }
+
+    void remove_free_block(block_header* b) {
+        size_t fl, sl;
+        mapping_insert(block_size(b), fl, sl);
+        remove_free_block(b, fl, sl);
+    }
+
+    void insert_free_block(block_header* b) {
+        size_t fl, sl;
+        mapping_insert(block_size(b), fl, sl);
+        block_header* head = blocks_[fl][sl];
+        links(b).next_ = head;
+        links(b).prev_ = nullptr;
+        if (head) links(head).prev_ = b;
+        blocks_[fl][sl] = b;
+        fl_bitmap_ |= uint32_t(1) << fl;
+        sl_bitmap_[fl] |= uint32_t(1) << sl;
+    }
+
+public:
+    // @brief Empty allocator, memory is given later by add_region
+    tlsf_allocator() : fl_bitmap_(0), sl_bitmap_(), blocks_() {}
+
+    // @brief Manage a caller-provided region, which must outlive the allocator
+    tlsf_allocator(void* mem, size_t bytes) : tlsf_allocator() {
+        add_region(mem, bytes);
+    }
+
+    // @brief Allocate and manage a region of `bytes` bytes
+    explicit tlsf_allocator(size_t bytes) : tlsf_allocator() {
+        owned_.reset(new char[bytes]);
+        add_region(owned_.get(), bytes);
+    }
+
+    // blocks point into the managed regions and back into the free lists
+    tlsf_allocator(const tlsf_allocator&) = delete;
+    tlsf_allocator& operator=(const tlsf_allocator&) = delete;
+    tlsf_allocator(tlsf_allocator&&) = delete;
+    tlsf_allocator& operator=(tlsf_allocator&&) = delete;
+
+    // @brief Add one more region of memory
+    // @return false if the region is too small to hold a block
+    bool add_region(void* mem, size_t bytes) {
+        uintptr_t start = (reinterpret_cast<uintptr_t>(mem) + align_size - 1) & ~(align_size - 1);
+        uintptr_t end = (reinterpret_cast<uintptr_t>(mem) + bytes) & ~(align_size - 1);
+        if (end <= start || end - start < 2 * header_size + block_size_min) {
+            return false;
+        }
+        size_t size = end - start - 2 * header_size;
+        if (size > block_size_max) size = block_size_max;
+
+        // one free block covering the region, followed by a used zero-sized sentinel stopping merges
+        block_header* b = reinterpret_cast<block_header*>(start);
+        b->prev_phys_ = nullptr;
+        b->size_ = size | flag_free;
+        block_header* sentinel = next_phys(b);
+        sentinel->prev_phys_ = b;
+        sentinel->size_ = flag_prev_free;
+        insert_free_block(b);
+        return true;
+    }
+
+    // @return 16-byte aligned memory of at least size bytes, nullptr if no free block is large enough
+    void* allocate(size_t size) {
+        if (size > block_size_max) return nullptr;
+        size_t adjust = size < block_size_min ? block_size_min : (size + align_size - 1) & ~(align_size - 1);
+        size_t fl, sl;
+        mapping_search(adjust, fl, sl);
+        block_header* b = find_suitable(fl, sl);
+        if (!b) return nullptr;
+        remove_free_block(b, fl, sl);
+
+        size_t size_b = block_size(b);
+        if (size_b - adjust >= header_size + block_size_min) {
+            // split, the remainder stays free
+            block_header* rest = reinterpret_cast<block_header*>(payload(b) + adjust);
+            rest->prev_phys_ = b;
+            rest->size_ = (size_b - adjust - header_size) | flag_free;
+            set_block_size(b, adjust);
+            next_phys(rest)->prev_phys_ = rest;
+            insert_free_block(rest);
+        } else {
+            set_flag(next_phys(b), flag_prev_free, false);
+        }
+        set_flag(b, flag_free, false);
+        return payload(b);
+    }
+
+    // @brief Return memory from allocate(), nullptr is ignored
+    void deallocate(void* ptr) {
+        if (!ptr) return;
+        block_header* b = header_of(ptr);
+        assert(!is_free(b) && "Double free detected");
+        set_flag(b, flag_free, true);
+
+        // merge with free neighbours
+        if (is_prev_free(b)) {
+            block_header* prev = b->prev_phys_;
+            remove_free_block(prev);
+            set_block_size(prev, block_size(prev) + header_size + block_size(b));
+            b = prev;
+            next_phys(b)->prev_phys_ = b;
+        }
+        block_header* next = next_phys(b);
+        if (is_free(next)) {
+            remove_free_block(next);
+            set_block_size(b, block_size(b) + header_size + block_size(next));
+            next = next_phys(b);
+            next->prev_phys_ = b;
+        }
+        set_flag(next, flag_prev_free, true);
+        insert_free_block(b);
+    }
+
+    // @return Bytes usable at ptr, at least the size passed to allocate()
+    static size_t usable_size(void* ptr) {
+        return block_size(header_of(ptr));
+    }
+};
+
+}
+#endif
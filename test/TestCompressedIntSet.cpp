@@ -0,0 +1,149 @@
+#include "../include/CompressedIntSet.hpp"
+#include "../include/FlatSet.hpp"
+#include "../include/ToyTest.hpp"
+#include <iostream>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <stdexcept>
+
+using toylib::compressed_int_set;
+
+static std::vector<uint64_t> SortedIds(size_t n, uint64_t max_gap, uint64_t start, std::mt19937_64& rng) {
+    std::vector<uint64_t> v;
+    uint64_t x = start;
+    for (size_t i = 0; i < n; i++) {
+        v.push_back(x);
+        x += 1 + rng() % max_gap;
+    }
+    return v;
+}
+
+bool TestCompressedIntSet_SimpleTest() {
+    compressed_int_set empty;
+    TOYTEST_ASSERT(empty.empty() && empty.begin() == empty.end(), "default set should be empty");
+    TOYTEST_ASSERT_EQ(empty.count(0), 0, "empty set should contain nothing");
+
+    std::vector<uint64_t> v = {3, 4, 5, 10, 1000};
+    compressed_int_set s(v);
+    TOYTEST_ASSERT_EQ(s.size(), 5, "size mismatch");
+    TOYTEST_ASSERT(std::equal(s.begin(), s.end(), v.begin(), v.end()), "iteration mismatch");
+    TOYTEST_ASSERT_EQ(s.count(4), 1, "count failed");
+    TOYTEST_ASSERT_EQ(s.count(6), 0, "count found missing value");
+    TOYTEST_ASSERT_EQ(*s.lower_bound(6), 10, "lower_bound mismatch");
+    TOYTEST_ASSERT(s.lower_bound(1001) == s.end(), "lower_bound past the end should be end()");
+
+    // extreme gaps use 64-bit packing
+    std::vector<uint64_t> wide = {0, 1, UINT64_MAX - 1, UINT64_MAX};
+    compressed_int_set w(wide);
+    TOYTEST_ASSERT(std::equal(w.begin(), w.end(), wide.begin(), wide.end()), "64-bit gaps mismatch");
+    TOYTEST_ASSERT_EQ(w.count(UINT64_MAX), 1, "count of max value failed");
+
+    bool thrown = false;
+    try {
+        std::vector<uint64_t> bad = {1, 2, 2};
+        compressed_int_set b(bad);
+    } catch (const std::invalid_argument&) {
+        thrown = true;
+    }
+    TOYTEST_ASSERT(thrown, "duplicate input should throw");
+    return true;
+}
+
+bool TestCompressedIntSet_RandomTest() {
+    std::mt19937_64 rng(7);
+    // gaps from consecutive values (0 bits) to very sparse ones, sizes around block boundaries
+    for (uint64_t max_gap : {1ull, 2ull, 16ull, 1000ull, 1ull << 40}) {
+        for (size_t n : {1, 127, 128, 129, 256, 1000, 20000}) {
+            std::vector<uint64_t> v = SortedIds(n, max_gap, rng() % 1000, rng);
+            compressed_int_set s(v.begin(), v.end());
+            TOYTEST_ASSERT_EQ(s.size(), v.size(), "size mismatch");
+            TOYTEST_ASSERT(std::equal(s.begin(), s.end(), v.begin(), v.end()), "iteration mismatch");
+            std::vector<uint64_t> visited;
+            s.for_each([&visited](uint64_t x) { visited.push_back(x); });
+            TOYTEST_ASSERT(visited == v, "for_each mismatch");
+            for (int q = 0; q < 2000; q++) {
+                uint64_t x = q % 2 ? v[rng() % v.size()] : rng() % (v.back() + 2);
+                auto it = std::lower_bound(v.begin(), v.end(), x);
+                auto cit = s.lower_bound(x);
+                TOYTEST_ASSERT((it == v.end()) == (cit == s.end()), "lower_bound end mismatch");
+                if (it != v.end()) {
+                    TOYTEST_ASSERT_EQ(*cit, *it, "lower_bound mismatch");
+                }
+                TOYTEST_ASSERT_EQ(s.count(x), (it != v.end() && *it == x) ? 1 : 0, "count mismatch");
+            }
+        }
+    }
+    return true;
+}
+
+// memory and scan/lookup speed against flat_set<uint64_t>
+bool TestCompressedIntSet_Benchmark() {
+    std::mt19937_64 rng(11);
+    const size_t n = 20000000;
+    for (uint64_t max_gap : {4ull, 64ull}) {
+        std::vector<uint64_t> v = SortedIds(n, max_gap, 1ull << 40, rng);
+        compressed_int_set cs(v);
+        toylib::flat_set<uint64_t> fs(toylib::sorted_unique, std::vector<uint64_t>(v));
+        std::vector<uint64_t> queries;
+        for (int i = 0; i < 1000000; i++) {
+            queries.push_back(v[rng() % n] + rng() % 2);
+        }
+
+        auto t0 = std::chrono::high_resolution_clock::now();
+        uint64_t sum1 = 0;
+        for (uint64_t x : fs) sum1 += x;
+        auto t1 = std::chrono::high_resolution_clock::now();
+        uint64_t sum2 = 0;
+        for (uint64_t x : cs) sum2 += x;
+        auto t15 = std::chrono::high_resolution_clock::now();
+        uint64_t sum3 = 0;
+        cs.for_each([&sum3](uint64_t x) { sum3 += x; });
+        auto t2 = std::chrono::high_resolution_clock::now();
+        size_t found1 = 0, found2 = 0;
+        for (uint64_t q : queries) found1 += fs.count(q);
+        auto t3 = std::chrono::high_resolution_clock::now();
+        for (uint64_t q : queries) found2 += cs.count(q);
+        auto t4 = std::chrono::high_resolution_clock::now();
+        TOYTEST_ASSERT_EQ(sum1, sum2, "scan result mismatch");
+        TOYTEST_ASSERT_EQ(sum1, sum3, "for_each result mismatch");
+        TOYTEST_ASSERT_EQ(found1, found2, "lookup result mismatch");
+
+        std::cout << n << " ids, gaps up to " << max_gap << ": memory flat_set " << n * sizeof(uint64_t) / (1 << 20)
+                  << " MB, compressed " << cs.memory_usage() / (1 << 20) << " MB ("
+                  << cs.memory_usage() * 8.0 / n << " bits/id)" << std::endl;
+        std::cout << "  scan: flat_set " << std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count()
+                  << " ms, compressed iterator " << std::chrono::duration_cast<std::chrono::milliseconds>(t15 - t1).count()
+                  << " ms, compressed for_each " << std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t15).count() << " ms; "
+                  << queries.size() << " lookups: flat_set " << std::chrono::duration_cast<std::chrono::milliseconds>(t3 - t2).count()
+                  << " ms, compressed " << std::chrono::duration_cast<std::chrono::milliseconds>(t4 - t3).count() << " ms" << std::endl;
+    }
+    return true;
+}
+
+int main() {
+    std::vector<std::string> passed, failed;
+    RUN_TEST("CompressedIntSet_SimpleTest", TestCompressedIntSet_SimpleTest, passed, failed);
+    RUN_TEST_TIMER("CompressedIntSet_RandomTest", TestCompressedIntSet_RandomTest, passed, failed);
+    RUN_TEST_TIMER("CompressedIntSet_Benchmark", TestCompressedIntSet_Benchmark, passed, failed);
+
+    if (failed.empty()) {
+        std::cout << "All tests passed!" << std::endl;
+        return 0;
+    } else {
+        std::cout << "Some tests failed!" << std::endl;
+        std::cout << "Passed tests: ";
+        for (const auto& name : passed) {
+            std::cout << name << " ";
+        }
+        std::cout << std::endl;
+
+        std::cout << "Failed tests: ";
+        for (const auto& name : failed) {
+            std::cout << name << " ";
+        }
+        std::cout << std::endl;
+
+        return 1;
+    }
+}
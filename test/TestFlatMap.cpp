@@ -1,8 +1,18 @@
 #include "../include/FlatMap.hpp"
+#include "../include/SmallVector.hpp"
 #include "../include/ToyTest.hpp"
 #include <iostream>
 #include <map>
 #include <unordered_map>
+#include <string>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <random>
+#include <limits>
+#include <thread>
+#include <atomic>
+#include <shared_mutex>
 using namespace toylib;
 
 bool TestFlatMap_SimpleTest() {
@@ -189,10 +199,771 @@ bool TestFlatSet_Benchmark() {
     return true;
 }
 
+// key counting its constructions, lookups with a transparent comparator must not create any
+struct CountedName {
+    static int constructed;
+    std::string name_;
+    CountedName(const char* name) : name_(name) {
+        constructed++;
+    }
+    CountedName(const CountedName& other) : name_(other.name_) {
+        constructed++;
+    }
+};
+int CountedName::constructed = 0;
+
+struct NameLess {
+    using is_transparent = void;
+    bool operator()(const CountedName& a, const CountedName& b) const {
+        return a.name_ < b.name_;
+    }
+    bool operator()(const CountedName& a, const char* b) const {
+        return strcmp(a.name_.c_str(), b) < 0;
+    }
+    bool operator()(const char* a, const CountedName& b) const {
+        return strcmp(a, b.name_.c_str()) < 0;
+    }
+};
+
+bool TestFlatMap_TransparentTest() {
+    flat_map<CountedName, int, NameLess> fm;
+    const char* names[] = {"route/a", "route/b", "route/c", "users", "users/profile"};
+    for (int i = 0; i < 5; i++) {
+        fm.insert({CountedName(names[i]), i});
+    }
+    int before = CountedName::constructed;
+    for (int i = 0; i < 5; i++) {
+        TOYTEST_ASSERT_EQ(fm.count(names[i]), 1, "transparent count failed");
+        TOYTEST_ASSERT_EQ(fm.find(names[i])->second, i, "transparent find failed");
+        TOYTEST_ASSERT_EQ(fm.at(names[i]), i, "transparent at failed");
+    }
+    TOYTEST_ASSERT_EQ(fm.count("route"), 0, "transparent count found missing key");
+    TOYTEST_ASSERT(fm.find("zzz") == fm.end(), "transparent find found missing key");
+    bool thrown = false;
+    try {
+        fm.at("missing");
+    } catch (const std::out_of_range&) {
+        thrown = true;
+    }
+    TOYTEST_ASSERT(thrown, "transparent at should throw for missing key");
+    TOYTEST_ASSERT_EQ(fm.erase("route/b"), 1, "transparent erase failed");
+    TOYTEST_ASSERT_EQ(fm.erase("route/b"), 0, "transparent erase removed missing key");
+    TOYTEST_ASSERT_EQ(CountedName::constructed, before, "lookup constructed a temporary key");
+
+    // erase by iterator still picks the iterator overload
+    fm.erase(fm.begin());
+    TOYTEST_ASSERT_EQ(fm.size(), 3, "erase by iterator failed");
+
+    // std::less<> with std::string keys
+    flat_map<std::string, int, std::less<>> sm;
+    sm["alpha"] = 1;
+    sm["beta"] = 2;
+    TOYTEST_ASSERT_EQ(sm.count("alpha"), 1, "std::less<> count failed");
+    TOYTEST_ASSERT_EQ(sm.at("beta"), 2, "std::less<> at failed");
+    // a non-transparent map still accepts convertible keys through Key
+    flat_map<std::string, int> plain;
+    plain["k"] = 3;
+    TOYTEST_ASSERT_EQ(plain.count("k"), 1, "count with convertible key failed");
+    return true;
+}
+
+bool TestFlatMap_BatchTest() {
+    for (int n : {0, 1, 2, 17, 1000}) {
+        flat_map<int, int> fm;
+        for (int i = 0; i < n; i++) {
+            int k = rand() % (4 * n + 1);
+            fm[k] = k * 2;
+        }
+        std::vector<int> keys;
+        for (int i = 0; i < 2000; i++) {
+            keys.push_back(rand() % (4 * n + 3) - 1);
+        }
+        for (int sorted = 0; sorted < 2; sorted++) {
+            if (sorted) std::sort(keys.begin(), keys.end());
+            std::vector<size_t> counts(keys.size());
+            std::vector<flat_map<int, int>::iterator> its(keys.size());
+            fm.count_batch(keys.data(), keys.size(), counts.data());
+            fm.find_batch(keys.data(), keys.size(), its.data());
+            for (size_t i = 0; i < keys.size(); i++) {
+                TOYTEST_ASSERT_EQ(counts[i], fm.count(keys[i]), "count_batch mismatch");
+                TOYTEST_ASSERT(its[i] == fm.find(keys[i]), "find_batch mismatch");
+                TOYTEST_ASSERT(its[i] == fm.end() || its[i]->second == keys[i] * 2, "find_batch found wrong element");
+            }
+        }
+    }
+    return true;
+}
+
+// counts copies and moves, to check that inserts don't copy
+struct Tracked {
+    static int copies;
+    static int moves;
+    static int constructs;
+    int v_;
+    std::string payload_;
+    Tracked(int v) : v_(v), payload_(64, 'x') {
+        constructs++;
+    }
+    Tracked(int v, const std::string& payload) : v_(v), payload_(payload) {
+        constructs++;
+    }
+    Tracked(const Tracked& o) : v_(o.v_), payload_(o.payload_) {
+        copies++;
+    }
+    Tracked(Tracked&& o) noexcept : v_(o.v_), payload_(std::move(o.payload_)) {
+        moves++;
+    }
+    Tracked& operator=(const Tracked& o) {
+        v_ = o.v_;
+        payload_ = o.payload_;
+        copies++;
+        return *this;
+    }
+    Tracked& operator=(Tracked&& o) noexcept {
+        v_ = o.v_;
+        payload_ = std::move(o.payload_);
+        moves++;
+        return *this;
+    }
+    bool operator<(const Tracked& o) const {
+        return v_ < o.v_;
+    }
+    static void reset() {
+        copies = moves = constructs = 0;
+    }
+};
+int Tracked::copies = 0;
+int Tracked::moves = 0;
+int Tracked::constructs = 0;
+
+bool TestFlatMap_EmplaceTest() {
+    flat_map<std::string, Tracked> fm;
+    fm.reserve(16);
+    Tracked::reset();
+    fm.insert({std::string("a"), Tracked(1)});
+    TOYTEST_ASSERT_EQ(Tracked::copies, 0, "rvalue insert copied");
+
+    // try_emplace constructs the value in place and nothing on the duplicate path
+    Tracked::reset();
+    auto r = fm.try_emplace("b", 2, std::string("two"));
+    TOYTEST_ASSERT(r.second && r.first->second.payload_ == "two", "try_emplace failed");
+    TOYTEST_ASSERT_EQ(Tracked::constructs, 1, "try_emplace should construct once");
+    TOYTEST_ASSERT_EQ(Tracked::copies, 0, "try_emplace copied");
+    Tracked::reset();
+    r = fm.try_emplace("b", 3);
+    TOYTEST_ASSERT(!r.second && r.first->second.v_ == 2, "try_emplace replaced existing value");
+    TOYTEST_ASSERT_EQ(Tracked::constructs + Tracked::copies + Tracked::moves, 0, "try_emplace constructed a value for a duplicate");
+
+    // key passed as rvalue is moved in, and kept when it's a duplicate
+    std::string key(100, 'k');
+    fm.try_emplace(std::move(key), 4);
+    TOYTEST_ASSERT(key.empty(), "rvalue key should be moved in");
+    std::string dup(100, 'k');
+    fm.try_emplace(std::move(dup), 5);
+    TOYTEST_ASSERT_EQ(dup.size(), 100, "duplicate key was moved from");
+
+    // insert_or_assign
+    Tracked::reset();
+    auto ia = fm.insert_or_assign("a", Tracked(10));
+    TOYTEST_ASSERT(!ia.second && fm.at("a").v_ == 10, "insert_or_assign should assign existing");
+    ia = fm.insert_or_assign("c", Tracked(30));
+    TOYTEST_ASSERT(ia.second && fm.at("c").v_ == 30, "insert_or_assign should insert missing");
+    TOYTEST_ASSERT_EQ(Tracked::copies, 0, "insert_or_assign copied");
+
+    // emplace and emplace_hint
+    TOYTEST_ASSERT(fm.emplace("d", 40).second, "emplace failed");
+    TOYTEST_ASSERT(!fm.emplace("d", 41).second, "duplicate emplace should fail");
+    auto it = fm.emplace_hint(fm.end(), "z", 260);
+    TOYTEST_ASSERT(it->first == "z" && it == fm.end() - 1, "emplace_hint at end failed");
+    it = fm.emplace_hint(fm.begin(), "0", 0);
+    TOYTEST_ASSERT(it == fm.begin(), "emplace_hint at begin failed");
+
+    // emplace compares the key first, no value is constructed for a duplicate
+    Tracked::reset();
+    TOYTEST_ASSERT(!fm.emplace(std::string("d"), 42).second, "duplicate emplace should fail");
+    TOYTEST_ASSERT(!fm.emplace(std::piecewise_construct, std::forward_as_tuple("d"), std::forward_as_tuple(43, "x")).second,
+                   "duplicate piecewise emplace should fail");
+    TOYTEST_ASSERT(fm.emplace_hint(fm.end(), "d", 44)->second.v_ == 40, "duplicate emplace_hint replaced existing value");
+    TOYTEST_ASSERT(fm.emplace_hint(fm.begin(), std::piecewise_construct, std::forward_as_tuple(1, 'd'),
+                                   std::forward_as_tuple(45))->second.v_ == 40, "duplicate piecewise emplace_hint failed");
+    TOYTEST_ASSERT_EQ(Tracked::constructs + Tracked::copies + Tracked::moves, 0, "emplace constructed a value for a duplicate");
+    r = fm.emplace(std::piecewise_construct, std::forward_as_tuple("e"), std::forward_as_tuple(50, "fifty"));
+    TOYTEST_ASSERT(r.second && r.first->second.payload_ == "fifty", "piecewise emplace failed");
+    TOYTEST_ASSERT_EQ(Tracked::constructs, 1, "piecewise emplace should construct once");
+    TOYTEST_ASSERT_EQ(Tracked::copies, 0, "piecewise emplace copied");
+    it = fm.emplace_hint(fm.find("e") + 1, "f", 60);
+    TOYTEST_ASSERT(it->first == "f" && it->second.v_ == 60 && (it - 1)->first == "e", "emplace_hint in the middle failed");
+
+    // operator[] with rvalue key
+    flat_map<std::string, int> counts;
+    counts[std::string("x")]++;
+    counts["x"]++;
+    TOYTEST_ASSERT_EQ(counts["x"], 2, "operator[] mismatch");
+    TOYTEST_ASSERT(std::is_sorted(fm.begin(), fm.end(),
+        [](const std::pair<std::string, Tracked>& a, const std::pair<std::string, Tracked>& b) { return a.first < b.first; }), "map is not sorted");
+    return true;
+}
+
+template <size_t N>
+using small_map = flat_map<std::string, int, std::less<std::string>, small_vector<std::pair<std::string, int>, N>>;
+
+bool TestFlatMap_SmallStorageTest() {
+    small_map<4> m;
+    std::map<std::string, int> ref;
+    for (int i = 0; i < 40; i++) {
+        std::string k = "attr" + std::to_string(i * 7 % 40);
+        m[k] = i;
+        ref[k] = i;
+        if (i == 3) {
+            TOYTEST_ASSERT(m.begin() + 4 == m.end(), "map should hold 4 entries");
+        }
+    }
+    m.try_emplace("attr1", 100);
+    m.insert_or_assign("attr2", 200);
+    ref["attr2"] = 200;
+    m.erase("attr3");
+    ref.erase("attr3");
+    TOYTEST_ASSERT_EQ(m.size(), ref.size(), "size mismatch");
+    TOYTEST_ASSERT(std::equal(m.begin(), m.end(), ref.begin(), ref.end(),
+        [](const std::pair<std::string, int>& a, const std::pair<const std::string, int>& b) {
+            return a.first == b.first && a.second == b.second;
+        }), "content mismatch");
+    for (int i = 0; i < 45; i++) {
+        std::string k = "attr" + std::to_string(i);
+        TOYTEST_ASSERT_EQ(m.count(k), ref.count(k), "count mismatch");
+    }
+    // copies and moves of an inline map
+    small_map<8> a;
+    a["x"] = 1;
+    a["y"] = 2;
+    small_map<8> b(a);
+    small_map<8> c(std::move(a));
+    TOYTEST_ASSERT(b.at("y") == 2 && c.at("x") == 1 && c.size() == 2, "copy or move mismatch");
+    return true;
+}
+
+// many tiny maps, like per connection attributes
+template <typename Map>
+static void RunTinyMaps(const std::vector<int>& keys, const std::vector<int>& order, long long& build_ms, long long& lookup_ms, long long& sum) {
+    auto t0 = std::chrono::high_resolution_clock::now();
+    std::vector<Map> v(order.size());
+    for (auto& m : v) {
+        for (int k : keys) m[k] = k;
+    }
+    auto t1 = std::chrono::high_resolution_clock::now();
+    // maps are visited in random order, as connections would be
+    for (int i : order) {
+        for (int k = 0; k < 11; k++) sum += v[i].count(k);
+    }
+    auto t2 = std::chrono::high_resolution_clock::now();
+    build_ms = std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count();
+    lookup_ms = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count();
+}
+
+bool TestFlatMap_SmallStorageBenchmark() {
+    const int maps = 1000000;
+    std::vector<int> keys = {3, 7, 1, 9, 5, 0};
+    std::vector<int> order(maps);
+    for (int i = 0; i < maps; i++) {
+        order[i] = i;
+    }
+    std::shuffle(order.begin(), order.end(), std::mt19937(11));
+    long long build1, lookup1, sum1 = 0, build2, lookup2, sum2 = 0;
+    RunTinyMaps<flat_map<int, int>>(keys, order, build1, lookup1, sum1);
+    RunTinyMaps<flat_map<int, int, std::less<int>, small_vector<std::pair<int, int>, 8>>>(keys, order, build2, lookup2, sum2);
+    TOYTEST_ASSERT_EQ(sum1, sum2, "lookup results mismatch");
+    std::cout << maps << " maps of " << keys.size() << " entries\t build ms \\ 11M lookups ms" << std::endl;
+    std::cout << "std::vector storage\t " << build1 << " \\ " << lookup1 << std::endl;
+    std::cout << "small_vector<8>\t\t " << build2 << " \\ " << lookup2 << std::endl;
+    return true;
+}
+
+struct SumResolve {
+    void operator()(int& kept, int&& dup) const {
+        kept += dup;
+    }
+};
+
+bool TestFlatMap_ParallelBuildTest() {
+    for (size_t n : {size_t(10), size_t(100000)}) {
+        for (size_t threads : {1, 3, 4}) {
+            std::vector<std::pair<int, int>> entries;
+            std::map<int, int> first, last, sum;
+            for (size_t i = 0; i < n; i++) {
+                int k = rand() % static_cast<int>(n / 3 + 1);
+                int v = static_cast<int>(i);
+                entries.push_back({k, v});
+                first.insert({k, v});
+                last[k] = v;
+                sum[k] += v;
+            }
+            auto same = [](const std::pair<int, int>& a, const std::pair<const int, int>& b) {
+                return a.first == b.first && a.second == b.second;
+            };
+            auto entries2 = entries, entries3 = entries;
+            auto m1 = flat_map_build_parallel(std::move(entries), threads);
+            auto m2 = flat_map_build_parallel(std::move(entries2), threads, std::less<int>(), flat_keep_last());
+            auto m3 = flat_map_build_parallel(std::move(entries3), threads, std::less<int>(), SumResolve());
+            TOYTEST_ASSERT(std::equal(m1.begin(), m1.end(), first.begin(), first.end(), same), "keep_first mismatch");
+            TOYTEST_ASSERT(std::equal(m2.begin(), m2.end(), last.begin(), last.end(), same), "keep_last mismatch");
+            TOYTEST_ASSERT(std::equal(m3.begin(), m3.end(), sum.begin(), sum.end(), same), "summing resolve mismatch");
+        }
+    }
+    std::vector<std::pair<std::string, std::string>> names;
+    for (int i = 0; i < 80000; i++) {
+        names.push_back({"k" + std::to_string(i % 5000), std::to_string(i)});
+    }
+    auto m = flat_map_build_parallel(std::move(names), 2, std::less<std::string>(), flat_keep_last());
+    TOYTEST_ASSERT(m.size() == 5000 && m.at("k7") == "75007", "string map build mismatch");
+    return true;
+}
+
+bool TestFlatMap_SoaTest() {
+    soa_flat_map<int, std::string> m;
+    std::map<int, std::string> ref;
+    for (int i = 0; i < 3000; i++) {
+        int k = rand() % 1000;
+        int op = rand() % 4;
+        if (op == 0) {
+            m[k] = std::to_string(i);
+            ref[k] = std::to_string(i);
+        } else if (op == 1) {
+            auto r = m.insert({k, std::to_string(i)});
+            TOYTEST_ASSERT_EQ(r.second, ref.insert({k, std::to_string(i)}).second, "insert result mismatch");
+            TOYTEST_ASSERT(r.first->first == k && r.first->second == ref[k], "insert returned wrong iterator");
+        } else if (op == 2) {
+            m.insert_or_assign(k, "x" + std::to_string(i));
+            ref[k] = "x" + std::to_string(i);
+        } else {
+            TOYTEST_ASSERT_EQ(m.erase(k), ref.erase(k), "erase result mismatch");
+        }
+    }
+    TOYTEST_ASSERT_EQ(m.size(), ref.size(), "size mismatch");
+    TOYTEST_ASSERT(std::equal(m.begin(), m.end(), ref.begin(), ref.end(),
+        [](std::pair<const int&, std::string&> a, const std::pair<const int, std::string>& b) {
+            return a.first == b.first && a.second == b.second;
+        }), "content mismatch");
+    for (int k = -1; k <= 1000; k++) {
+        TOYTEST_ASSERT_EQ(m.count(k), ref.count(k), "count mismatch");
+        auto it = m.find(k);
+        TOYTEST_ASSERT((it != m.end()) == (ref.count(k) == 1), "find mismatch");
+        if (it != m.cend()) {
+            TOYTEST_ASSERT(it->second == ref[k] && m.at(k) == ref[k], "value mismatch");
+        }
+    }
+    TOYTEST_ASSERT(std::is_sorted(m.keys().begin(), m.keys().end()), "keys are not sorted");
+
+    // writes through iterators reach the value array
+    for (auto kv : m) {
+        kv.second += "!";
+    }
+    const auto& cm = m;
+    TOYTEST_ASSERT(cm.begin()->second.back() == '!' && cm.end() - cm.begin() == static_cast<std::ptrdiff_t>(m.size()), "iterator write failed");
+    m.erase(m.begin());
+    m.try_emplace(-5, 3, 'a');
+    TOYTEST_ASSERT(m.begin()->second == "aaa", "try_emplace failed");
+    bool thrown = false;
+    try {
+        m.at(5000);
+    } catch (const std::out_of_range&) {
+        thrown = true;
+    }
+    TOYTEST_ASSERT(thrown, "at() should throw for a missing key");
+
+    soa_flat_map<std::string, int> sm(sorted_unique, std::vector<std::string>{"a", "b", "c"}, std::vector<int>{1, 2, 3});
+    TOYTEST_ASSERT(sm.at("b") == 2 && sm.count("d") == 0, "sorted_unique construction mismatch");
+    // rvalue keys are moved into the key array
+    std::string key(64, 'k');
+    TOYTEST_ASSERT(sm.insert_or_assign(std::move(key), 4).second && key.empty(), "rvalue key should be moved");
+    TOYTEST_ASSERT(!sm.insert_or_assign(std::string(64, 'k'), 5).second && sm.at(std::string(64, 'k')) == 5,
+                   "insert_or_assign should assign an existing key");
+    // operator* returns a proxy, so the iterator doesn't claim to be more than an input iterator
+    static_assert(std::is_same<std::iterator_traits<soa_flat_map<int, int>::iterator>::iterator_category,
+                               std::input_iterator_tag>::value, "soa_flat_map iterator category");
+    return true;
+}
+
+// 8 byte keys with 120 byte values, lookups that read the value
+struct BigValue {
+    uint64_t data[15];
+};
+
+bool TestFlatMap_SoaBenchmark() {
+    const size_t n = 1 << 20;
+    std::vector<uint64_t> keys(n);
+    for (size_t i = 0; i < n; i++) {
+        keys[i] = i * 5;
+    }
+    std::vector<std::pair<uint64_t, BigValue>> entries(n);
+    std::vector<BigValue> values(n);
+    for (size_t i = 0; i < n; i++) {
+        entries[i].first = keys[i];
+        for (int j = 0; j < 15; j++) {
+            entries[i].second.data[j] = keys[i] + j;
+        }
+        values[i] = entries[i].second;
+    }
+    flat_map<uint64_t, BigValue> fm(sorted_unique, std::move(entries));
+    soa_flat_map<uint64_t, BigValue> sm(sorted_unique, std::move(keys), std::move(values));
+    std::vector<uint64_t> queries;
+    for (int i = 0; i < 2000000; i++) {
+        queries.push_back(((static_cast<uint64_t>(rand()) << 16) ^ static_cast<uint64_t>(rand())) % (n * 5));
+    }
+    uint64_t sum1 = 0, sum2 = 0;
+    auto t0 = std::chrono::high_resolution_clock::now();
+    for (uint64_t q : queries) {
+        auto it = fm.find(q);
+        if (it != fm.end()) sum1 += it->second.data[7];
+    }
+    auto t1 = std::chrono::high_resolution_clock::now();
+    for (uint64_t q : queries) {
+        auto it = sm.find(q);
+        if (it != sm.end()) sum2 += it.value().data[7];
+    }
+    auto t2 = std::chrono::high_resolution_clock::now();
+    TOYTEST_ASSERT_EQ(sum1, sum2, "lookup results mismatch");
+    std::cout << queries.size() << " finds over " << n << " entries with 120 byte values: flat_map "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count() << " ms, soa_flat_map "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count() << " ms" << std::endl;
+    return true;
+}
+
+// readers only get a const reference
+static size_t ReadConfig(const flat_map<int, std::string>& cfg, int from, int to) {
+    size_t hits = 0;
+    for (int k = from; k < to; k++) {
+        if (cfg.contains(k)) {
+            auto it = cfg.find(k);
+            hits += (it != cfg.end() && cfg.at(k) == it->second) ? 1 : 0;
+        }
+    }
+    return hits;
+}
+
+bool TestFlatMap_ConstTest() {
+    flat_map<int, std::string> m;
+    for (int i = 0; i < 100; i += 2) {
+        m[i] = std::to_string(i);
+    }
+    const flat_map<int, std::string>& cm = m;
+    for (int k = -1; k <= 101; k++) {
+        std::map<int, std::string> ref;
+        for (const auto& kv : cm) ref.insert(kv);
+        auto lb = cm.lower_bound(k);
+        auto ub = cm.upper_bound(k);
+        auto er = cm.equal_range(k);
+        TOYTEST_ASSERT(lb - cm.begin() == std::distance(ref.begin(), ref.lower_bound(k)), "lower_bound mismatch");
+        TOYTEST_ASSERT(ub - cm.begin() == std::distance(ref.begin(), ref.upper_bound(k)), "upper_bound mismatch");
+        TOYTEST_ASSERT(er.first == lb && er.second == ub, "equal_range mismatch");
+        TOYTEST_ASSERT_EQ(cm.contains(k), ref.count(k) == 1, "contains mismatch");
+        TOYTEST_ASSERT((cm.find(k) == cm.end()) == (ref.count(k) == 0), "const find mismatch");
+    }
+    TOYTEST_ASSERT(cm.at(42) == "42", "const at mismatch");
+    bool thrown = false;
+    try {
+        cm.at(41);
+    } catch (const std::out_of_range&) {
+        thrown = true;
+    }
+    TOYTEST_ASSERT(thrown, "const at() should throw for a missing key");
+    // non-const versions still give mutable access
+    m.lower_bound(10)->second = "ten";
+    m.equal_range(12).first->second = "twelve";
+    TOYTEST_ASSERT(cm.at(10) == "ten" && cm.at(12) == "twelve", "mutable lower_bound or equal_range failed");
+
+    // concurrent readers of one immutable map
+    std::vector<size_t> hits(4, 0);
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 4; t++) {
+        readers.emplace_back([&cm, &hits, t]() {
+            for (int r = 0; r < 200; r++) {
+                hits[t] += ReadConfig(cm, 0, 100);
+            }
+        });
+    }
+    for (auto& th : readers) {
+        th.join();
+    }
+    for (size_t h : hits) {
+        TOYTEST_ASSERT_EQ(h, 200 * 50, "concurrent reader mismatch");
+    }
+
+    flat_map<std::string, int, std::less<>> tm;
+    tm["alpha"] = 1;
+    const auto& ctm = tm;
+    TOYTEST_ASSERT(ctm.contains("alpha") && !ctm.contains("beta") && ctm.at("alpha") == 1 && ctm.find("alpha") != ctm.end(),
+        "transparent const lookups failed");
+    return true;
+}
+
+bool TestFlatMap_CowTest() {
+    cow_flat_map<int, int> m;
+    TOYTEST_ASSERT_EQ(m.size(), 0, "new map should be empty");
+    m.insert_or_assign(1, 10);
+    m.update([](flat_map<int, int>& fm) {
+        for (int i = 2; i <= 5; i++) fm[i] = i * 10;
+    });
+    TOYTEST_ASSERT(m.size() == 5 && m.get(3) == 30 && m.get(9, -1) == -1 && m.contains(5), "update mismatch");
+    TOYTEST_ASSERT_EQ(m.erase(5), 1, "erase failed");
+    TOYTEST_ASSERT(!m.contains(5), "erased key still visible");
+    int sum = m.read([](const flat_map<int, int>& fm) {
+        int s = 0;
+        for (const auto& kv : fm) s += kv.second;
+        return s;
+    });
+    TOYTEST_ASSERT_EQ(sum, 100, "read mismatch");
+    TOYTEST_ASSERT_EQ(m.retired(), 0, "snapshots without readers should be freed");
+
+    // a snapshot in use is not freed until its reader leaves
+    bool unchanged = false;
+    size_t retired_inside = m.read([&m, &unchanged](const flat_map<int, int>& fm) {
+        m.insert_or_assign(100, 1);
+        unchanged = fm.count(100) == 0;
+        return m.retired();
+    });
+    TOYTEST_ASSERT(unchanged, "a reader's snapshot must not change");
+    TOYTEST_ASSERT(retired_inside == 1 && m.retired() == 0 && m.contains(100), "reclaim after read mismatch");
+
+    // every snapshot a reader sees is one whole version: all values equal and the size matches
+    cow_flat_map<int, int> versions(flat_map<int, int>{});
+    std::atomic<bool> stop(false);
+    std::atomic<size_t> torn(0), reads(0);
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 4; t++) {
+        readers.emplace_back([&]() {
+            while (!stop.load()) {
+                bool ok = versions.read([](const flat_map<int, int>& fm) {
+                    if (fm.empty()) return true;
+                    int v = fm.begin()->second;
+                    if (fm.size() != static_cast<size_t>(v % 50 + 1)) return false;
+                    for (const auto& kv : fm) {
+                        if (kv.second != v) return false;
+                    }
+                    return true;
+                });
+                torn += ok ? 0 : 1;
+                reads++;
+            }
+        });
+    }
+    for (int v = 0; v < 2000; v++) {
+        flat_map<int, int> next;
+        for (int k = 0; k <= v % 50; k++) next[k] = v;
+        versions.assign(std::move(next));
+        if (v % 100 == 0) std::this_thread::yield();
+    }
+    stop = true;
+    for (auto& th : readers) {
+        th.join();
+    }
+    TOYTEST_ASSERT_EQ(torn.load(), 0, "a reader saw a partial update");
+    TOYTEST_ASSERT_EQ(versions.retired(), 0, "snapshots leaked after readers left");
+    TOYTEST_ASSERT(reads.load() > 0, "readers never ran");
+    return true;
+}
+
+// readers look up keys while one writer updates a few times, against a reader-writer lock around a flat_map
+bool TestFlatMap_CowBenchmark() {
+    const int threads = 4, lookups = 2000000, keys = 10000;
+    flat_map<int, int> base;
+    for (int i = 0; i < keys; i++) base[i] = i;
+    cow_flat_map<int, int> cow(base);
+    flat_map<int, int> locked(base);
+    std::shared_timed_mutex mtx;
+
+    auto run = [&](bool use_cow) {
+        std::atomic<long long> total(0);
+        std::atomic<bool> stop(false);
+        std::thread writer([&]() {
+            for (int u = 0; !stop.load(); u++) {
+                if (use_cow) {
+                    cow.insert_or_assign(u % keys, u % keys);
+                } else {
+                    std::unique_lock<std::shared_timed_mutex> lock(mtx);
+                    locked.insert_or_assign(u % keys, u % keys);
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+        });
+        std::vector<std::thread> readers;
+        auto t0 = std::chrono::high_resolution_clock::now();
+        for (int t = 0; t < threads; t++) {
+            readers.emplace_back([&, t]() {
+                long long sum = 0;
+                for (int i = 0; i < lookups; i++) {
+                    int k = static_cast<int>((static_cast<long long>(i) * 7919 + t) % keys);
+                    if (use_cow) {
+                        sum += cow.read([k](const flat_map<int, int>& m) { return m.at(k); });
+                    } else {
+                        std::shared_lock<std::shared_timed_mutex> lock(mtx);
+                        sum += locked.at(k);
+                    }
+                }
+                total += sum;
+            });
+        }
+        for (auto& th : readers) th.join();
+        auto t1 = std::chrono::high_resolution_clock::now();
+        stop = true;
+        writer.join();
+        return std::make_pair(total.load(), std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count());
+    };
+    auto r1 = run(false);
+    auto r2 = run(true);
+    TOYTEST_ASSERT_EQ(r1.first, r2.first, "lookup results mismatch");
+    std::cout << threads << " readers x " << lookups << " lookups (hardware threads: " << std::thread::hardware_concurrency()
+              << "): shared_timed_mutex " << r1.second << " ms, cow_flat_map " << r2.second << " ms" << std::endl;
+    return true;
+}
+
+// sorted unique keys of three shapes: uniform, clustered around a few centers, and exponentially growing (adversarial)
+template <typename Key>
+static std::vector<Key> MakeKeys(int shape, size_t n, std::mt19937_64& rng) {
+    std::vector<Key> keys;
+    if (shape == 0) {
+        for (size_t i = 0; i < n; i++) {
+            keys.push_back(static_cast<Key>(rng() >> 20));
+        }
+    } else if (shape == 1) {
+        for (size_t i = 0; i < n; i++) {
+            uint64_t center = (rng() % 16) << 36;
+            keys.push_back(static_cast<Key>(center + rng() % (uint64_t(1) << (10 + rng() % 16))));
+        }
+    } else {
+        double v = 1;
+        for (size_t i = 0; i < n; i++) {
+            v = v * 1.00002 + 1;
+            keys.push_back(static_cast<Key>(v) + static_cast<Key>(i));
+        }
+    }
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    return keys;
+}
+
+template <typename Key>
+static bool CheckSearchPolicies(const std::vector<Key>& keys, std::mt19937_64& rng) {
+    using interp_map = flat_map<Key, int, std::less<Key>, std::vector<std::pair<Key, int>>, flat_interpolation_search>;
+    std::vector<std::pair<Key, int>> entries;
+    for (size_t i = 0; i < keys.size(); i++) {
+        entries.push_back({keys[i], static_cast<int>(i)});
+    }
+    flat_map<Key, int> bm(sorted_unique, std::vector<std::pair<Key, int>>(entries));
+    interp_map im(sorted_unique, std::vector<std::pair<Key, int>>(entries));
+    learned_flat_map<Key, int> lm(sorted_unique, std::vector<std::pair<Key, int>>(entries), 8);
+    std::vector<Key> queries;
+    for (size_t i = 0; i < keys.size() && i < 20000; i++) {
+        Key k = keys[rng() % keys.size()];
+        queries.push_back(k);
+        queries.push_back(static_cast<Key>(k + 1));
+        queries.push_back(static_cast<Key>(k - 1));
+    }
+    queries.push_back(std::numeric_limits<Key>::lowest());
+    queries.push_back(std::numeric_limits<Key>::max());
+    for (Key q : queries) {
+        auto expected = bm.lower_bound(q) - bm.begin();
+        TOYTEST_ASSERT_EQ(im.lower_bound(q) - im.begin(), expected, "interpolation lower_bound mismatch");
+        TOYTEST_ASSERT_EQ(lm.lower_bound(q) - lm.begin(), expected, "learned lower_bound mismatch");
+        TOYTEST_ASSERT_EQ(im.count(q), bm.count(q), "interpolation count mismatch");
+        TOYTEST_ASSERT_EQ(lm.count(q), bm.count(q), "learned count mismatch");
+        if (bm.count(q)) {
+            TOYTEST_ASSERT(lm.at(q) == bm.at(q) && im.at(q) == bm.at(q), "value mismatch");
+        }
+    }
+    return true;
+}
+
+bool TestFlatMap_SearchPolicyTest() {
+    std::mt19937_64 rng(17);
+    for (int shape = 0; shape < 3; shape++) {
+        for (size_t n : {size_t(1), size_t(5), size_t(100), size_t(100000)}) {
+            if (!CheckSearchPolicies(MakeKeys<uint64_t>(shape, n, rng), rng)) return false;
+            if (!CheckSearchPolicies(MakeKeys<int64_t>(shape, n, rng), rng)) return false;
+            if (!CheckSearchPolicies(MakeKeys<int>(shape, n, rng), rng)) return false;
+            if (!CheckSearchPolicies(MakeKeys<double>(shape, n, rng), rng)) return false;
+        }
+    }
+    // huge keys near the top of the range, where double can't tell neighbours apart
+    std::vector<uint64_t> huge;
+    for (uint64_t i = 0; i < 5000; i++) {
+        huge.push_back(~uint64_t(0) - 100000 + i * 3);
+    }
+    if (!CheckSearchPolicies(huge, rng)) return false;
+    std::vector<int64_t> negative;
+    for (int64_t i = 0; i < 5000; i++) {
+        negative.push_back(std::numeric_limits<int64_t>::min() / 2 + i * i * 1000003);
+    }
+    if (!CheckSearchPolicies(negative, rng)) return false;
+    // infinite float keys and queries, single-point segments predict 0 * inf
+    const float inf = std::numeric_limits<float>::infinity();
+    std::vector<float> infinite{-inf, -1e30f, -2.5f, 0.0f, 1.0f, 1e30f, inf};
+    if (!CheckSearchPolicies(infinite, rng)) return false;
+    learned_flat_map<float, int> lf(sorted_unique, {{0.0f, 0}, {1.0f, 1}, {1e30f, 2}}, 0);
+    TOYTEST_ASSERT(lf.lower_bound(inf) == lf.end() && lf.count(inf) == 0, "inf query should find nothing");
+    TOYTEST_ASSERT(lf.lower_bound(-inf) == lf.begin(), "-inf query should stop at the first key");
+    // NaN is unordered, only check that it is searched without undefined behaviour, like std::lower_bound
+    TOYTEST_ASSERT(lf.lower_bound(std::numeric_limits<float>::quiet_NaN()) == lf.begin(), "NaN query mismatch");
+
+    learned_flat_map<int, int> empty;
+    TOYTEST_ASSERT(empty.count(1) == 0 && empty.lower_bound(1) == empty.end(), "empty learned map lookup failed");
+    flat_map<int, int> src;
+    for (int i = 0; i < 1000; i++) src[i * 2] = i;
+    learned_flat_map<int, int> from_map(src);
+    TOYTEST_ASSERT(from_map.segments() == 1 && from_map.at(500) == 250, "linear keys should need one segment");
+    return true;
+}
+
+bool TestFlatMap_SearchPolicyBenchmark() {
+    using interp_map = flat_map<uint64_t, uint64_t, std::less<uint64_t>, std::vector<std::pair<uint64_t, uint64_t>>, flat_interpolation_search>;
+    const size_t n = 4000000, m = 4000000;
+    std::mt19937_64 rng(23);
+    const char* shapes[3] = {"uniform", "clustered", "adversarial"};
+    std::cout << n << " keys, " << m << " lookups\t binary \\ interpolation \\ learned ms (segments)" << std::endl;
+    for (int shape = 0; shape < 3; shape++) {
+        std::vector<uint64_t> keys = MakeKeys<uint64_t>(shape, n, rng);
+        std::vector<std::pair<uint64_t, uint64_t>> entries;
+        for (uint64_t k : keys) entries.push_back({k, k});
+        flat_map<uint64_t, uint64_t> bm(sorted_unique, std::vector<std::pair<uint64_t, uint64_t>>(entries));
+        interp_map im(sorted_unique, std::vector<std::pair<uint64_t, uint64_t>>(entries));
+        learned_flat_map<uint64_t, uint64_t> lm(sorted_unique, std::move(entries));
+        std::vector<uint64_t> queries;
+        for (size_t i = 0; i < m; i++) {
+            queries.push_back(i % 2 ? keys[rng() % keys.size()] : keys[rng() % keys.size()] + 1);
+        }
+        size_t f1 = 0, f2 = 0, f3 = 0;
+        auto t0 = std::chrono::high_resolution_clock::now();
+        for (uint64_t q : queries) f1 += bm.count(q);
+        auto t1 = std::chrono::high_resolution_clock::now();
+        for (uint64_t q : queries) f2 += im.count(q);
+        auto t2 = std::chrono::high_resolution_clock::now();
+        for (uint64_t q : queries) f3 += lm.count(q);
+        auto t3 = std::chrono::high_resolution_clock::now();
+        TOYTEST_ASSERT(f1 == f2 && f1 == f3, "lookup results mismatch");
+        std::cout << shapes[shape] << "\t\t " << std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count()
+                  << " \\ " << std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count()
+                  << " \\ " << std::chrono::duration_cast<std::chrono::milliseconds>(t3 - t2).count()
+                  << " (" << lm.segments() << ")" << std::endl;
+    }
+    return true;
+}
+
 int main() {
     std::vector<std::string> passed, failed;
     RUN_TEST("FlatMap Simple Test", TestFlatMap_SimpleTest, passed, failed);
     RUN_TEST("FlatMap Sanity Test", TestFlatMap_SanityTest, passed, failed);
+    RUN_TEST("FlatMap Transparent Test", TestFlatMap_TransparentTest, passed, failed);
+    RUN_TEST("FlatMap Batch Test", TestFlatMap_BatchTest, passed, failed);
+    RUN_TEST("FlatMap Emplace Test", TestFlatMap_EmplaceTest, passed, failed);
+    RUN_TEST("FlatMap Parallel Build Test", TestFlatMap_ParallelBuildTest, passed, failed);
+    RUN_TEST("FlatMap Const Test", TestFlatMap_ConstTest, passed, failed);
+    RUN_TEST("FlatMap Cow Test", TestFlatMap_CowTest, passed, failed);
+    RUN_TEST_TIMER("FlatMap Cow Benchmark", TestFlatMap_CowBenchmark, passed, failed);
+    RUN_TEST("FlatMap Search Policy Test", TestFlatMap_SearchPolicyTest, passed, failed);
+    RUN_TEST_TIMER("FlatMap Search Policy Benchmark", TestFlatMap_SearchPolicyBenchmark, passed, failed);
+    RUN_TEST("FlatMap SoA Test", TestFlatMap_SoaTest, passed, failed);
+    RUN_TEST_TIMER("FlatMap SoA Benchmark", TestFlatMap_SoaBenchmark, passed, failed);
+    RUN_TEST("FlatMap Small Storage Test", TestFlatMap_SmallStorageTest, passed, failed);
+    RUN_TEST_TIMER("FlatMap Small Storage Benchmark", TestFlatMap_SmallStorageBenchmark, passed, failed);
     RUN_TEST("FlatMap Benchmark", TestFlatSet_Benchmark, passed, failed);
 
     if (failed.empty()) {
@@ -1,11 +1,18 @@
 #include "../include/FlatSet.hpp"
+#include "../include/SmallVector.hpp"
 #include "../include/ToyTest.hpp"
 #include <iostream>
 #include <set>
 #include <unordered_set>
 #include <cstdlib>
+#include <algorithm>
+#include <iterator>
+#include <string>
+#include <thread>
 
 using toylib::flat_set;
+using toylib::eytzinger_set;
+using toylib::frozen_flat_set;
 
 bool TestFlatSet_SimpleTest() {
     flat_set<int> fs;
@@ -233,11 +240,897 @@ bool TestFlatSet_Benchmark() {
     return true;
 }
 
+bool TestFlatSet_BulkInsertTest() {
+    // 与std::set的结果对比
+    flat_set<int> fs;
+    std::set<int> s;
+    for (int round = 0; round < 20; round++) {
+        std::vector<int> batch;
+        for (int i = 0; i < 1000; i++) {
+            batch.push_back(rand() % 5000);
+        }
+        fs.insert(batch.begin(), batch.end());
+        s.insert(batch.begin(), batch.end());
+        TOYTEST_ASSERT_EQ(fs.size(), s.size(), "size mismatch after range insert");
+        TOYTEST_ASSERT(std::equal(fs.begin(), fs.end(), s.begin()), "content mismatch after range insert");
+    }
+
+    // 已有元素和重复的新元素中，保留先出现的那个
+    struct Item {
+        int key_;
+        int tag_;
+    };
+    struct ItemLess {
+        bool operator()(const Item& a, const Item& b) const { return a.key_ < b.key_; }
+    };
+    flat_set<Item, ItemLess> items;
+    items.insert(Item{2, 0});
+    std::vector<Item> batch = {{3, 1}, {2, 1}, {1, 1}, {3, 2}, {1, 2}};
+    items.insert(batch.begin(), batch.end());
+    TOYTEST_ASSERT_EQ(items.size(), 3, "duplicates not removed");
+    for (const auto& it : items) {
+        TOYTEST_ASSERT_EQ(it.tag_, it.key_ == 2 ? 0 : 1, "range insert kept the wrong equivalent element");
+    }
+
+    // 接管已排序的vector，不复制
+    std::vector<int> sorted = {1, 3, 5, 7};
+    const int* raw = sorted.data();
+    flat_set<int> adopted(toylib::sorted_unique, std::move(sorted));
+    TOYTEST_ASSERT_EQ(adopted.size(), 4, "adopted size mismatch");
+    TOYTEST_ASSERT(&*adopted.begin() == raw, "sorted vector should be moved, not copied");
+    TOYTEST_ASSERT_EQ(adopted.count(5), 1, "adopted set lookup failed");
+    TOYTEST_ASSERT_EQ(adopted.count(4), 0, "adopted set lookup failed");
+
+    // 1M个元素的批量构建
+    std::vector<int> keys;
+    for (int i = 0; i < 1000000; i++) {
+        keys.push_back(rand() % 2000000);
+    }
+    flat_set<int> big;
+    auto start = std::chrono::high_resolution_clock::now();
+    big.insert(keys.begin(), keys.begin() + keys.size() / 2);
+    big.insert(keys.begin() + keys.size() / 2, keys.end());
+    auto end = std::chrono::high_resolution_clock::now();
+    std::cout << "Range insert of 1M keys in two batches: "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << " ms" << std::endl;
+    std::set<int> expected(keys.begin(), keys.end());
+    TOYTEST_ASSERT_EQ(big.size(), expected.size(), "bulk insert size mismatch");
+    TOYTEST_ASSERT(std::equal(big.begin(), big.end(), expected.begin()), "bulk insert content mismatch");
+    return true;
+}
+
+// comparator whose order is chosen at runtime
+struct DirectionLess {
+    bool descending = false;
+    bool operator()(int a, int b) const {
+        return descending ? b < a : a < b;
+    }
+};
+
+bool TestFlatSet_EytzingerTest() {
+    // 各种大小的树形状都要覆盖
+    for (int n = 0; n < 70; n++) {
+        flat_set<int> fs;
+        for (int i = 0; i < n; i++) {
+            fs.insert(i * 2);
+        }
+        eytzinger_set<int> es(fs);
+        TOYTEST_ASSERT_EQ(es.size(), static_cast<size_t>(n), "size mismatch");
+        TOYTEST_ASSERT(std::equal(fs.begin(), fs.end(), es.begin()) && std::distance(es.begin(), es.end()) == n, "iteration order mismatch");
+        for (int v = -1; v <= 2 * n; v++) {
+            TOYTEST_ASSERT_EQ(es.count(v), fs.count(v), "count mismatch");
+            auto lb = es.lower_bound(v);
+            auto expected = std::lower_bound(fs.begin(), fs.end(), v);
+            if (expected == fs.end()) {
+                TOYTEST_ASSERT(lb == es.end(), "lower_bound should return end()");
+            } else {
+                TOYTEST_ASSERT(lb != es.end(), "lower_bound should not return end()");
+                TOYTEST_ASSERT_EQ(*lb, *expected, "lower_bound mismatch");
+            }
+            TOYTEST_ASSERT((es.find(v) != es.end()) == (fs.count(v) == 1), "find mismatch");
+        }
+    }
+
+    // stateful comparator, the tree must be searched in the set's order, not a default constructed one
+    DirectionLess desc{true};
+    flat_set<int, DirectionLess> rs(desc);
+    for (int i = 0; i < 50; i++) {
+        rs.insert(i * 2);
+    }
+    eytzinger_set<int, DirectionLess> res(rs);
+    TOYTEST_ASSERT(std::equal(rs.begin(), rs.end(), res.begin()) && *res.begin() == 98, "descending iteration order mismatch");
+    for (int v = -1; v <= 100; v++) {
+        TOYTEST_ASSERT_EQ(res.count(v), rs.count(v), "count mismatch with descending comparator");
+        auto lb = res.lower_bound(v);
+        auto expected = std::lower_bound(rs.begin(), rs.end(), v, desc);
+        TOYTEST_ASSERT((lb == res.end()) == (expected == rs.end()) && (lb == res.end() || *lb == *expected),
+                       "lower_bound mismatch with descending comparator");
+    }
+
+    // 查找性能对比
+    std::vector<int> keys;
+    for (int i = 0; i < 4000000; i++) {
+        keys.push_back(rand());
+    }
+    flat_set<int> fs;
+    fs.insert(keys.begin(), keys.end());
+    eytzinger_set<int> es(fs);
+    std::vector<int> queries;
+    for (int i = 0; i < 4000000; i++) {
+        queries.push_back(i % 2 ? keys[rand() % keys.size()] : rand());
+    }
+    size_t found1 = 0, found2 = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int q : queries) {
+        found1 += fs.count(q);
+    }
+    auto mid = std::chrono::high_resolution_clock::now();
+    for (int q : queries) {
+        found2 += es.count(q);
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    TOYTEST_ASSERT_EQ(found1, found2, "lookup results mismatch");
+    std::cout << "4M lookups over " << fs.size() << " keys: flat_set "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(mid - start).count() << " ms, eytzinger_set "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(end - mid).count() << " ms" << std::endl;
+    return true;
+}
+
+template <typename T>
+static bool CheckFastSearch(const std::vector<T>& values, const std::vector<T>& queries) {
+    flat_set<T> fs;
+    fs.insert(values.begin(), values.end());
+    std::set<T> s(values.begin(), values.end());
+    for (const T& q : queries) {
+        TOYTEST_ASSERT_EQ(fs.count(q), s.count(q), "count mismatch for fast search");
+        auto it = fs.find(q);
+        TOYTEST_ASSERT((it != fs.end()) == (s.count(q) == 1), "find mismatch for fast search");
+    }
+    return true;
+}
+
+bool TestFlatSet_FastSearchTest() {
+    for (int n : {0, 1, 3, 8, 31, 32, 33, 100, 1000, 5000}) {
+        std::vector<int> vi;
+        std::vector<unsigned> vu;
+        std::vector<float> vf;
+        std::vector<int64_t> vl;
+        std::vector<long long> vll;
+        std::vector<short> vs;
+        std::vector<int> qi;
+        std::vector<unsigned> qu;
+        std::vector<float> qf;
+        std::vector<int64_t> ql;
+        std::vector<long long> qll;
+        std::vector<short> qs;
+        for (int i = 0; i < n; i++) {
+            int r = rand() % (4 * n + 1) - 2 * n;
+            vi.push_back(r);
+            vu.push_back(static_cast<unsigned>(r) * 2654435761u);    // spans the sign bit
+            vf.push_back(r * 0.5f);
+            vl.push_back(static_cast<int64_t>(r) * (int64_t(1) << 33));
+            vll.push_back(-static_cast<long long>(r) * 3);
+            vs.push_back(static_cast<short>(r));
+        }
+        for (int i = -2 * n - 2; i <= 2 * n + 2; i++) {
+            qi.push_back(i);
+            qu.push_back(static_cast<unsigned>(i) * 2654435761u);
+            qf.push_back(i * 0.5f);
+            ql.push_back(static_cast<int64_t>(i) * (int64_t(1) << 33));
+            qll.push_back(-static_cast<long long>(i) * 3);
+            qs.push_back(static_cast<short>(i));
+        }
+        if (!CheckFastSearch(vi, qi) || !CheckFastSearch(vu, qu) || !CheckFastSearch(vf, qf) ||
+            !CheckFastSearch(vl, ql) || !CheckFastSearch(vll, qll) || !CheckFastSearch(vs, qs)) {
+            std::cerr << "fast search failed with " << n << " elements" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// 与原先教科书式二分查找的对比
+bool TestFlatSet_SearchBenchmark() {
+    auto textbook_count = [](const std::vector<int>& data, int v) -> size_t {
+        size_t l = 0, r = data.size();
+        while (l < r) {
+            size_t mid = l + (r - l) / 2;
+            if (data[mid] < v) l = mid + 1;
+            else r = mid;
+        }
+        return (l < data.size() && data[l] == v) ? 1 : 0;
+    };
+    const int lookups = 2000000;
+    std::cout << "size\t textbook ns / flat_set ns per lookup" << std::endl;
+    for (size_t n : {16, 64, 256, 1024, 4096, 16384, 65536, 1 << 20}) {
+        std::vector<int> keys;
+        for (size_t i = 0; i < n; i++) {
+            keys.push_back(static_cast<int>(i * 3));
+        }
+        flat_set<int> fs(toylib::sorted_unique, std::vector<int>(keys));
+        std::vector<int> queries;
+        for (int i = 0; i < lookups; i++) {
+            queries.push_back(rand() % static_cast<int>(n * 3));
+        }
+        size_t found1 = 0, found2 = 0;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int q : queries) {
+            found1 += textbook_count(keys, q);
+        }
+        auto mid = std::chrono::high_resolution_clock::now();
+        for (int q : queries) {
+            found2 += fs.count(q);
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        TOYTEST_ASSERT_EQ(found1, found2, "lookup results mismatch");
+        std::cout << n << "\t " << std::chrono::duration_cast<std::chrono::nanoseconds>(mid - start).count() / lookups
+                  << " / " << std::chrono::duration_cast<std::chrono::nanoseconds>(end - mid).count() / lookups << std::endl;
+    }
+    return true;
+}
+
+template <typename T, typename Gen>
+static bool CheckSetAlgebra(size_t na, size_t nb, Gen gen) {
+    std::set<T> sa, sb;
+    while (sa.size() < na) sa.insert(gen());
+    while (sb.size() < nb) sb.insert(gen());
+    flat_set<T> a, b;
+    a.insert(sa.begin(), sa.end());
+    b.insert(sb.begin(), sb.end());
+
+    std::vector<T> expect;
+    std::set_union(sa.begin(), sa.end(), sb.begin(), sb.end(), std::back_inserter(expect));
+    auto u = toylib::flat_set_union(a, b);
+    TOYTEST_ASSERT(std::equal(u.begin(), u.end(), expect.begin(), expect.end()), "union mismatch");
+
+    expect.clear();
+    std::set_intersection(sa.begin(), sa.end(), sb.begin(), sb.end(), std::back_inserter(expect));
+    auto i = toylib::flat_set_intersection(a, b);
+    TOYTEST_ASSERT(std::equal(i.begin(), i.end(), expect.begin(), expect.end()), "intersection mismatch");
+
+    expect.clear();
+    std::set_difference(sa.begin(), sa.end(), sb.begin(), sb.end(), std::back_inserter(expect));
+    auto d = toylib::flat_set_difference(a, b);
+    TOYTEST_ASSERT(std::equal(d.begin(), d.end(), expect.begin(), expect.end()), "difference mismatch");
+    expect.clear();
+    std::set_difference(sb.begin(), sb.end(), sa.begin(), sa.end(), std::back_inserter(expect));
+    d = toylib::flat_set_difference(b, a);
+    TOYTEST_ASSERT(std::equal(d.begin(), d.end(), expect.begin(), expect.end()), "reversed difference mismatch");
+
+    expect.clear();
+    std::set_symmetric_difference(sa.begin(), sa.end(), sb.begin(), sb.end(), std::back_inserter(expect));
+    auto x = toylib::flat_set_symmetric_difference(a, b);
+    TOYTEST_ASSERT(std::equal(x.begin(), x.end(), expect.begin(), expect.end()), "symmetric difference mismatch");
+
+    // output iterator version
+    std::vector<T> out;
+    toylib::flat_set_intersection(b, a, std::back_inserter(out));
+    TOYTEST_ASSERT(std::equal(out.begin(), out.end(), i.begin(), i.end()), "intersection is not symmetric");
+    return true;
+}
+
+bool TestFlatSet_SetAlgebraTest() {
+    // balanced sizes use merge (and SIMD for 32-bit keys), skewed sizes use galloping
+    size_t sizes[][2] = {{0, 0}, {0, 10}, {10, 0}, {1, 1}, {5, 7}, {100, 100}, {1000, 1003}, {3, 1000}, {1000, 3}, {50, 5000}, {5000, 40}};
+    for (auto& sz : sizes) {
+        for (int range : {2, 10}) {
+            auto gen32 = [&]() { return static_cast<uint32_t>(rand() % ((sz[0] + sz[1]) * range + 1)) * 2654435761u; };
+            auto geni = [&]() { return rand() % static_cast<int>((sz[0] + sz[1]) * range + 1) - static_cast<int>(sz[0] + sz[1]); };
+            auto gens = [&]() { return std::to_string(rand() % ((sz[0] + sz[1]) * range + 1)); };
+            if (!CheckSetAlgebra<uint32_t>(sz[0], sz[1], gen32) || !CheckSetAlgebra<int>(sz[0], sz[1], geni) ||
+                !CheckSetAlgebra<std::string>(sz[0], sz[1], gens)) {
+                std::cerr << "set algebra failed with sizes " << sz[0] << ", " << sz[1] << std::endl;
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// intersection of posting lists against std::set_intersection over the same sorted arrays
+bool TestFlatSet_SetAlgebraBenchmark() {
+    auto make = [](size_t n, uint32_t range) {
+        std::vector<uint32_t> v;
+        for (size_t i = 0; i < n; i++) v.push_back(static_cast<uint32_t>(rand()) % range);
+        flat_set<uint32_t> fs;
+        fs.insert(v.begin(), v.end());
+        return fs;
+    };
+    size_t cases[][2] = {{1000000, 1000000}, {1000000, 100000}, {1000000, 1000}, {1000000, 10}};
+    for (auto& c : cases) {
+        flat_set<uint32_t> a = make(c[0], 4000000), b = make(c[1], 4000000);
+        const int rounds = 20;
+        std::vector<uint32_t> out1, out2;
+        out1.reserve(b.size());
+        out2.reserve(b.size());
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int r = 0; r < rounds; r++) {
+            out1.clear();
+            std::set_intersection(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(out1));
+        }
+        auto mid = std::chrono::high_resolution_clock::now();
+        for (int r = 0; r < rounds; r++) {
+            out2.clear();
+            toylib::flat_set_intersection(a, b, std::back_inserter(out2));
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        TOYTEST_ASSERT(out1 == out2, "intersection results mismatch");
+        std::cout << a.size() << " x " << b.size() << " intersection: std::set_intersection "
+                  << std::chrono::duration_cast<std::chrono::microseconds>(mid - start).count() / rounds << " us, flat_set_intersection "
+                  << std::chrono::duration_cast<std::chrono::microseconds>(end - mid).count() / rounds << " us" << std::endl;
+    }
+    return true;
+}
+
+// comparator between std::string keys and (pointer, length) slices of a request buffer
+struct SliceLess {
+    using is_transparent = void;
+    using slice = std::pair<const char*, size_t>;
+    static int cmp(const std::string& a, const slice& b) {
+        return a.compare(0, std::string::npos, b.first, b.second);
+    }
+    bool operator()(const std::string& a, const std::string& b) const {
+        return a < b;
+    }
+    bool operator()(const std::string& a, const slice& b) const {
+        return cmp(a, b) < 0;
+    }
+    bool operator()(const slice& a, const std::string& b) const {
+        return cmp(b, a) > 0;
+    }
+};
+
+bool TestFlatSet_TransparentTest() {
+    flat_set<std::string, SliceLess> fs;
+    for (const char* s : {"GET", "POST", "PUT", "DELETE"}) {
+        fs.insert(s);
+    }
+    const char buf[] = "PUT /index.html";
+    TOYTEST_ASSERT_EQ(fs.count(SliceLess::slice(buf, 3)), 1, "transparent count failed");
+    TOYTEST_ASSERT_EQ(fs.count(SliceLess::slice(buf, 2)), 0, "transparent count matched a prefix");
+    TOYTEST_ASSERT(*fs.find(SliceLess::slice(buf, 3)) == "PUT", "transparent find failed");
+    TOYTEST_ASSERT(fs.find(SliceLess::slice(buf, 4)) == fs.end(), "transparent find matched a longer key");
+    TOYTEST_ASSERT_EQ(fs.erase(SliceLess::slice(buf, 3)), 1, "transparent erase failed");
+    TOYTEST_ASSERT_EQ(fs.count("PUT"), 0, "erased key still found");
+    // iterator overload of erase is still chosen
+    fs.erase(fs.begin());
+    TOYTEST_ASSERT_EQ(fs.size(), 2, "erase by iterator failed");
+
+    flat_set<std::string, std::less<>> ls;
+    ls.insert("abc");
+    TOYTEST_ASSERT_EQ(ls.count("abc"), 1, "std::less<> count failed");
+    TOYTEST_ASSERT_EQ(ls.erase("abc"), 1, "std::less<> erase failed");
+    return true;
+}
+
+bool TestFlatSet_BatchTest() {
+    for (int n : {0, 1, 2, 17, 1000, 5000}) {
+        flat_set<int> fs;
+        for (int i = 0; i < n; i++) {
+            fs.insert(rand() % (4 * n + 1));
+        }
+        std::vector<int> keys;
+        for (int i = 0; i < 3000; i++) {
+            keys.push_back(rand() % (4 * n + 3) - 1);
+        }
+        for (int sorted = 0; sorted < 2; sorted++) {
+            if (sorted) std::sort(keys.begin(), keys.end());     // sorted batches take the merge path
+            std::vector<size_t> counts(keys.size());
+            std::vector<flat_set<int>::iterator> its(keys.size());
+            fs.count_batch(keys.data(), keys.size(), counts.data());
+            fs.find_batch(keys.data(), keys.size(), its.data());
+            for (size_t i = 0; i < keys.size(); i++) {
+                TOYTEST_ASSERT_EQ(counts[i], fs.count(keys[i]), "count_batch mismatch");
+                TOYTEST_ASSERT(its[i] == fs.find(keys[i]), "find_batch mismatch");
+            }
+        }
+    }
+    // non-arithmetic keys use the same lockstep search through comp_
+    flat_set<std::string> ss;
+    for (int i = 0; i < 100; i += 2) {
+        ss.insert(std::to_string(i));
+    }
+    std::vector<std::string> skeys;
+    for (int i = 0; i < 100; i++) {
+        skeys.push_back(std::to_string((i * 37) % 100));
+    }
+    std::vector<size_t> scounts(skeys.size());
+    ss.count_batch(skeys.data(), skeys.size(), scounts.data());
+    for (size_t i = 0; i < skeys.size(); i++) {
+        TOYTEST_ASSERT_EQ(scounts[i], ss.count(skeys[i]), "count_batch mismatch for string keys");
+    }
+    return true;
+}
+
+// lookups of a batch against a set much larger than the cache
+bool TestFlatSet_BatchBenchmark() {
+    const size_t n = 1 << 22;
+    std::vector<uint32_t> data;
+    for (size_t i = 0; i < n; i++) {
+        data.push_back(static_cast<uint32_t>(i * 3));
+    }
+    flat_set<uint32_t> fs(toylib::sorted_unique, std::move(data));
+    std::vector<uint32_t> keys;
+    for (int i = 0; i < 1000000; i++) {
+        keys.push_back(static_cast<uint32_t>(((static_cast<size_t>(rand()) << 16) ^ rand()) % (n * 3)));
+    }
+    std::vector<size_t> counts(keys.size());
+    auto t0 = std::chrono::high_resolution_clock::now();
+    size_t found1 = 0;
+    for (uint32_t k : keys) {
+        found1 += fs.count(k);
+    }
+    auto t1 = std::chrono::high_resolution_clock::now();
+    fs.count_batch(keys.data(), keys.size(), counts.data());
+    auto t2 = std::chrono::high_resolution_clock::now();
+    size_t found2 = 0;
+    for (size_t c : counts) {
+        found2 += c;
+    }
+    std::sort(keys.begin(), keys.end());
+    auto t3 = std::chrono::high_resolution_clock::now();
+    fs.count_batch(keys.data(), keys.size(), counts.data());
+    auto t4 = std::chrono::high_resolution_clock::now();
+    size_t found3 = 0;
+    for (size_t c : counts) {
+        found3 += c;
+    }
+    TOYTEST_ASSERT_EQ(found1, found2, "count_batch result mismatch");
+    TOYTEST_ASSERT_EQ(found1, found3, "sorted count_batch result mismatch");
+    std::cout << keys.size() << " lookups over " << n << " keys: count loop "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count() << " ms, count_batch "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count() << " ms, sorted count_batch "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(t4 - t3).count() << " ms" << std::endl;
+    return true;
+}
+
+bool TestFlatSet_BufferedTest() {
+    for (size_t max_buffer : {size_t(0), size_t(1), size_t(4), size_t(100)}) {
+        toylib::buffered_flat_set<int> bs(max_buffer);
+        std::set<int> s;
+        for (int op = 0; op < 20000; op++) {
+            int k = rand() % 3000;
+            switch (rand() % 4) {
+            case 0:
+            case 1: {
+                auto r = bs.insert(k);
+                TOYTEST_ASSERT_EQ(r.second, s.insert(k).second, "insert result mismatch");
+                TOYTEST_ASSERT_EQ(*r.first, k, "insert returned wrong iterator");
+                break;
+            }
+            case 2:
+                TOYTEST_ASSERT_EQ(bs.erase(k), s.erase(k), "erase result mismatch");
+                break;
+            default: {
+                auto it = bs.find(k);
+                TOYTEST_ASSERT_EQ(bs.count(k), s.count(k), "count mismatch");
+                TOYTEST_ASSERT((it != bs.end()) == (s.count(k) == 1), "find mismatch");
+                if (it != bs.end()) {
+                    TOYTEST_ASSERT_EQ(*it, k, "find returned wrong element");
+                    // iterating from a found element continues in order
+                    auto next = std::next(it);
+                    auto snext = std::next(s.find(k));
+                    TOYTEST_ASSERT((next == bs.end()) == (snext == s.end()), "successor mismatch");
+                    if (snext != s.end()) {
+                        TOYTEST_ASSERT_EQ(*next, *snext, "successor mismatch");
+                    }
+                }
+                break;
+            }
+            }
+            TOYTEST_ASSERT(bs.buffer_size() <= (max_buffer ? max_buffer : 64), "buffer exceeds its limit");
+        }
+        TOYTEST_ASSERT_EQ(bs.size(), s.size(), "size mismatch");
+        TOYTEST_ASSERT(std::equal(bs.begin(), bs.end(), s.begin(), s.end()), "iteration is not sorted or misses keys");
+        std::vector<int> more;
+        for (int i = 0; i < 1000; i++) {
+            more.push_back(rand() % 6000);
+        }
+        bs.insert(more.begin(), more.end());
+        s.insert(more.begin(), more.end());
+        TOYTEST_ASSERT(std::equal(bs.begin(), bs.end(), s.begin(), s.end()), "range insert mismatch");
+        bs.flush();
+        TOYTEST_ASSERT_EQ(bs.buffer_size(), 0, "flush left keys in buffer");
+        TOYTEST_ASSERT(std::equal(bs.begin(), bs.end(), s.begin(), s.end()), "flush lost keys");
+    }
+    return true;
+}
+
+// a burst of random inserts, where flat_set shifts O(n) elements per insert
+bool TestFlatSet_BufferedBenchmark() {
+    const int n = 300000;
+    std::vector<int> keys;
+    for (int i = 0; i < n; i++) {
+        keys.push_back(static_cast<int>((static_cast<unsigned>(rand()) << 8) ^ static_cast<unsigned>(rand())));
+    }
+    auto t0 = std::chrono::high_resolution_clock::now();
+    flat_set<int> fs;
+    for (int k : keys) {
+        fs.insert(k);
+    }
+    auto t1 = std::chrono::high_resolution_clock::now();
+    toylib::buffered_flat_set<int> bs;
+    for (int k : keys) {
+        bs.insert(k);
+    }
+    auto t2 = std::chrono::high_resolution_clock::now();
+    std::set<int> s;
+    for (int k : keys) {
+        s.insert(k);
+    }
+    auto t3 = std::chrono::high_resolution_clock::now();
+    size_t found1 = 0, found2 = 0;
+    for (int k : keys) {
+        found1 += fs.count(k);
+    }
+    auto t4 = std::chrono::high_resolution_clock::now();
+    for (int k : keys) {
+        found2 += bs.count(k);
+    }
+    auto t5 = std::chrono::high_resolution_clock::now();
+    TOYTEST_ASSERT_EQ(found1, found2, "lookup result mismatch");
+    TOYTEST_ASSERT(std::equal(fs.begin(), fs.end(), bs.begin(), bs.end()), "contents mismatch");
+    std::cout << n << " random inserts: flat_set " << std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count()
+              << " ms, buffered_flat_set " << std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count()
+              << " ms, std::set " << std::chrono::duration_cast<std::chrono::milliseconds>(t3 - t2).count() << " ms" << std::endl;
+    std::cout << n << " lookups: flat_set " << std::chrono::duration_cast<std::chrono::milliseconds>(t4 - t3).count()
+              << " ms, buffered_flat_set " << std::chrono::duration_cast<std::chrono::milliseconds>(t5 - t4).count() << " ms" << std::endl;
+    return true;
+}
+
+// counts copies and moves, to check that inserts don't copy
+struct Tracked {
+    static int copies;
+    static int moves;
+    static int constructs;
+    int v_;
+    std::string payload_;
+    Tracked(int v) : v_(v), payload_(64, 'x') {
+        constructs++;
+    }
+    Tracked(int v, const std::string& payload) : v_(v), payload_(payload) {
+        constructs++;
+    }
+    Tracked(const Tracked& o) : v_(o.v_), payload_(o.payload_) {
+        copies++;
+    }
+    Tracked(Tracked&& o) noexcept : v_(o.v_), payload_(std::move(o.payload_)) {
+        moves++;
+    }
+    Tracked& operator=(const Tracked& o) {
+        v_ = o.v_;
+        payload_ = o.payload_;
+        copies++;
+        return *this;
+    }
+    Tracked& operator=(Tracked&& o) noexcept {
+        v_ = o.v_;
+        payload_ = std::move(o.payload_);
+        moves++;
+        return *this;
+    }
+    bool operator<(const Tracked& o) const {
+        return v_ < o.v_;
+    }
+    static void reset() {
+        copies = moves = constructs = 0;
+    }
+};
+int Tracked::copies = 0;
+int Tracked::moves = 0;
+int Tracked::constructs = 0;
+
+bool TestFlatSet_MoveInsertTest() {
+    flat_set<Tracked> fs;
+    fs.reserve(16);
+    Tracked::reset();
+    for (int i = 0; i < 10; i += 2) {
+        fs.insert(Tracked(i));
+    }
+    TOYTEST_ASSERT_EQ(Tracked::copies, 0, "rvalue insert copied");
+    fs.emplace(5);
+    fs.emplace(7, std::string("seven"));
+    fs.emplace_hint(fs.end(), 100);
+    fs.insert(fs.begin(), Tracked(-1));
+    TOYTEST_ASSERT_EQ(Tracked::copies, 0, "emplace copied");
+    TOYTEST_ASSERT_EQ(fs.size(), 9, "size mismatch after emplace");
+
+    // duplicates are not moved in, the argument keeps its payload
+    Tracked dup(4);
+    auto r = fs.insert(std::move(dup));
+    TOYTEST_ASSERT(!r.second && r.first->v_ == 4, "duplicate insert should fail");
+    TOYTEST_ASSERT_EQ(dup.payload_.size(), 64, "duplicate insert moved from the argument");
+    TOYTEST_ASSERT(!fs.emplace(7).second, "duplicate emplace should fail");
+
+    // lvalue key is copied exactly once
+    Tracked::reset();
+    Tracked k(50);
+    fs.emplace(k);
+    TOYTEST_ASSERT_EQ(Tracked::copies, 1, "lvalue emplace should copy once");
+
+    int expect[] = {-1, 0, 2, 4, 5, 6, 7, 8, 50, 100};
+    TOYTEST_ASSERT(std::equal(fs.begin(), fs.end(), std::begin(expect), std::end(expect),
+        [](const Tracked& a, int b) { return a.v_ == b; }), "order mismatch after inserts");
+    return true;
+}
+
+struct ConstantHash {
+    size_t operator()(int) const {
+        return 42;
+    }
+};
+
+bool TestFlatSet_FrozenTest() {
+    // 各种大小都要覆盖，包括空集合和只有单键桶的小集合
+    for (int n : {0, 1, 2, 3, 5, 17, 100, 1000, 50000}) {
+        flat_set<int> fs;
+        for (int i = 0; i < n; i++) {
+            fs.insert(rand() % (n * 4 + 1));
+        }
+        frozen_flat_set<int> zs(fs);
+        TOYTEST_ASSERT(zs.hashed(), "perfect hash should be built");
+        TOYTEST_ASSERT_EQ(zs.size(), fs.size(), "size mismatch");
+        TOYTEST_ASSERT(std::equal(fs.begin(), fs.end(), zs.begin(), zs.end()), "iteration order mismatch");
+        for (int v = -1; v <= n * 4 + 1; v++) {
+            TOYTEST_ASSERT_EQ(zs.count(v), fs.count(v), "count mismatch");
+            auto it = zs.find(v);
+            TOYTEST_ASSERT((it != zs.end()) == (fs.count(v) == 1), "find mismatch");
+            if (it != zs.end()) {
+                TOYTEST_ASSERT_EQ(*it, v, "find returned wrong element");
+            }
+            TOYTEST_ASSERT(zs.lower_bound(v) - zs.begin() == std::lower_bound(fs.begin(), fs.end(), v) - fs.begin(), "lower_bound mismatch");
+        }
+    }
+
+    std::vector<std::string> words;
+    for (int i = 0; i < 2000; i++) {
+        words.push_back("key" + std::to_string(i * 7));
+    }
+    std::sort(words.begin(), words.end());
+    frozen_flat_set<std::string> ws(toylib::sorted_unique, std::vector<std::string>(words));
+    for (int i = 0; i < 14000; i++) {
+        TOYTEST_ASSERT_EQ(ws.count("key" + std::to_string(i)), i % 7 == 0 ? 1 : 0, "string count mismatch");
+    }
+
+    // a hash that can't tell keys apart falls back to binary search
+    frozen_flat_set<int, std::less<int>, ConstantHash> cs(toylib::sorted_unique, std::vector<int>{1, 3, 5, 7});
+    TOYTEST_ASSERT(!cs.hashed(), "constant hash can't build a perfect hash");
+    TOYTEST_ASSERT(cs.count(5) == 1 && cs.count(4) == 0 && cs.find(7) != cs.end(), "fallback lookup failed");
+
+    // shared by several threads without locks
+    flat_set<int> fs;
+    for (int i = 0; i < 100000; i++) {
+        fs.insert(i * 3);
+    }
+    const frozen_flat_set<int> shared(fs);
+    std::vector<size_t> found(4, 0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([&shared, &found, t]() {
+            for (int v = 0; v < 300000; v++) {
+                found[t] += shared.count(v);
+            }
+        });
+    }
+    for (auto& th : threads) {
+        th.join();
+    }
+    for (size_t f : found) {
+        TOYTEST_ASSERT_EQ(f, 100000, "concurrent count mismatch");
+    }
+    return true;
+}
+
+bool TestFlatSet_FrozenBenchmark() {
+    std::vector<int> keys;
+    for (int i = 0; i < 4000000; i++) {
+        keys.push_back(static_cast<int>((static_cast<unsigned>(rand()) << 16) ^ static_cast<unsigned>(rand())));
+    }
+    flat_set<int> fs;
+    fs.insert(keys.begin(), keys.end());
+    auto t0 = std::chrono::high_resolution_clock::now();
+    frozen_flat_set<int> zs(fs);
+    auto t1 = std::chrono::high_resolution_clock::now();
+    std::unordered_set<int> us(fs.begin(), fs.end());
+    std::vector<int> queries;
+    for (int i = 0; i < 4000000; i++) {
+        queries.push_back(i % 2 ? keys[rand() % keys.size()] : rand());
+    }
+    size_t found1 = 0, found2 = 0, found3 = 0;
+    auto t2 = std::chrono::high_resolution_clock::now();
+    for (int q : queries) {
+        found1 += fs.count(q);
+    }
+    auto t3 = std::chrono::high_resolution_clock::now();
+    for (int q : queries) {
+        found2 += zs.count(q);
+    }
+    auto t4 = std::chrono::high_resolution_clock::now();
+    for (int q : queries) {
+        found3 += us.count(q);
+    }
+    auto t5 = std::chrono::high_resolution_clock::now();
+    TOYTEST_ASSERT_EQ(found1, found2, "frozen lookup results mismatch");
+    TOYTEST_ASSERT_EQ(found1, found3, "unordered_set lookup results mismatch");
+    std::cout << "4M lookups over " << fs.size() << " keys: flat_set "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(t3 - t2).count() << " ms, frozen_flat_set "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(t4 - t3).count() << " ms (built in "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count() << " ms), unordered_set "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(t5 - t4).count() << " ms" << std::endl;
+    return true;
+}
+
+bool TestFlatSet_SmallStorageTest() {
+    flat_set<std::string, std::less<std::string>, toylib::small_vector<std::string, 4>> fs;
+    std::set<std::string> ref;
+    for (int i = 0; i < 200; i++) {
+        std::string k = std::to_string(rand() % 50);
+        TOYTEST_ASSERT_EQ(fs.insert(k).second, ref.insert(k).second, "insert result mismatch");
+        if (i % 3 == 0) {
+            k = std::to_string(rand() % 50);
+            TOYTEST_ASSERT_EQ(fs.erase(k), ref.erase(k), "erase result mismatch");
+        }
+        TOYTEST_ASSERT(std::equal(fs.begin(), fs.end(), ref.begin(), ref.end()), "content mismatch");
+    }
+    fs.insert(ref.begin(), ref.end());
+    fs.emplace_hint(fs.end(), "zzz");
+    TOYTEST_ASSERT(fs.count("zzz") == 1 && fs.size() == ref.size() + 1, "range insert or emplace_hint mismatch");
+
+    flat_set<int, std::less<int>, toylib::small_vector<int, 8>> small(toylib::sorted_unique, {1, 2, 3});
+    TOYTEST_ASSERT(small.count(2) == 1 && small.count(4) == 0, "sorted_unique construction mismatch");
+
+    // free functions and adaptors accept sets with other storage
+    using small_set = flat_set<int, std::less<int>, toylib::small_vector<int, 8>>;
+    small_set other(toylib::sorted_unique, {2, 3, 5, 8, 13});
+    small_set u = toylib::flat_set_union(small, other);
+    small_set in = toylib::flat_set_intersection(small, other);
+    small_set d = toylib::flat_set_difference(small, other);
+    small_set sd = toylib::flat_set_symmetric_difference(small, other);
+    std::vector<int> ev{1, 2, 3, 5, 8, 13}, ei{2, 3}, ed{1}, esd{1, 5, 8, 13};
+    TOYTEST_ASSERT(std::equal(u.begin(), u.end(), ev.begin(), ev.end()), "small_vector union mismatch");
+    TOYTEST_ASSERT(std::equal(in.begin(), in.end(), ei.begin(), ei.end()), "small_vector intersection mismatch");
+    TOYTEST_ASSERT(std::equal(d.begin(), d.end(), ed.begin(), ed.end()), "small_vector difference mismatch");
+    TOYTEST_ASSERT(std::equal(sd.begin(), sd.end(), esd.begin(), esd.end()), "small_vector symmetric difference mismatch");
+
+    toylib::frozen_flat_set<int> frozen(u);
+    toylib::eytzinger_set<int> eytzinger(u);
+    for (int k = 0; k < 15; k++) {
+        TOYTEST_ASSERT_EQ(frozen.count(k), u.count(k), "frozen_flat_set from small_vector set mismatch");
+        TOYTEST_ASSERT_EQ(eytzinger.count(k), u.count(k), "eytzinger_set from small_vector set mismatch");
+    }
+
+    auto built = toylib::flat_set_build_parallel<int, std::less<int>, toylib::small_vector<int, 8>>(
+        std::vector<int>{13, 1, 8, 2, 3, 5, 1, 13}, 2);
+    TOYTEST_ASSERT(std::equal(built.begin(), built.end(), ev.begin(), ev.end()), "small_vector parallel build mismatch");
+    return true;
+}
+
+// ordered by k only, order_ records the input position
+struct Tagged {
+    int k_;
+    int order_;
+    bool operator<(const Tagged& o) const {
+        return k_ < o.k_;
+    }
+};
+
+bool TestFlatSet_ParallelBuildTest() {
+    for (size_t n : {size_t(0), size_t(100), size_t(70000), size_t(300000)}) {
+        for (size_t threads : {1, 2, 3, 8}) {
+            std::vector<Tagged> keys;
+            std::set<int> ref;
+            for (size_t i = 0; i < n; i++) {
+                int k = rand() % static_cast<int>(n / 2 + 1);
+                keys.push_back({k, static_cast<int>(i)});
+                ref.insert(k);
+            }
+            std::vector<int> first(n / 2 + 1, -1);
+            for (const Tagged& t : keys) {
+                if (first[t.k_] < 0) first[t.k_] = t.order_;
+            }
+            auto fs = toylib::flat_set_build_parallel(std::move(keys), threads);
+            TOYTEST_ASSERT_EQ(fs.size(), ref.size(), "size mismatch");
+            TOYTEST_ASSERT(std::equal(fs.begin(), fs.end(), ref.begin(), ref.end(),
+                [](const Tagged& a, int b) { return a.k_ == b; }), "content mismatch");
+            for (const Tagged& t : fs) {
+                TOYTEST_ASSERT_EQ(t.order_, first[t.k_], "the first of equivalent keys should be kept");
+            }
+        }
+    }
+    // custom comparator, descending
+    std::vector<int> keys;
+    for (int i = 0; i < 200000; i++) {
+        keys.push_back(rand() % 1000);
+    }
+    auto desc = toylib::flat_set_build_parallel(std::move(keys), 4, std::greater<int>());
+    TOYTEST_ASSERT(desc.size() == 1000 && *desc.begin() == 999, "descending build mismatch");
+    return true;
+}
+
+bool TestFlatSet_ParallelBuildBenchmark() {
+    const size_t n = 20000000;
+    std::vector<uint64_t> keys(n);
+    for (size_t i = 0; i < n; i++) {
+        keys[i] = (static_cast<uint64_t>(rand()) << 31) ^ static_cast<uint64_t>(rand());
+    }
+    size_t hw = std::thread::hardware_concurrency();
+    std::cout << n << " keys, hardware threads: " << hw << std::endl;
+    size_t expect = 0;
+    for (size_t threads : {size_t(1), size_t(2), size_t(4), size_t(8)}) {
+        std::vector<uint64_t> copy(keys);
+        auto t0 = std::chrono::high_resolution_clock::now();
+        auto fs = toylib::flat_set_build_parallel(std::move(copy), threads);
+        auto t1 = std::chrono::high_resolution_clock::now();
+        if (threads == 1) expect = fs.size();
+        TOYTEST_ASSERT_EQ(fs.size(), expect, "size mismatch between thread counts");
+        std::cout << threads << " threads: " << std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count() << " ms" << std::endl;
+    }
+    return true;
+}
+
+bool TestFlatSet_ConstTest() {
+    flat_set<int> s;
+    for (int i = 0; i < 100; i += 3) {
+        s.insert(i);
+    }
+    const flat_set<int>& cs = s;
+    std::set<int> ref(cs.begin(), cs.end());
+    for (int k = -1; k <= 101; k++) {
+        TOYTEST_ASSERT(cs.lower_bound(k) - cs.begin() == std::distance(ref.begin(), ref.lower_bound(k)), "lower_bound mismatch");
+        TOYTEST_ASSERT(cs.upper_bound(k) - cs.begin() == std::distance(ref.begin(), ref.upper_bound(k)), "upper_bound mismatch");
+        auto er = cs.equal_range(k);
+        TOYTEST_ASSERT(er.first == cs.lower_bound(k) && er.second == cs.upper_bound(k), "equal_range mismatch");
+        TOYTEST_ASSERT_EQ(cs.contains(k), ref.count(k) == 1, "contains mismatch");
+        TOYTEST_ASSERT((cs.find(k) == cs.end()) == (ref.count(k) == 0), "const find mismatch");
+    }
+    // concurrent readers of one immutable set
+    std::vector<size_t> found(4, 0);
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 4; t++) {
+        readers.emplace_back([&cs, &found, t]() {
+            for (int r = 0; r < 200; r++) {
+                for (int k = 0; k < 100; k++) {
+                    found[t] += (cs.contains(k) && cs.find(k) != cs.end()) ? 1 : 0;
+                }
+            }
+        });
+    }
+    for (auto& th : readers) {
+        th.join();
+    }
+    for (size_t f : found) {
+        TOYTEST_ASSERT_EQ(f, 200 * ref.size(), "concurrent reader mismatch");
+    }
+    flat_set<std::string, std::less<>> ts;
+    ts.insert("alpha");
+    const auto& cts = ts;
+    TOYTEST_ASSERT(cts.contains("alpha") && !cts.contains("beta") && cts.find("alpha") != cts.end(), "transparent const lookups failed");
+    return true;
+}
+
 int main() {
     std::vector<std::string> passed, failed;
     RUN_TEST("FlatSet Simple Test", TestFlatSet_SimpleTest, passed, failed);
     RUN_TEST("FlatSet Sanity Test", TestFlatSet_SanityTest, passed, failed);
     RUN_TEST("FlatSet Hint Insert Test", TestFlatSet_HintInsertTest, passed, failed);
+    RUN_TEST("FlatSet Bulk Insert Test", TestFlatSet_BulkInsertTest, passed, failed);
+    RUN_TEST_TIMER("FlatSet Eytzinger Test", TestFlatSet_EytzingerTest, passed, failed);
+    RUN_TEST("FlatSet Fast Search Test", TestFlatSet_FastSearchTest, passed, failed);
+    RUN_TEST_TIMER("FlatSet Search Benchmark", TestFlatSet_SearchBenchmark, passed, failed);
+    RUN_TEST("FlatSet Set Algebra Test", TestFlatSet_SetAlgebraTest, passed, failed);
+    RUN_TEST("FlatSet Transparent Test", TestFlatSet_TransparentTest, passed, failed);
+    RUN_TEST("FlatSet Batch Test", TestFlatSet_BatchTest, passed, failed);
+    RUN_TEST("FlatSet Move Insert Test", TestFlatSet_MoveInsertTest, passed, failed);
+    RUN_TEST_TIMER("FlatSet Batch Benchmark", TestFlatSet_BatchBenchmark, passed, failed);
+    RUN_TEST("FlatSet Buffered Test", TestFlatSet_BufferedTest, passed, failed);
+    RUN_TEST_TIMER("FlatSet Buffered Benchmark", TestFlatSet_BufferedBenchmark, passed, failed);
+    RUN_TEST("FlatSet Const Test", TestFlatSet_ConstTest, passed, failed);
+    RUN_TEST("FlatSet Small Storage Test", TestFlatSet_SmallStorageTest, passed, failed);
+    RUN_TEST("FlatSet Frozen Test", TestFlatSet_FrozenTest, passed, failed);
+    RUN_TEST_TIMER("FlatSet Frozen Benchmark", TestFlatSet_FrozenBenchmark, passed, failed);
+    RUN_TEST("FlatSet Parallel Build Test", TestFlatSet_ParallelBuildTest, passed, failed);
+    RUN_TEST_TIMER("FlatSet Parallel Build Benchmark", TestFlatSet_ParallelBuildBenchmark, passed, failed);
+    RUN_TEST_TIMER("FlatSet Set Algebra Benchmark", TestFlatSet_SetAlgebraBenchmark, passed, failed);
     RUN_TEST_TIMER("FlatSet Benchmark Test", TestFlatSet_Benchmark, passed, failed);
 
     if (failed.empty()) {
@@ -3,8 +3,16 @@
 #include <iostream>
 #include <thread>
 #include <atomic>
+#include <set>
+#include <algorithm>
 
 using toylib::fixed_mem_pool;
+using toylib::static_mem_pool;
+using toylib::pooled_object;
+using toylib::cache_aligned_mem_pool;
+
+// constant-initialized, usable before main
+static static_mem_pool<8, 4> g_static_pool;
 
 bool TestMemPool_SimpleTest() {
     fixed_mem_pool<8, 32> pool(1);
@@ -235,6 +243,318 @@ bool TestMemPool_ExpandPressureTest() {
     return true;
 }
 
+bool TestMemPool_StaticPoolTest() {
+    // 静态池不依赖堆内存
+    auto p1 = g_static_pool.alloc();
+    auto p2 = g_static_pool.alloc();
+    auto p3 = g_static_pool.alloc();
+    auto p4 = g_static_pool.alloc();
+    TOYTEST_ASSERT(p1 && p2 && p3 && p4, "static pool should be able to alloc 4 items");
+    TOYTEST_ASSERT(!g_static_pool.alloc(), "static pool should be exhausted");
+    TOYTEST_ASSERT(reinterpret_cast<uintptr_t>(p1) % alignof(std::max_align_t) == 0, "storage is not aligned");
+
+    g_static_pool.free(p2);
+    auto p5 = g_static_pool.alloc();
+    TOYTEST_ASSERT(p5 == p2, "freed block should be reused");
+
+    g_static_pool.free(p1);
+    g_static_pool.free(p3);
+    g_static_pool.free(p4);
+    g_static_pool.free(p5);
+
+    // 局部对象
+    static_mem_pool<16, 32> pool;
+    TOYTEST_ASSERT_EQ(pool.capacity(), 32, "capacity mismatch");
+    std::vector<uint64_t*> ptrs;
+    for (int i = 0; i < 32; i++) {
+        auto p = pool.alloc_as<uint64_t>();
+        TOYTEST_ASSERT(p, "static pool alloc failed");
+        *p = i;
+        ptrs.push_back(p);
+    }
+    TOYTEST_ASSERT(!pool.alloc(), "static pool should be exhausted");
+    for (int i = 0; i < 32; i++) {
+        TOYTEST_ASSERT_EQ(*ptrs[i], static_cast<uint64_t>(i), "data corrupted");
+        pool.free(ptrs[i]);
+    }
+    for (int i = 0; i < 32; i++) {
+        TOYTEST_ASSERT(pool.alloc(), "static pool alloc after free failed");
+    }
+    return true;
+}
+
+bool TestMemPool_ForEachLiveTest() {
+    fixed_mem_pool<8, 1024> pool(2);   // 128 blocks per chunk, two bitmap words
+
+    // 没有存活对象
+    size_t visited = 0;
+    pool.for_each_live([&visited](char*) { visited++; });
+    TOYTEST_ASSERT_EQ(visited, 0, "empty pool should have no live blocks");
+
+    std::vector<char*> ptrs;
+    for (int i = 0; i < 300; i++) {     // spans a third chunk
+        auto p = pool.alloc(true);
+        *reinterpret_cast<uint64_t*>(p) = i;
+        ptrs.push_back(p);
+    }
+    // 释放偶数编号的对象
+    std::set<char*> expected;
+    for (int i = 0; i < 300; i++) {
+        if (i % 2 == 0) {
+            pool.free(ptrs[i]);
+        } else {
+            expected.insert(ptrs[i]);
+        }
+    }
+
+    std::vector<char*> seen;
+    pool.for_each_live([&seen](char* p) { seen.push_back(p); });
+    TOYTEST_ASSERT_EQ(seen.size(), expected.size(), "live block count mismatch");
+    for (size_t i = 0; i < seen.size(); i++) {
+        TOYTEST_ASSERT(expected.count(seen[i]), "visited block is not live");
+        TOYTEST_ASSERT(*reinterpret_cast<uint64_t*>(seen[i]) % 2 == 1, "visited block has wrong content");
+        if (i > 0) {
+            TOYTEST_ASSERT(seen[i - 1] < seen[i], "blocks should be visited in address order");
+        }
+    }
+
+    // 重新分配后应该再次可见
+    auto p = pool.alloc(false);
+    seen.clear();
+    pool.for_each_live([&seen](char* p) { seen.push_back(p); });
+    TOYTEST_ASSERT_EQ(seen.size(), expected.size() + 1, "reallocated block should be live");
+    TOYTEST_ASSERT(std::find(seen.begin(), seen.end(), p) != seen.end(), "reallocated block not visited");
+    return true;
+}
+
+bool TestMemPool_WarmUpTest() {
+    // 按字节数/对象数预分配
+    fixed_mem_pool<8, 32> by_bytes(toylib::prealloc_bytes(100));     // 4 chunks
+    for (int i = 0; i < 16; i++) {
+        TOYTEST_ASSERT(by_bytes.alloc(false), "pool preallocated by bytes is too small");
+    }
+    TOYTEST_ASSERT(!by_bytes.alloc(false), "pool preallocated by bytes is too large");
+
+    fixed_mem_pool<8, 32> by_objects(toylib::prealloc_objects(9));   // 3 chunks
+    for (int i = 0; i < 12; i++) {
+        TOYTEST_ASSERT(by_objects.alloc(false), "pool preallocated by objects is too small");
+    }
+    TOYTEST_ASSERT(!by_objects.alloc(false), "pool preallocated by objects is too large");
+
+    // warm up must keep live objects and free list intact
+    fixed_mem_pool<16, 3 * 4096 + 100> pool(2);
+    std::vector<uint64_t*> ptrs;
+    for (int i = 0; i < 100; i++) {
+        auto p = pool.alloc_as<uint64_t>();
+        *p = i;
+        ptrs.push_back(p);
+    }
+    TOYTEST_ASSERT(pool.warm_up(), "warm up without locking should succeed");
+    // locking may be refused by RLIMIT_MEMLOCK, only check it doesn't break anything
+    bool locked = pool.warm_up(true);
+    std::cout << "warm_up(true) " << (locked ? "locked pages" : "failed to lock pages") << std::endl;
+    for (int i = 0; i < 100; i++) {
+        TOYTEST_ASSERT_EQ(*ptrs[i], static_cast<uint64_t>(i), "warm up corrupted live object");
+        pool.free(ptrs[i]);
+    }
+    size_t allocated = 0;
+    while (pool.alloc(false)) {
+        allocated++;
+    }
+    TOYTEST_ASSERT_EQ(allocated, 2 * ((3 * 4096 + 100) / 16), "warm up corrupted free list");
+    return true;
+}
+
+bool TestMemPool_BulkTest() {
+    fixed_mem_pool<8, 32> pool(1);
+    char* ptrs[6];
+    TOYTEST_ASSERT_EQ(pool.alloc_bulk(ptrs, 6, false), 4, "bulk alloc should stop when exhausted");
+    TOYTEST_ASSERT_EQ(pool.alloc_bulk(ptrs + 4, 2, true), 2, "bulk alloc should expand pool");
+    std::set<char*> unique(ptrs, ptrs + 6);
+    TOYTEST_ASSERT_EQ(unique.size(), 6, "bulk alloc returned duplicated blocks");
+
+    pool.free_bulk(ptrs, 6);
+    size_t live = 0;
+    pool.for_each_live([&live](char*) { live++; });
+    TOYTEST_ASSERT_EQ(live, 0, "bulk free should release all blocks");
+    TOYTEST_ASSERT_EQ(pool.alloc_bulk(ptrs, 6, false), 6, "released blocks should be reusable");
+    return true;
+}
+
+struct PooledMessage : pooled_object<PooledMessage> {
+    uint64_t seq_;
+    uint32_t payload_[5];
+    explicit PooledMessage(uint64_t seq) : seq_(seq) {}
+};
+
+// larger derived type must not be carved from PooledMessage's blocks
+struct LargerMessage : PooledMessage {
+    char extra_[64];
+    explicit LargerMessage(uint64_t seq) : PooledMessage(seq) {}
+};
+
+// deletes its message from a static destructor, after the main thread's cache is gone
+struct StaticMessageHolder {
+    PooledMessage* msg_ = nullptr;
+    ~StaticMessageHolder() {
+        delete msg_;
+    }
+};
+static StaticMessageHolder static_holder;
+
+bool TestMemPool_PooledObjectTest() {
+    std::vector<PooledMessage*> msgs;
+    for (int i = 0; i < 1000; i++) {
+        msgs.push_back(new PooledMessage(i));
+    }
+    size_t live = 0;
+    PooledMessage::object_pool().for_each_live([&live](char*) { live++; });
+    TOYTEST_ASSERT(live >= 1000, "objects should be allocated from the pool");
+
+    std::set<PooledMessage*> pooled;
+    PooledMessage::object_pool().for_each_live([&pooled](char* p) {
+        pooled.insert(reinterpret_cast<PooledMessage*>(p));
+    });
+    for (int i = 0; i < 1000; i++) {
+        TOYTEST_ASSERT(pooled.count(msgs[i]), "object is not allocated from the pool");
+        TOYTEST_ASSERT_EQ(msgs[i]->seq_, static_cast<uint64_t>(i), "object data corrupted");
+        delete msgs[i];
+    }
+
+    PooledMessage* larger = new LargerMessage(7);
+    TOYTEST_ASSERT(!pooled.count(larger), "larger derived type should use global operator new");
+    delete static_cast<LargerMessage*>(larger);
+
+    // 多线程new/delete，包括跨线程释放
+    const int threads = 8;
+    const int rounds = 2000;
+    std::atomic_bool start{false};
+    std::vector<std::vector<PooledMessage*>> handoff(threads);
+    std::vector<char> results(threads, 0);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&, t]() {
+            bool good = true;
+            while (!start);
+            std::vector<PooledMessage*> held;
+            for (int r = 0; r < rounds; r++) {
+                held.push_back(new PooledMessage(t * rounds + r));
+                if (held.size() == 64) {
+                    for (auto m : held) {
+                        good = good && m->seq_ / rounds == static_cast<uint64_t>(t);
+                        delete m;
+                    }
+                    held.clear();
+                }
+            }
+            handoff[t] = held;
+            results[t] = good;
+        });
+    }
+    start.store(true);
+    for (auto& w : workers) {
+        w.join();
+    }
+    for (int t = 0; t < threads; t++) {
+        TOYTEST_ASSERT(results[t], "pooled object corrupted in thread " + std::to_string(t));
+        // freed by another thread
+        for (auto m : handoff[t]) {
+            delete m;
+        }
+    }
+
+    // blocks cached by a thread go back to the pool when it exits
+    size_t live_before = PooledMessage::object_pool().stats().live_;
+    std::thread([]() {
+        std::vector<PooledMessage*> held;
+        for (int i = 0; i < 100; i++) {
+            held.push_back(new PooledMessage(i));
+        }
+        for (auto m : held) {
+            delete m;
+        }
+    }).join();
+    TOYTEST_ASSERT_EQ(PooledMessage::object_pool().stats().live_, live_before, "thread cache is not flushed at thread exit");
+    static_holder.msg_ = new PooledMessage(42);
+    return true;
+}
+
+bool TestMemPool_StatsTest() {
+    fixed_mem_pool<8, 32> pool(2);
+    auto st = pool.stats();
+    TOYTEST_ASSERT_EQ(st.chunks_, 2, "chunks count mismatch");
+    TOYTEST_ASSERT_EQ(st.capacity_, 8, "capacity mismatch");
+    TOYTEST_ASSERT_EQ(st.live_, 0, "live count mismatch");
+
+    std::vector<char*> ptrs;
+    for (int i = 0; i < 10; i++) {  // third chunk is allocated
+        ptrs.push_back(pool.alloc());
+    }
+    pool.free(ptrs[9]);
+    pool.free(ptrs[8]);
+    pool.free(ptrs[0]);
+    st = pool.stats();
+    TOYTEST_ASSERT_EQ(st.allocs_, 10, "allocs count mismatch");
+    TOYTEST_ASSERT_EQ(st.frees_, 3, "frees count mismatch");
+    TOYTEST_ASSERT_EQ(st.live_, 7, "live count mismatch");
+    TOYTEST_ASSERT_EQ(st.peak_live_, 10, "peak live count mismatch");
+    TOYTEST_ASSERT_EQ(st.chunks_, 3, "chunks count mismatch");
+    TOYTEST_ASSERT_EQ(st.capacity_, 12, "capacity mismatch");
+
+    auto occupancy = pool.chunk_occupancy();
+    TOYTEST_ASSERT_EQ(occupancy.size(), 3, "chunk occupancy size mismatch");
+    size_t sum = 0;
+    for (size_t o : occupancy) {
+        TOYTEST_ASSERT(o <= 4, "chunk occupancy too large");
+        sum += o;
+    }
+    TOYTEST_ASSERT_EQ(sum, 7, "chunk occupancy sum mismatch");
+
+    // chunk占用分别为3/4、满、空
+    auto hist = pool.occupancy_histogram(4);
+    TOYTEST_ASSERT_EQ(hist.size(), 4, "histogram size mismatch");
+    TOYTEST_ASSERT_EQ(hist[3], 2, "full and 3/4 used chunks should be in the last bucket");
+    TOYTEST_ASSERT_EQ(hist[0], 1, "empty chunk should be in the first bucket");
+
+    size_t total = 0;
+    for (size_t h : pool.occupancy_histogram()) {
+        total += h;
+    }
+    TOYTEST_ASSERT_EQ(total, 3, "histogram should count every chunk");
+    return true;
+}
+
+bool TestMemPool_AlignedTest() {
+    const size_t line = toylib::DEFAULT_CACHE_LINE_WIDTH;
+    cache_aligned_mem_pool<24, 1024> pool(1);
+    std::vector<char*> ptrs;
+    while (char* p = pool.alloc(false)) {
+        TOYTEST_ASSERT_EQ(reinterpret_cast<uintptr_t>(p) % line, 0, "block is not aligned to cache line");
+        ptrs.push_back(p);
+    }
+    TOYTEST_ASSERT_EQ(ptrs.size(), 1024 / line, "each block should take a whole cache line");
+    std::sort(ptrs.begin(), ptrs.end());
+    for (size_t i = 1; i < ptrs.size(); i++) {
+        TOYTEST_ASSERT(ptrs[i] - ptrs[i - 1] >= static_cast<ptrdiff_t>(line), "blocks share a cache line");
+    }
+    for (char* p : ptrs) {
+        pool.free(p);
+    }
+
+    // alignment larger than new[] guarantees, chunk base must still be aligned
+    fixed_mem_pool<40, 4096, 256> wide(3);
+    struct alignas(256) Wide {
+        char data[40];
+    };
+    for (int i = 0; i < 48; i++) {
+        Wide* w = wide.alloc_as<Wide>();
+        TOYTEST_ASSERT(w, "aligned pool alloc failed");
+        TOYTEST_ASSERT_EQ(reinterpret_cast<uintptr_t>(w) % 256, 0, "block is not aligned to 256 bytes");
+    }
+    TOYTEST_ASSERT(!wide.alloc(false), "3 chunks should hold 48 blocks of 256 bytes");
+    return true;
+}
+
 int main() {
     std::vector<std::string> passed, failed;
     RUN_TEST("MemPool_SimpleTest", TestMemPool_SimpleTest, passed, failed);
@@ -243,6 +563,13 @@ int main() {
     RUN_TEST("MemPool_NonfixedTest", TestMemPool_NonfixedTest, passed, failed);
     RUN_TEST_TIMER("MemPool_ConcurrentTest", TestMemPool_ConcurrentTest, passed, failed);
     RUN_TEST_TIMER("MemPool_ExpandPressureTest", TestMemPool_ExpandPressureTest, passed, failed);
+    RUN_TEST("MemPool_StaticPoolTest", TestMemPool_StaticPoolTest, passed, failed);
+    RUN_TEST("MemPool_ForEachLiveTest", TestMemPool_ForEachLiveTest, passed, failed);
+    RUN_TEST("MemPool_WarmUpTest", TestMemPool_WarmUpTest, passed, failed);
+    RUN_TEST("MemPool_BulkTest", TestMemPool_BulkTest, passed, failed);
+    RUN_TEST("MemPool_StatsTest", TestMemPool_StatsTest, passed, failed);
+    RUN_TEST("MemPool_AlignedTest", TestMemPool_AlignedTest, passed, failed);
+    RUN_TEST_TIMER("MemPool_PooledObjectTest", TestMemPool_PooledObjectTest, passed, failed);
 
     if (failed.empty()) {
         std::cout << "All tests passed!" << std::endl;
@@ -0,0 +1,199 @@
+#include "../include/PackedMemoryArray.hpp"
+#include "../include/FlatSet.hpp"
+#include "../include/ToyTest.hpp"
+#include <iostream>
+#include <chrono>
+#include <set>
+#include <string>
+#include <vector>
+#include <random>
+#include <algorithm>
+
+using toylib::pma_set;
+
+bool TestPMA_SimpleTest() {
+    pma_set<int> s;
+    TOYTEST_ASSERT(s.empty() && s.begin() == s.end(), "new set should be empty");
+    TOYTEST_ASSERT(s.insert(5).second, "insert failed");
+    TOYTEST_ASSERT(!s.insert(5).second, "duplicate insert should fail");
+    TOYTEST_ASSERT_EQ(*s.insert(3).first, 3, "insert returned wrong iterator");
+    TOYTEST_ASSERT_EQ(s.count(5), 1, "count failed");
+    TOYTEST_ASSERT_EQ(s.count(4), 0, "count found missing key");
+    TOYTEST_ASSERT_EQ(s.erase(5), 1, "erase failed");
+    TOYTEST_ASSERT_EQ(s.erase(5), 0, "erase removed missing key");
+    TOYTEST_ASSERT_EQ(s.size(), 1, "size mismatch");
+    return true;
+}
+
+bool TestPMA_SanityTest() {
+    std::mt19937 rng(3);
+    // ascending, descending and random orders hit different rebalancing patterns
+    for (int order = 0; order < 3; order++) {
+        pma_set<int> s;
+        std::set<int> ref;
+        for (int i = 0; i < 50000; i++) {
+            int k = order == 0 ? i : (order == 1 ? -i : static_cast<int>(rng() % 100000));
+            auto r = s.insert(k);
+            TOYTEST_ASSERT_EQ(r.second, ref.insert(k).second, "insert result mismatch");
+            TOYTEST_ASSERT_EQ(*r.first, k, "insert returned wrong iterator");
+        }
+        TOYTEST_ASSERT_EQ(s.size(), ref.size(), "size mismatch");
+        TOYTEST_ASSERT(std::equal(s.begin(), s.end(), ref.begin(), ref.end()), "iteration is not sorted");
+        TOYTEST_ASSERT(s.capacity() < 4 * ref.size() + 64, "too many gaps");
+        for (int i = 0; i < 20000; i++) {
+            int k = static_cast<int>(rng() % 100000) - (order == 1 ? 50000 : 0);
+            TOYTEST_ASSERT_EQ(s.count(k), ref.count(k), "count mismatch");
+            auto it = s.find(k);
+            TOYTEST_ASSERT((it != s.end()) == (ref.count(k) == 1), "find mismatch");
+            if (it != s.end()) {
+                TOYTEST_ASSERT_EQ(*it, k, "find returned wrong element");
+            }
+        }
+        // erase most keys, the array shrinks
+        std::vector<int> keys(ref.begin(), ref.end());
+        std::shuffle(keys.begin(), keys.end(), rng);
+        for (size_t i = 0; i < keys.size() * 9 / 10; i++) {
+            TOYTEST_ASSERT_EQ(s.erase(keys[i]), 1, "erase failed");
+            ref.erase(keys[i]);
+        }
+        TOYTEST_ASSERT(std::equal(s.begin(), s.end(), ref.begin(), ref.end()), "contents mismatch after erase");
+        TOYTEST_ASSERT(s.capacity() <= 16 * ref.size() + 64, "array didn't shrink");
+        // and grows again
+        for (int i = 0; i < 10000; i++) {
+            int k = static_cast<int>(rng() % 100000);
+            TOYTEST_ASSERT_EQ(s.insert(k).second, ref.insert(k).second, "insert after erase mismatch");
+        }
+        TOYTEST_ASSERT(std::equal(s.begin(), s.end(), ref.begin(), ref.end()), "contents mismatch after reinsertion");
+    }
+
+    // erasing a contiguous range empties whole segments, lookups around the hole must still work
+    {
+        pma_set<int> s;
+        std::set<int> ref;
+        for (int i = 0; i < 100000; i++) {
+            s.insert(i);
+            ref.insert(i);
+        }
+        for (int i = 20000; i < 70000; i++) {
+            TOYTEST_ASSERT_EQ(s.erase(i), 1, "range erase failed");
+            ref.erase(i);
+        }
+        for (int i = 0; i < 100000; i += 7) {
+            TOYTEST_ASSERT_EQ(s.count(i), ref.count(i), "count mismatch after range erase");
+        }
+        for (int i = 30000; i < 40000; i++) {
+            TOYTEST_ASSERT(s.insert(i).second && *s.find(i) == i, "insert into the erased range failed");
+            ref.insert(i);
+        }
+        for (int i = 99999; i >= 90000; i--) {
+            s.erase(i);
+            ref.erase(i);
+        }
+        TOYTEST_ASSERT(std::equal(s.begin(), s.end(), ref.begin(), ref.end()), "contents mismatch after range erase");
+        for (int i = -1; i <= 100000; i += 3) {
+            TOYTEST_ASSERT_EQ(s.count(i), ref.count(i), "count mismatch after reinsertion");
+        }
+    }
+
+    pma_set<std::string> ss;
+    for (int i = 0; i < 1000; i++) {
+        std::string k = std::to_string(i * 7919 % 1000);
+        ss.insert(std::move(k));
+    }
+    TOYTEST_ASSERT_EQ(ss.size(), 1000, "string set size mismatch");
+    TOYTEST_ASSERT(std::is_sorted(ss.begin(), ss.end()), "string set is not sorted");
+    return true;
+}
+
+// random inserts, lookups and a full scan against flat_set (vector backend) and std::set
+bool TestPMA_Benchmark() {
+    std::mt19937 rng(5);
+    for (int n : {100000, 1000000}) {
+        std::vector<int> keys(n), queries(n);
+        for (int i = 0; i < n; i++) {
+            keys[i] = static_cast<int>(rng());
+            queries[i] = keys[rng() % n];
+        }
+        pma_set<int> ps;
+        toylib::flat_set<int> fs;
+        std::set<int> ss;
+        long long insert_ms[3] = {-1, -1, -1}, lookup_ms[3], scan_ms[3];
+        size_t found[3] = {0, 0, 0};
+        long long sums[3] = {0, 0, 0};
+
+        auto t0 = std::chrono::high_resolution_clock::now();
+        for (int k : keys) ps.insert(k);
+        auto t1 = std::chrono::high_resolution_clock::now();
+        for (int q : queries) found[0] += ps.count(q);
+        auto t2 = std::chrono::high_resolution_clock::now();
+        for (int k : ps) sums[0] += k;
+        auto t3 = std::chrono::high_resolution_clock::now();
+        insert_ms[0] = std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count();
+        lookup_ms[0] = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count();
+        scan_ms[0] = std::chrono::duration_cast<std::chrono::microseconds>(t3 - t2).count();
+
+        // flat_set's O(n) shifting is too slow for one million random inserts, build it in bulk there
+        t0 = std::chrono::high_resolution_clock::now();
+        if (n <= 100000) {
+            for (int k : keys) fs.insert(k);
+        } else {
+            fs.insert(keys.begin(), keys.end());
+        }
+        t1 = std::chrono::high_resolution_clock::now();
+        for (int q : queries) found[1] += fs.count(q);
+        t2 = std::chrono::high_resolution_clock::now();
+        for (int k : fs) sums[1] += k;
+        t3 = std::chrono::high_resolution_clock::now();
+        if (n <= 100000) insert_ms[1] = std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count();
+        lookup_ms[1] = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count();
+        scan_ms[1] = std::chrono::duration_cast<std::chrono::microseconds>(t3 - t2).count();
+
+        t0 = std::chrono::high_resolution_clock::now();
+        for (int k : keys) ss.insert(k);
+        t1 = std::chrono::high_resolution_clock::now();
+        for (int q : queries) found[2] += ss.count(q);
+        t2 = std::chrono::high_resolution_clock::now();
+        for (int k : ss) sums[2] += k;
+        t3 = std::chrono::high_resolution_clock::now();
+        insert_ms[2] = std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count();
+        lookup_ms[2] = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count();
+        scan_ms[2] = std::chrono::duration_cast<std::chrono::microseconds>(t3 - t2).count();
+
+        TOYTEST_ASSERT(found[0] == found[1] && found[1] == found[2], "lookup results mismatch");
+        TOYTEST_ASSERT(sums[0] == sums[1] && sums[1] == sums[2], "scan results mismatch");
+        const char* names[3] = {"pma_set ", "flat_set", "std::set"};
+        std::cout << n << " random keys\t insert ms \\ lookup ms \\ scan us" << std::endl;
+        for (int i = 0; i < 3; i++) {
+            std::cout << names[i] << "\t " << (insert_ms[i] < 0 ? std::string("-") : std::to_string(insert_ms[i]))
+                      << " \\ " << lookup_ms[i] << " \\ " << scan_ms[i] << std::endl;
+        }
+    }
+    return true;
+}
+
+int main() {
+    std::vector<std::string> passed, failed;
+    RUN_TEST("PMA_SimpleTest", TestPMA_SimpleTest, passed, failed);
+    RUN_TEST_TIMER("PMA_SanityTest", TestPMA_SanityTest, passed, failed);
+    RUN_TEST_TIMER("PMA_Benchmark", TestPMA_Benchmark, passed, failed);
+
+    if (failed.empty()) {
+        std::cout << "All tests passed!" << std::endl;
+        return 0;
+    } else {
+        std::cout << "Some tests failed!" << std::endl;
+        std::cout << "Passed tests: ";
+        for (const auto& name : passed) {
+            std::cout << name << " ";
+        }
+        std::cout << std::endl;
+
+        std::cout << "Failed tests: ";
+        for (const auto& name : failed) {
+            std::cout << name << " ";
+        }
+        std::cout << std::endl;
+
+        return 1;
+    }
+}
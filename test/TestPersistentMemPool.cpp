@@ -0,0 +1,230 @@
+#include "../include/PersistentMemPool.hpp"
+#include "../include/ToyTest.hpp"
+#include <iostream>
+#include <set>
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <csignal>
+#include <sys/wait.h>
+
+using toylib::persistent_mem_pool;
+using toylib::offset_ptr;
+
+struct ListNode {
+    offset_ptr<ListNode> next_;
+    uint64_t seq_;
+    uint64_t check_;    // seq_ * 31 + 7, detects partially written nodes
+};
+
+// list head and tail, stored inside the pool as root object
+struct ListRoot {
+    offset_ptr<ListNode> head_;
+    offset_ptr<ListNode> tail_;
+};
+
+using list_pool = persistent_mem_pool<32, 4096>;
+
+static std::string TestFilePath(const char* name) {
+    return std::string("/tmp/toylib_") + name + "_" + std::to_string(getpid()) + ".pool";
+}
+
+bool TestPersistentMemPool_OffsetPtrTest() {
+    ListNode nodes[2];
+    nodes[0].next_ = &nodes[1];
+    nodes[1].next_ = nullptr;
+    TOYTEST_ASSERT(nodes[0].next_.get() == &nodes[1], "offset_ptr get mismatch");
+    TOYTEST_ASSERT(!nodes[1].next_, "null offset_ptr should be false");
+
+    // 复制后仍指向同一个目标
+    offset_ptr<ListNode> copy = nodes[0].next_;
+    TOYTEST_ASSERT(copy == nodes[0].next_, "copied offset_ptr should point to the same target");
+    nodes[1].seq_ = 42;
+    TOYTEST_ASSERT_EQ(copy->seq_, 42, "offset_ptr dereference failed");
+    return true;
+}
+
+bool TestPersistentMemPool_ReopenTest() {
+    std::string path = TestFilePath("reopen");
+    unlink(path.c_str());
+    std::vector<uint64_t> offsets;
+    {
+        list_pool pool(path, 16);
+        auto root = pool.alloc_as<ListRoot>();
+        new (root) ListRoot();
+        pool.set_root(root);
+        for (uint64_t i = 0; i < 300; i++) {   // 128 blocks per chunk, grows the file
+            auto node = pool.alloc_as<ListNode>();
+            node->seq_ = i;
+            node->check_ = i * 31 + 7;
+            node->next_ = nullptr;
+            if (root->tail_) {
+                root->tail_->next_ = node;
+            } else {
+                root->head_ = node;
+            }
+            root->tail_ = node;
+            offsets.push_back(pool.to_offset(node));
+        }
+        TOYTEST_ASSERT_EQ(pool.chunks_count(), 3, "pool should grow to 3 chunks");
+        TOYTEST_ASSERT(pool.sync(), "sync failed");
+    }
+    {
+        // 第二个实例通常映射到不同地址
+        list_pool pool(path, 16);
+        auto root = pool.root<ListRoot>();
+        TOYTEST_ASSERT(root, "root lost after reopen");
+        uint64_t seq = 0;
+        for (auto node = root->head_.get(); node; node = node->next_.get()) {
+            TOYTEST_ASSERT_EQ(node->seq_, seq, "list order broken after reopen");
+            TOYTEST_ASSERT_EQ(pool.to_offset(node), offsets[seq], "object moved after reopen");
+            seq++;
+        }
+        TOYTEST_ASSERT_EQ(seq, 300, "list length mismatch after reopen");
+
+        // 剩余的空闲块不应与存活对象重叠
+        std::set<uint64_t> live(offsets.begin(), offsets.end());
+        live.insert(pool.to_offset(root));
+        size_t free_blocks = 0;
+        while (char* p = pool.alloc(false)) {
+            TOYTEST_ASSERT(!live.count(pool.to_offset(p)), "free list overlaps live objects");
+            free_blocks++;
+        }
+        TOYTEST_ASSERT_EQ(free_blocks, 3 * 128 - 301, "free block count mismatch");
+    }
+    {
+        // layout mismatch
+        bool thrown = false;
+        try {
+            persistent_mem_pool<64, 4096> other(path, 16);
+        } catch (const std::runtime_error&) {
+            thrown = true;
+        }
+        TOYTEST_ASSERT(thrown, "opening with a different layout should throw");
+    }
+    unlink(path.c_str());
+    return true;
+}
+
+// child keeps appending to the tail and popping from the head until it is killed
+static void CrashChild(const std::string& path) {
+    list_pool pool(path, 64);
+    auto root = pool.root<ListRoot>();
+    if (!root) {
+        root = pool.alloc_as<ListRoot>();
+        new (root) ListRoot();
+        pool.set_root(root);
+    }
+    uint64_t seq = root->tail_ ? root->tail_->seq_ + 1 : 0;
+    size_t len = 0;
+    for (auto node = root->head_.get(); node; node = node->next_.get()) {
+        len++;
+    }
+    while (true) {
+        auto node = pool.alloc_as<ListNode>();
+        node->seq_ = seq;
+        node->check_ = seq * 31 + 7;
+        node->next_ = nullptr;
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+        // publish the new node after it is fully written
+        if (root->tail_) {
+            root->tail_->next_ = node;
+        } else {
+            root->head_ = node;
+        }
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+        root->tail_ = node;
+        seq++;
+        len++;
+
+        // keep the list bounded so the pool is never exhausted
+        while (len > 1000 || (len > 1 && seq % 3 == 0)) {
+            // unlink before free, a crash in between only leaks the node
+            ListNode* old = root->head_.get();
+            root->head_ = old->next_;
+            std::atomic_signal_fence(std::memory_order_seq_cst);
+            pool.free(old);
+            len--;
+            if (seq % 3 == 0) break;
+        }
+    }
+}
+
+bool TestPersistentMemPool_CrashTest() {
+    std::string path = TestFilePath("crash");
+    unlink(path.c_str());
+    srand(12345);
+    for (int round = 0; round < 20; round++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            CrashChild(path);
+            _exit(0);
+        }
+        usleep(2000 + rand() % 20000);
+        kill(pid, SIGKILL);
+        int status;
+        waitpid(pid, &status, 0);
+
+        // 重新映射并检查结构
+        list_pool pool(path, 64);
+        auto root = pool.root<ListRoot>();
+        if (!root) {
+            continue;   // killed before the root was published
+        }
+        std::set<ListNode*> live;
+        live.insert(reinterpret_cast<ListNode*>(root));
+        uint64_t prev = 0;
+        bool first = true;
+        ListNode* last = nullptr;
+        for (auto node = root->head_.get(); node; node = node->next_.get()) {
+            TOYTEST_ASSERT_EQ(node->check_, node->seq_ * 31 + 7, "partially written node is reachable");
+            TOYTEST_ASSERT(first || node->seq_ == prev + 1, "list is broken after crash");
+            TOYTEST_ASSERT(!live.count(node), "list has a cycle after crash");
+            live.insert(node);
+            prev = node->seq_;
+            first = false;
+            last = node;
+        }
+        // tail may lag one node behind if killed between the two publish steps
+        TOYTEST_ASSERT(!root->tail_ || root->tail_.get() == last || root->tail_->next_.get() == last, "tail is inconsistent after crash");
+
+        // free list must not hand out reachable nodes, put blocks back afterwards
+        std::vector<char*> taken;
+        while (char* p = pool.alloc(false)) {
+            TOYTEST_ASSERT(!live.count(reinterpret_cast<ListNode*>(p)), "free list overlaps live objects after crash");
+            taken.push_back(p);
+        }
+        for (char* p : taken) {
+            pool.free(p);
+        }
+    }
+    unlink(path.c_str());
+    return true;
+}
+
+int main() {
+    std::vector<std::string> passed, failed;
+    RUN_TEST("PersistentMemPool_OffsetPtrTest", TestPersistentMemPool_OffsetPtrTest, passed, failed);
+    RUN_TEST("PersistentMemPool_ReopenTest", TestPersistentMemPool_ReopenTest, passed, failed);
+    RUN_TEST_TIMER("PersistentMemPool_CrashTest", TestPersistentMemPool_CrashTest, passed, failed);
+
+    if (failed.empty()) {
+        std::cout << "All tests passed!" << std::endl;
+        return 0;
+    } else {
+        std::cout << "Some tests failed!" << std::endl;
+        std::cout << "Passed tests: ";
+        for (const auto& name : passed) {
+            std::cout << name << " ";
+        }
+        std::cout << std::endl;
+
+        std::cout << "Failed tests: ";
+        for (const auto& name : failed) {
+            std::cout << name << " ";
+        }
+        std::cout << std::endl;
+
+        return 1;
+    }
+}
@@ -0,0 +1,136 @@
+#include "../include/SmallVector.hpp"
+#include "../include/ToyTest.hpp"
+#include <iostream>
+#include <vector>
+#include <string>
+#include <random>
+#include <algorithm>
+
+using toylib::small_vector;
+
+// counts live objects, so leaks and double destruction show up
+struct Counted {
+    static int live;
+    std::string s_;
+    Counted() : s_("default") {
+        live++;
+    }
+    Counted(const std::string& s) : s_(s) {
+        live++;
+    }
+    Counted(const Counted& o) : s_(o.s_) {
+        live++;
+    }
+    Counted(Counted&& o) noexcept : s_(std::move(o.s_)) {
+        live++;
+    }
+    Counted& operator=(const Counted& o) = default;
+    Counted& operator=(Counted&& o) noexcept = default;
+    ~Counted() {
+        live--;
+    }
+    bool operator==(const Counted& o) const {
+        return s_ == o.s_;
+    }
+};
+int Counted::live = 0;
+
+bool TestSmallVector_SimpleTest() {
+    small_vector<int, 4> v;
+    TOYTEST_ASSERT(v.empty() && v.inlined() && v.capacity() == 4, "new vector should be empty and inline");
+    for (int i = 0; i < 4; i++) {
+        v.push_back(i);
+    }
+    TOYTEST_ASSERT(v.inlined(), "4 elements should fit inline");
+    v.push_back(4);
+    TOYTEST_ASSERT(!v.inlined() && v.size() == 5, "5th element should spill to the heap");
+    v.insert(v.begin(), -1);
+    v.erase(v.begin() + 2);
+    int expect[] = {-1, 0, 2, 3, 4};
+    TOYTEST_ASSERT(std::equal(v.begin(), v.end(), std::begin(expect), std::end(expect)), "content mismatch");
+    v.erase(v.begin() + 1, v.end());
+    v.shrink_to_fit();
+    TOYTEST_ASSERT(v.inlined() && v.size() == 1 && v[0] == -1, "shrink_to_fit should move back inline");
+    return true;
+}
+
+bool TestSmallVector_SanityTest() {
+    std::mt19937 rng(7);
+    {
+        small_vector<Counted, 3> v;
+        std::vector<Counted> ref;
+        for (int i = 0; i < 20000; i++) {
+            int op = static_cast<int>(rng() % 6);
+            std::string s = std::to_string(i);
+            size_t pos = ref.empty() ? 0 : rng() % (ref.size() + 1);
+            if (op <= 1) {
+                v.insert(v.begin() + pos, Counted(s));
+                ref.insert(ref.begin() + pos, Counted(s));
+            } else if (op == 2) {
+                v.emplace_back(s);
+                ref.emplace_back(s);
+            } else if (op == 3 && !ref.empty()) {
+                pos = rng() % ref.size();
+                v.erase(v.begin() + pos);
+                ref.erase(ref.begin() + pos);
+            } else if (op == 4 && !ref.empty()) {
+                // an element of the vector itself, may move while inserting
+                v.insert(v.begin() + pos, v[0]);
+                ref.insert(ref.begin() + pos, ref[0]);
+            } else if (op == 5 && ref.size() > 8) {
+                size_t n = rng() % (ref.size() - 4);
+                v.erase(v.begin() + 2, v.begin() + 2 + n);
+                ref.erase(ref.begin() + 2, ref.begin() + 2 + n);
+            }
+            TOYTEST_ASSERT_EQ(v.size(), ref.size(), "size mismatch");
+        }
+        TOYTEST_ASSERT(std::equal(v.begin(), v.end(), ref.begin(), ref.end()), "content mismatch");
+
+        // copies and moves, inline and spilled
+        small_vector<Counted, 3> copy(v);
+        TOYTEST_ASSERT(copy == v, "copy mismatch");
+        small_vector<Counted, 3> moved(std::move(copy));
+        TOYTEST_ASSERT(moved == v && copy.empty(), "move mismatch");
+        small_vector<Counted, 3> small = {Counted("a"), Counted("b")};
+        small_vector<Counted, 3> small_moved(std::move(small));
+        TOYTEST_ASSERT(small_moved.inlined() && small_moved.size() == 2 && small_moved[1].s_ == "b", "inline move mismatch");
+        small_moved = v;
+        TOYTEST_ASSERT(small_moved == v, "copy assignment mismatch");
+        small_moved.swap(moved);
+        TOYTEST_ASSERT(small_moved == v && moved == v, "swap mismatch");
+        moved = std::move(small_moved);
+        small_moved.insert(small_moved.end(), ref.begin(), ref.begin() + 2);
+        small_moved.insert(small_moved.begin() + 1, ref.begin(), ref.begin() + 5);
+        std::vector<Counted> expect = {ref[0], ref[0], ref[1], ref[2], ref[3], ref[4], ref[1]};
+        TOYTEST_ASSERT(std::equal(small_moved.begin(), small_moved.end(), expect.begin(), expect.end()), "range insert mismatch");
+        ref.clear();
+    }
+    TOYTEST_ASSERT_EQ(Counted::live, 0, "leaked or double destroyed elements");
+    return true;
+}
+
+int main() {
+    std::vector<std::string> passed, failed;
+    RUN_TEST("SmallVector_SimpleTest", TestSmallVector_SimpleTest, passed, failed);
+    RUN_TEST("SmallVector_SanityTest", TestSmallVector_SanityTest, passed, failed);
+
+    if (failed.empty()) {
+        std::cout << "All tests passed!" << std::endl;
+        return 0;
+    } else {
+        std::cout << "Some tests failed!" << std::endl;
+        std::cout << "Passed tests: ";
+        for (const auto& name : passed) {
+            std::cout << name << " ";
+        }
+        std::cout << std::endl;
+
+        std::cout << "Failed tests: ";
+        for (const auto& name : failed) {
+            std::cout << name << " ";
+        }
+        std::cout << std::endl;
+
+        return 1;
+    }
+}
@@ -0,0 +1,194 @@
+#include "../include/TLSFAllocator.hpp"
+#include "../include/ToyTest.hpp"
+#include <iostream>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <functional>
+
+using toylib::tlsf_allocator;
+
+bool TestTLSF_SimpleTest() {
+    tlsf_allocator alloc(1 << 20);
+    auto p = static_cast<uint64_t*>(alloc.allocate(sizeof(uint64_t)));
+    TOYTEST_ASSERT(p, "allocate failed");
+    *p = 0x1234;
+    TOYTEST_ASSERT_EQ(*p, 0x1234, "value mismatch");
+    alloc.deallocate(p);
+    return true;
+}
+
+bool TestTLSF_SanityTest() {
+    // 调用方提供的内存
+    std::vector<char> region(64 * 1024 + 7);
+    tlsf_allocator alloc(region.data() + 3, 64 * 1024);
+
+    std::vector<char*> ptrs;
+    size_t sizes[] = {1, 15, 16, 17, 100, 511, 512, 513, 1000, 4096};
+    for (size_t sz : sizes) {
+        char* p = static_cast<char*>(alloc.allocate(sz));
+        TOYTEST_ASSERT(p, "allocate failed for size " + std::to_string(sz));
+        TOYTEST_ASSERT_EQ(reinterpret_cast<uintptr_t>(p) % 16, 0, "allocation is not 16-byte aligned");
+        TOYTEST_ASSERT(tlsf_allocator::usable_size(p) >= sz, "usable size smaller than requested");
+        TOYTEST_ASSERT(p >= region.data() && p + sz <= region.data() + region.size(), "allocation outside of region");
+        memset(p, static_cast<int>(sz & 0xff), sz);
+        ptrs.push_back(p);
+    }
+    for (size_t i = 0; i < ptrs.size(); i++) {
+        for (size_t j = 0; j < sizes[i]; j++) {
+            TOYTEST_ASSERT_EQ(static_cast<unsigned char>(ptrs[i][j]), sizes[i] & 0xff, "allocations overlap");
+        }
+    }
+
+    // 区域不够大时返回nullptr
+    TOYTEST_ASSERT(!alloc.allocate(1 << 20), "oversized allocation should fail");
+
+    // 全部释放后相邻块应合并，可以再分配接近整个区域的大块
+    std::reverse(ptrs.begin(), ptrs.end());
+    std::swap(ptrs[1], ptrs[4]);
+    for (char* p : ptrs) {
+        alloc.deallocate(p);
+    }
+    void* big = alloc.allocate(60 * 1024);
+    TOYTEST_ASSERT(big, "freed blocks are not coalesced");
+    alloc.deallocate(big);
+
+    // 填满后释放再填满
+    std::vector<void*> small;
+    while (void* p = alloc.allocate(48)) {
+        small.push_back(p);
+    }
+    size_t count = small.size();
+    TOYTEST_ASSERT(count > 900, "too much overhead for small blocks");
+    for (size_t i = 0; i < small.size(); i += 2) {
+        alloc.deallocate(small[i]);
+    }
+    for (size_t i = 1; i < small.size(); i += 2) {
+        alloc.deallocate(small[i]);
+    }
+    small.clear();
+    while (void* p = alloc.allocate(48)) {
+        small.push_back(p);
+    }
+    TOYTEST_ASSERT_EQ(small.size(), count, "blocks leaked after free");
+
+    // 追加区域
+    std::vector<char> region2(4096);
+    TOYTEST_ASSERT(alloc.add_region(region2.data(), region2.size()), "add_region failed");
+    TOYTEST_ASSERT(alloc.allocate(2048), "allocation from added region failed");
+    return true;
+}
+
+bool TestTLSF_RandomTest() {
+    tlsf_allocator alloc(16 << 20);
+    std::mt19937 rng(42);
+    struct slot {
+        unsigned char* ptr_;
+        size_t size_;
+        unsigned char tag_;
+    };
+    std::vector<slot> slots(2000, slot{nullptr, 0, 0});
+    for (int op = 0; op < 200000; op++) {
+        slot& s = slots[rng() % slots.size()];
+        if (s.ptr_) {
+            for (size_t i = 0; i < s.size_; i += 61) {
+                TOYTEST_ASSERT_EQ(s.ptr_[i], s.tag_, "block content corrupted");
+            }
+            alloc.deallocate(s.ptr_);
+            s.ptr_ = nullptr;
+        } else {
+            s.size_ = 1 + rng() % (rng() % 2 ? 256 : 16384);
+            s.ptr_ = static_cast<unsigned char*>(alloc.allocate(s.size_));
+            TOYTEST_ASSERT(s.ptr_, "allocation failed while region is far from full");
+            s.tag_ = static_cast<unsigned char>(op);
+            memset(s.ptr_, s.tag_, s.size_);
+        }
+    }
+    for (auto& s : slots) {
+        alloc.deallocate(s.ptr_);
+    }
+    // requests are rounded up to the next second level class, so the largest block can't be fully requested
+    TOYTEST_ASSERT(alloc.allocate(15 << 20), "region is fragmented after freeing everything");
+    return true;
+}
+
+// 最坏情况延迟对比：尺寸在16B~256KB之间对数均匀分布，随机替换存活对象
+// glibc malloc在大尺寸上会走mmap/munmap，并在释放时合并、整理，最坏延迟远高于平均值
+bool TestTLSF_LatencyBenchmark() {
+    const size_t live = 1000;
+    const int ops = 200000;
+    std::mt19937 rng(7);
+    std::vector<size_t> sizes(ops);
+    std::vector<size_t> victims(ops);
+    for (int i = 0; i < ops; i++) {
+        double e = std::uniform_real_distribution<double>(4.0, 18.0)(rng);
+        sizes[i] = static_cast<size_t>(std::pow(2.0, e));
+        victims[i] = rng() % live;
+    }
+
+    auto run = [&](const char* name, std::function<void*(size_t)> alloc_fn, std::function<void(void*)> free_fn, bool report) {
+        std::vector<void*> slots(live, nullptr);
+        std::vector<long long> lat;
+        lat.reserve(ops);
+        size_t failures = 0;
+        for (int i = 0; i < ops; i++) {
+            void*& slot = slots[victims[i]];
+            auto start = std::chrono::steady_clock::now();
+            free_fn(slot);
+            slot = alloc_fn(sizes[i]);
+            auto end = std::chrono::steady_clock::now();
+            // touch the block like a real user would
+            if (slot) static_cast<char*>(slot)[0] = 1;
+            else failures++;
+            lat.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+        }
+        for (void* p : slots) {
+            free_fn(p);
+        }
+        if (!report) return;
+        std::sort(lat.begin(), lat.end());
+        std::cout << name << " free+alloc ns: p50 " << lat[ops / 2] << ", p99 " << lat[ops * 99 / 100]
+                  << ", p99.99 " << lat[ops - ops / 10000] << ", max " << lat.back() << ", failed allocations " << failures << std::endl;
+    };
+
+    // first pass of each allocator only faults pages in
+    tlsf_allocator alloc(size_t(128) << 20);
+    auto tlsf_alloc = [&alloc](size_t sz) { return alloc.allocate(sz); };
+    auto tlsf_free = [&alloc](void* p) { alloc.deallocate(p); };
+    run("tlsf  ", tlsf_alloc, tlsf_free, false);
+    run("tlsf  ", tlsf_alloc, tlsf_free, true);
+    run("malloc", malloc, free, false);
+    run("malloc", malloc, free, true);
+    return true;
+}
+
+int main() {
+    std::vector<std::string> passed, failed;
+    RUN_TEST("TLSF_SimpleTest", TestTLSF_SimpleTest, passed, failed);
+    RUN_TEST("TLSF_SanityTest", TestTLSF_SanityTest, passed, failed);
+    RUN_TEST_TIMER("TLSF_RandomTest", TestTLSF_RandomTest, passed, failed);
+    RUN_TEST_TIMER("TLSF_LatencyBenchmark", TestTLSF_LatencyBenchmark, passed, failed);
+
+    if (failed.empty()) {
+        std::cout << "All tests passed!" << std::endl;
+        return 0;
+    } else {
+        std::cout << "Some tests failed!" << std::endl;
+        std::cout << "Passed tests: ";
+        for (const auto& name : passed) {
+            std::cout << name << " ";
+        }
+        std::cout << std::endl;
+
+        std::cout << "Failed tests: ";
+        for (const auto& name : failed) {
+            std::cout << name << " ";
+        }
+        std::cout << std::endl;
+
+        return 1;
+    }
+}